@@ -10,52 +10,253 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <math.h>
+#include <tgmath.h> // type generic math functions, so that sqrt()/pow()/... of a real run in the precision it was built with
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <setjmp.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// the --stats counters are compiled in unless the program is built with -DRENDER_STATS=0 (make STATS=0), in which case every STAT() statement disappears
+#ifndef RENDER_STATS
+#define RENDER_STATS 1
+#endif
+#if RENDER_STATS
+#define STAT(statement) statement
+#else
+#define STAT(statement)
+#endif
+
+// the render math (compiled scene, hierarchy, rays and shading) runs in double precision unless the program is built with -DRENDER_FLOAT=1 (make FLOAT=1), which
+// halves the size of the scene and lets every SIMD instruction test twice as many spheres/rays; parsing and the hierarchy builder always stay in double precision
+#ifndef RENDER_FLOAT
+#define RENDER_FLOAT 0
+#endif
+#if RENDER_FLOAT
+typedef float real;
+#define REAL_NAME "float"
+#define BOUNDS_PAD 1e-5 // relative padding of the bounding boxes, large enough to cover float rounding in the slab test
+#else
+typedef double real;
+#define REAL_NAME "double"
+#define BOUNDS_PAD 1e-9
+#endif
+
+// vector types and intrinsics the SIMD kernels are written with, which hold reals of the build's precision (SSE(add) is _mm_add_pd, or _mm_add_ps in the float build)
+#if defined(__x86_64__) || defined(__i386__)
+#if RENDER_FLOAT
+typedef __m128 vec_sse;
+typedef __m256 vec_avx;
+typedef __m512 vec_avx512;
+typedef __mmask16 mask_avx512;
+#define SSE(op) _mm_##op##_ps
+#define AVX(op) _mm256_##op##_ps
+#define AVX512(op) _mm512_##op##_ps
+#define AVX512_CMP _mm512_cmp_ps_mask
+#else
+typedef __m128d vec_sse;
+typedef __m256d vec_avx;
+typedef __m512d vec_avx512;
+typedef __mmask8 mask_avx512;
+#define SSE(op) _mm_##op##_pd
+#define AVX(op) _mm256_##op##_pd
+#define AVX512(op) _mm512_##op##_pd
+#define AVX512_CMP _mm512_cmp_pd_mask
+#endif
+#define SSE_LANES (int)(sizeof(vec_sse) / sizeof(real)) // reals per vector
+#define AVX_LANES (int)(sizeof(vec_avx) / sizeof(real))
+#define AVX512_LANES (int)(sizeof(vec_avx512) / sizeof(real))
+#endif
 
 
 // function prototypes 
+struct render_scene; // forward declarations of structs defined further down which some of these prototypes take
+struct image_data;
+
 void read_scene(char* filename); // master function for parsing the input json file
 
-void raycasting(); // master function for raycasting and coloring pixels in the global image_data buffer
+void read_scene_list(char* filename); // reads the list of scene files (one per frame) given instead of a single json scene
+
+void read_keyframes(char* filename); // parses the --keyframes json file into the global keyframe list
+
+void animate_frame(int frame); // moves the parsed objects to where the keyframes put them in the given frame (relative to the animated camera)
+
+void numbered_output_name(char* output_file_name, int frame, char* out, int size); // turns out.ppm into out_0007.ppm for frame 7 of a batch
+
+int serve(char* socket_path); // runs the render server on the given unix domain socket (or host:port) until the process is killed
+
+void* serve_main(void* arg); // thread entry point of a render server worker, which keeps accepting connections and answering their requests
+
+void serve_connection(int fd); // answers every render request sent over one connection until the client hangs up
+
+int open_socket(char* address, int listening); // listens on (or connects to) a unix domain socket path or a TCP host:port, returning the socket (-1 on failure)
+
+int send_all(int fd, const char* data, size_t size); // writes all of the bytes to the socket, returning 0 if it can't
+
+void render_settings(char* out, size_t size); // describes the options which change what an image looks like, so a coordinator can check its workers render like it does
+
+void fail(); // exits after an error has been printed, or abandons just the scene being loaded when the render server set error_jump
+
+void raycasting(struct render_scene* rs, struct image_data* image, int width, int height); // master function for raycasting the compiled scene and coloring the pixels of the given image
 
 void write_image_data(char* output_file_name); // master function for writing image data from global image_data buffer to a ppm file (P6 in this case, as was recommended by the professor)
 
-double sphere_intersection(double* Ro, double* Rd, double* C, double r); // checks whether or not there's a sphere intersection
+void write_ppm(char* file_name, struct image_data* image, int width, int height); // writes the header and the given image to the given file in a single writev()
+
+void write_preview(char* output_file_name, struct image_data* image, int width, int height); // publishes the partly rendered image to the output file while rendering progressively
+
+int format_header(char* out, int size, int width, int height); // formats the ppm header of a width x height image into out and returns its length
+
+void map_image_data(char* output_file_name); // creates the output file at its final size and maps it so the global image_data buffer points straight into it
+
+double now_seconds(); // monotonic wall clock time in seconds, used to time the render phases
+
+void print_bench_report(char* input_file, int width, int height); // prints the phase times, ray counts and peak memory of the run as a single line of json
+
+void compare_image(char* file_name, struct image_data* image, int width, int height); // measures how far the rendered image is from the reference ppm given with --compare
+
+void print_stats_report(); // prints the merged --stats counters/timers either as a readable summary (stderr) or as a single line of json (stdout)
+
+real sphere_intersection(real* Ro, real* Rd, real* C, real r); // checks whether or not there's a sphere intersection (the original full quadratic, which --selftest checks the kernels against)
+
+real plane_hit(real* Ro, real* Rd, real px, real py, real pz, real nx, real ny, real nz); // plane intersection on the packed position/normal fields of the compiled scene
+
+// json_reader struct intended to hold the whole json file in memory (mmap'd when possible) along with the parser's position in it
+typedef struct json_reader
+{
+  const char* data;
+  size_t size;
+  size_t pos;
+  int mapped; // 1 when data is a mapping of the file, 0 when the file was read into a malloc'd buffer
+} json_reader;
+
+int open_json(char* filename, json_reader* json); // maps (or reads in) a whole json file and points the reader at its start (0 when it couldn't be read)
+
+void close_json(json_reader* json); // releases the memory open_json() got the file into
+
+void parse_scene(json_reader* json); // parses a whole json scene held in memory into the global object arena
+
+int parse_object(json_reader* json, int in_group); // parses one object of a scene (after its opening brace) into the object arena and returns its index
+
+int parse_group(json_reader* json); // parses the fields of a group object, moving its member spheres into the group_members arena, and returns the group's object index
+
+int find_group(char* name); // returns the index of the scene group with the given name (-1 if there's none)
+
+int parse_material(json_reader* json); // parses the fields of a material object into the scene_materials arena and returns the material's object index
+
+int find_material(char* name); // returns the index of the scene material with the given name (-1 if there's none)
+
+void parse_keyframes(json_reader* json); // parses a whole keyframe list held in memory into the global keyframe list
+
+int next_c(json_reader* json); // returns the next character of the json buffer and provides error checking and line number maintenance
+
+void expect_c(json_reader* json, int d); // checks that next character in file is d and displays error otherwise
+
+void skip_ws(json_reader* json); // skips over whitespace in json file
+
+void next_string(json_reader* json, char* buffer); // parses next string from json file into buffer (which must hold 129 characters)
+
+int next_key(json_reader* json, char* buffer); // parses the next key from json file into buffer and returns its interned KEY_ number (-1 for unknown keys)
+
+double next_number(json_reader* json); // parses next number from json file
+
+void next_vector(json_reader* json, double* v); // parses next vector from json file into v
+
+void normalize(real* v); // normalizes the given vector
+
+void copy_vector(real* out, double* v); // copies a parsed vector into the compiled scene, rounding it to real
+
+real sqr(real v); // squares the given value
+
+real clamp (real value); // checks color range of value
+
+void diffuse_calculation(real n[3], real l[3], real il[3], real kd[3], real* output); // performs diffuse color calculation
+
+void specular_calculation(real n[3], real l[3], real il[3], real ks[3], real v[3], real r[3], real ns, real* output); // performs specular color calcuation
+
+void specular_calculation_int(real n[3], real l[3], real il[3], real ks[3], real v[3], real r[3], int ns, real* output); // performs specular color calculation for a whole number exponent without pow()
+
+real ipow(real base, int exponent); // raises base to a non-negative whole number power by repeated squaring
+
+void shoot(real Ro[3], real Rd[3], real distance, int current_index, real* final_distance, int* final_index); // shoots a ray out into the scene and indirectly returns the intersection distance/object index
+
+void reflect_vector(real* d, real* p, int index, real* output); // calculates reflected vector
+
+void refract_vector(real* d, real* p, int external_ior, int index, real* output); // calculates refracted vector
+
+int new_object(); // appends a zeroed object to the global object arena (growing it if needed) and returns its index
+
+int new_group(); // appends an empty group to the global scene_groups (growing it if needed) and returns its index
+
+int new_material(); // appends an empty material to the global scene_materials (growing it if needed) and returns its index
+
+void free_scene(); // frees the object arena along with every other global buffer in one shot
 
-double plane_intersection(double* Ro, double* Rd, double* C, double* n); // checks whether or not there's a plane intersection
+int shoot_any(real Ro[3], real Rd[3], real distance, int current_index); // returns 1 as soon as any object is hit within distance (shadow rays only need to know that something is in the way)
 
-int next_c(FILE* json); // wraps the getc() function and provides error checking and line number maintenance
+int occluded(real Ro[3], real Rd[3], real distance, int current_index, int* last_occluder); // shadow ray query which tests the light's last occluder before falling back to shoot_any(), recording whichever object blocked the ray
 
-void expect_c(FILE* json, int d); // checks that next character in file is d and displays error otherwise
+void compile_scene(struct render_scene* rs); // builds the immutable render scene (packed spheres/planes, surfaces, materials and lights with all per-object setup done) and its bounding volume hierarchy
 
-void skip_ws(FILE* json); // skips over whitespace in json file
+void update_compiled_scene(); // compiles the render scene, or only refreshes it in place and refits its hierarchy when the objects are the same kinds in the same order as last frame's
 
-char* next_string(FILE* json); // parses next string from json file
+void compile_groups(struct render_scene* rs); // compiles every group of the scene into a render scene of its own, ready to be placed by the instances
 
-double next_number(FILE* json); // parses next number from json file
+void build_instance_bvh(struct render_scene* rs); // builds the bounding volume hierarchy over the compiled instances, reordering them so every leaf covers a contiguous range
 
-double* next_vector(FILE* json); // parses next vector from json file
+void build_light_bvh(struct render_scene* rs); // works out how far every light reaches and builds the bounding volume hierarchy over the lights' reach
 
-void normalize(double* v); // normalizes the given vector
+void free_light_bvh(struct render_scene* rs); // frees the light radii and the light hierarchy
 
-double sqr(double v); // squares the given double value
+int light_candidates(struct render_scene* rs, real* point, unsigned long long* mask, int* out); // lists (in index order) the lights whose bounds hold the point and returns how many there are
 
-double clamp (double value); // checks color range of value
+void free_compiled_scene(struct render_scene* rs); // frees a compiled render scene along with its hierarchy (and its groups)
 
-void diffuse_calculation(double n[3], double l[3], double il[3], double kd[3], double* output); // performs diffuse color calculation
+void free_group_scenes(struct render_scene* rs); // frees the render scenes of the groups compiled for a render scene
 
-void specular_calculation(double n[3], double l[3], double il[3], double ks[3], double v[3], double r[3], double ns, double* output); // performs specular color calcuation
+void build_bvh(struct render_scene* rs); // builds the bounding volume hierarchy over the compiled spheres, reordering them so every leaf covers a contiguous range
 
-void shoot(double Ro[3], double Rd[3], double distance, int current_index, double* final_distance, int* final_index); // shoots a ray out into the scene and indirectly returns the intersection distance/object index
+double refit_bvh(struct render_scene* rs); // recomputes the bounds of every hierarchy node around the spheres' current positions and returns the nodes' summed surface area
 
-void reflect_vector(double* d, double* p, int index, double* output); // calculates reflected vector
+void sphere_bounds(struct render_scene* rs, int slot, double* min, double* max); // padded bounding box of a compiled sphere, shared by the builder and refit_bvh()
 
-void refract_vector(double* d, double* p, int external_ior, int index, double* output); // calculates refracted vector
+double box_area(real* min, real* max); // surface area of a bounding box
+
+int is_scene_file(char* filename); // returns 1 when the file name ends in .rts, the extension of binary scene files
+
+void convert_scene(char* input_file, char* output_file); // parses and compiles a json scene and writes it out as a binary scene file (the --convert subcommand)
+
+void write_scene_file(char* filename, struct render_scene* rs, int with_bvh); // writes the compiled render scene (and its hierarchy when with_bvh is set) to a binary scene file
+
+void load_scene_file(char* filename, struct render_scene* rs); // maps a binary scene file and points the render scene's arrays straight into it
+
+void check_scene_file(char* name, const char* data, size_t size); // validates the header and every index of a binary scene file held in memory before any of it is used
+
+void bind_scene_file(struct render_scene* rs, char* data); // points the render scene's arrays into a checked binary scene file held in memory
+
+void scene_file_arrays(struct render_scene* rs, void** fields[], size_t sizes[]); // lists the render scene's arrays in the order binary scene files store them, along with their sizes
 
 
 // object struct typedef'd as Object intended to hold any of the specified objects in the given scene (.json) file
 typedef struct {
-  int kind; // 0 = camera, 1 = sphere, 2 = plane, 3 = light
+  int kind; // 0 = camera, 1 = sphere, 2 = plane, 3 = light, 4 = group, 5 = instance, 6 = material
   union {
     struct {
       double width;
@@ -69,6 +270,7 @@ typedef struct {
 	  double reflectivity;
 	  double refractivity;
 	  double ior;
+	  double shininess; // specular exponent
     } sphere;
     struct {
 	  double diffuse_color[3];
@@ -78,6 +280,7 @@ typedef struct {
 	  double reflectivity;
 	  double refractivity;
 	  double ior;
+	  double shininess; // specular exponent
     } plane;
     struct {
 	  int kind_light; // 0 = point light, 1 = spot light, 2 = reflection/refraction off an object
@@ -90,17 +293,518 @@ typedef struct {
 	  double angular_a0;
 	  double theta;
     } light;
+    struct {
+	  int index; // index into the global scene_groups
+    } group;
+    struct {
+	  int group; // index into the global scene_groups
+	  double position[3];
+	  double scale;
+    } instance;
+    struct {
+	  int index; // index into the global scene_materials
+    } material;
   };
 } Object;
 
-// numerous function prototypes placed after Object struct as they require it to be defined as a parameter
-double frad(Object* light, double dl); // performs radial attenuation
+// scene_group struct intended to hold a group read in from the scene file, i.e. a prototype whose member spheres are stored once (in the global group_members arena) and placed by any number of instances
+typedef struct scene_group
+{
+  char name[129];
+  int first; // index of the group's first member in group_members
+  int count;
+} scene_group;
+
+// scene_material struct intended to hold a named material read in from the scene file, whose shading fields are copied into every sphere/plane that refers to it by name
+typedef struct scene_material
+{
+  char name[129];
+  double diffuse_color[3];
+  double specular_color[3];
+  double shininess;
+  double reflectivity;
+  double refractivity;
+  double ior;
+} scene_material;
+
+// function prototypes for compiling lists of objects placed after the Object struct as they require it to be defined as a parameter
+void compile_objects(struct render_scene* rs, Object* list, int count); // packs the given objects into a render scene (its sphere/plane/light/instance arrays, surfaces and materials) and builds its hierarchy
+
+void compile_object(struct render_scene* rs, Object* list, int i); // copies object i of the list into its slot of the compiled scene (sphere/plane arrays, surface, light or instance)
+
+void compile_materials(struct render_scene* rs, Object* list, int count); // gathers the distinct materials of the listed spheres/planes into the render scene and points each surface at its own
+
+// render_light struct intended to hold the compiled, render-time copy of a light with everything that doesn't depend on the shaded point worked out up front
+typedef struct render_light
+{
+  int kind_light; // 0 = point light, 1 = spot light, 2 = reflection/refraction off an object
+  real color[3];
+  real position[3];
+  real direction[3]; // unit spot light direction
+  real radial_a2; // never 0 (replaced by 1)
+  real radial_a1;
+  real radial_a0;
+  real angular_a0;
+  int angular_power; // angular_a0 as an int when it's a whole number no larger than MAX_WHOLE_POWER (fang() then raises to it with ipow()), -1 otherwise
+  real cos_theta; // cosine of the spot light's half angle
+} render_light;
+
+// numerous function prototypes placed after the light structs as they require them to be defined as a parameter
+real frad(render_light* light, real dl); // performs radial attenuation
+
+real fang(render_light* light, real direction[3]); // performs angular attenuation
+
+double light_reach(render_light* light); // distance beyond which the light is culled under --light-cutoff (INFINITY without it)
+
+real light_importance(render_light* light, real distance, real light_to_point[3]); // estimate of how much the light adds to a point, which --light-samples draws lights by
+
+void light_bounds(render_light* light, double radius, double* min, double* max); // padded bounding box of the region the light can reach
+
+void direct_shade(real Ron[3], real Rdn[3], real Rd[3], real distance_to_light, int best_i, render_light* light, real* color); // uses a light source to compute diffuse/specular/frad/fang calculations and adds it to given color vector
+
+// path_ray struct intended to hold a pending reflected/refracted ray of shade() along with its throughput weight (the factor its color is scaled by before it ends up in the pixel)
+typedef struct path_ray
+{
+  real Ro[3];
+  real Rd[3];
+  real t; // distance to the object it hit
+  int index; // index of the object it hit
+  int ior; // index of refraction of the object it hit
+  int depth;
+  real weight[3];
+} path_ray;
+
+void bounce_ray(path_ray* ray, real Ron[3], int b, real* Ro_bounce, real* Rd_bounce); // sets up the reflected (b = 0) or refracted (b = 1) secondary ray of a hit
+
+
+
+// tile struct typedef'd as tile intended to hold the pixel bounds [x0, x1) x [y0, y1) of one square section of the image
+typedef struct tile
+{
+  int x0, y0;
+  int x1, y1;
+} tile;
+
+// tile_queue struct intended to hold the range [head, tail) of tile indices currently owned by one render worker; the owner pops from the head while idle workers steal from the tail
+typedef struct tile_queue
+{
+  pthread_mutex_t lock;
+  int head;
+  int tail;
+} tile_queue;
+
+// render_job struct intended to hold everything the render workers share while rendering a frame (all of it read-only except the tile queues)
+typedef struct render_job
+{
+  int M; // image height in pixels
+  int N; // image width in pixels
+  double cx, cy; // camera center
+  double pixheight;
+  double pixwidth;
+  tile* tiles;
+  int tile_count;
+  tile_queue* queues;
+  int queue_count;
+  int pass; // 0 = one ray through every pixel center, 1 = adaptive anti-aliasing of the pixels which need it
+  int step; // grid step of the current progressive pass (0 when not rendering progressively)
+  real* base_color; // clamped color of every pixel's center ray (3 per pixel), kept only when anti-aliasing
+  int* base_id; // object hit by every pixel's center ray (-1 for none), kept only when anti-aliasing
+  struct render_scene* scene; // compiled scene being rendered
+  struct image_data* image; // image being rendered into, which holds just the pixels of the window (row by row)
+  tile window; // part of the N x M image which is rendered (all of it, except for the tiles a distributed render hands out)
+  tile refine; // part of the window whose pixels the anti-aliasing pass may refine (the window minus the neighbours it only needs for comparing)
+} render_job;
+
+// ray_counts struct intended to hold how many rays of each type were traced, kept per render worker and summed up once rendering is done
+typedef struct ray_counts
+{
+  long long primary;
+  long long secondary; // reflected/refracted rays
+  long long shadow;
+} ray_counts;
+
+// render_stats struct intended to hold the --stats counters of one render worker (merged into stats_totals once rendering is done); only updated through STAT()
+typedef struct render_stats
+{
+  long long reflection_rays;
+  long long refraction_rays;
+  long long hit_checks; // any-hit queries for secondary rays which weren't worth tracing but decide whether the object's own color shows
+  long long traversals; // closest/any-hit queries made against the whole scene
+  long long box_tests; // hierarchy nodes tested
+  long long sphere_tests;
+  long long plane_tests;
+  long long occluder_hits; // shadow rays answered by the light's cached occluder
+  long long lights_culled; // lights skipped at a shaded point (and their shadow rays with them) because the point is out of their reach
+  long long shaded; // hits shaded (primary and secondary)
+  long long depth_sum; // sum of the bounce depth of every shaded hit
+  int depth_max;
+  long long depth_cutoffs; // secondary rays not traced because of --max-depth
+  long long weight_cutoffs; // secondary rays not traced because of --min-weight
+  long long refined_pixels; // pixels supersampled by the anti-aliasing pass
+  int tiles;
+  double busy_seconds; // time spent rendering tiles
+} render_stats;
+
+// render_worker struct intended to hold the per-thread state of a single render worker
+typedef struct render_worker
+{
+  int id; // also the index of the worker's own tile queue
+  pthread_t thread;
+  render_job* job;
+  path_ray* stack; // per-thread scratch stack of pending secondary rays used by shade(), allocated once per render
+  ray_counts rays;
+  render_stats stats;
+  int* occluders; // per-thread cache of the object which last blocked each light (-1 until one has), tested first by the next shadow ray towards that light
+  int* near_lights; // per-thread scratch list of the lights whose bounds hold the point being shaded (see light_candidates())
+  unsigned long long* near_mask; // per-thread scratch bitmask (one bit per light, all clear between calls) which light_candidates() sorts the lights with
+  real* light_weights; // per-thread scratch running sum of the near lights' importance (see light_importance()), which --light-samples draws the lights it shades from
+  unsigned int random_state; // light sampling random stream, reseeded from the pixel and sample before every primary sample so the image doesn't depend on the thread count
+} render_worker;
+
+void shade(render_worker* worker, real Ro[3], real Rd[3], real best_t, int best_i, real* color); // master shade function which shades a hit along with all of its reflected/refracted rays using the worker's ray stack
+
+// function prototypes for the tiled renderer placed after the render structs as they require them to be defined as parameters
+void raycasting_window(struct render_scene* rs, struct image_data* image, int width, int height, tile* window, tile* refine); // raycasts just one window of the image into an image of the window's size
+
+void render_pixel(render_worker* worker, int x, int y); // shoots/shades the primary ray through pixel (x, y) and stores its color directly in the job's image
+
+void render_tile(render_worker* worker, tile* t); // renders every pixel of the given tile
+
+void primary_ray(render_job* job, double sx, double sy, real* Rd); // computes the normalized direction of the primary ray through image position (sx, sy), measured in pixels (pixel centers sit at x + 0.5)
+
+void finish_pixel(render_worker* worker, int x, int y, real* Rd, real best_t, int best_i); // shades the closest hit of the primary ray through pixel (x, y) and stores its color in the job's image
+
+void shade_primary(render_worker* worker, real* Rd, real best_t, int best_i, int x, int y, int stream, real* color); // shades the closest hit (if any) of a primary ray through pixel (x, y) spp times and returns its clamped average color
+
+void refine_tile(render_worker* worker, tile* t); // supersamples the pixels of the tile whose center ray disagrees with a neighbour's (second pass of anti-aliasing)
+
+int pixel_index(render_job* job, int x, int y); // index of pixel (x, y) of the image in the job's image and anti-aliasing buffers, which only hold the window
+
+int needs_refinement(render_job* job, int x, int y); // checks whether pixel (x, y) differs from any of its neighbours by object hit or by color
+
+void run_pass(render_job* job, render_worker* workers, int pass); // hands out every tile again and renders them all on the worker threads
+
+double pixel_random(int x, int y, int sample); // deterministic pseudo random number in [0, 1) for the given pixel and sample number
+
+unsigned int pixel_hash(int x, int y, int sample); // hash of the pixel and sample number which pixel_random() and the light sampling streams are made from
+
+double next_random(render_worker* worker); // next pseudo random number in [0, 1) of the worker's light sampling stream
+
+void render_tile_packets(render_worker* worker, tile* t); // renders the tile in square packets of primary rays which walk the hierarchy together
+
+void render_tile_progressive(render_worker* worker, tile* t); // renders the pixels of the tile on the current progressive pass's grid, filling the block each one stands for
+
+int next_tile(render_job* job, int id); // pops the next tile index from the worker's own queue, stealing from another worker's queue once it's empty (-1 when all tiles are taken)
+
+void* render_worker_main(void* arg); // thread entry point which keeps rendering tiles until there are none left
+
+
+#define SHADE_DIFFUSE 0 // material classes, each of which direct_shade() has its own kernel for: no specular color at all, so the specular term is left out
+#define SHADE_WHOLE_POWER 1 // a specular term whose shininess is a whole number no larger than MAX_WHOLE_POWER, raised with ipow()
+#define SHADE_POWER 2 // any other shininess, raised with pow()
+#define SHADE_CLASSES 3
+#define MAX_WHOLE_POWER 1024 // largest exponent raised with ipow() rather than pow()
+
+// material struct intended to hold the shading-only fields of a sphere or plane, which are only needed once a hit has been found. Objects with identical fields share one
+// material (see compile_materials()), so every one of them is filled in through a memset() copy which leaves no stray padding bytes to tell them apart
+typedef struct material
+{
+  real diffuse_color[3];
+  real specular_color[3];
+  real reflectivity;
+  real refractivity;
+  real ior;
+  real shininess; // specular exponent
+  int shading; // material class (SHADE_DIFFUSE, SHADE_WHOLE_POWER or SHADE_POWER), which picks the direct_shade() kernel
+  int power; // shininess as an int for SHADE_WHOLE_POWER
+} material;
+
+// surface struct intended to hold the geometry of a sphere or plane needed to shade a hit on it (its normal) along with its material, indexed by object index
+typedef struct surface
+{
+  int kind; // 1 = sphere, 2 = plane (anything else is never hit)
+  real position[3]; // sphere center
+  real normal[3]; // unit plane normal
+  int slot; // index of the sphere/plane in the packed arrays (or of the light in the lights array)
+  int material; // index of the sphere/plane's material in the render scene's materials
+} surface;
+
+// bvh_node struct intended to hold one node of the flattened bounding volume hierarchy; an inner node's left child is stored right after it while offset holds the index of its right child, and a leaf holds the count compiled spheres starting at offset
+typedef struct bvh_node
+{
+  real min[3];
+  real max[3];
+  int offset;
+  int count; // 0 for inner nodes
+} bvh_node;
+
+// render_instance struct intended to hold the compiled copy of an instance. Its group's spheres are traced in the group's own space, which a ray enters as (Ro - position) / scale with
+// its direction unchanged, so the distances found there only have to be multiplied by scale
+typedef struct render_instance
+{
+  real position[3];
+  real scale;
+  real inv_scale;
+  int group; // index into the render scene's groups
+  int object; // object index of the instance
+  int first_id; // hit index of the group's first sphere placed by this instance (object_count + object * instance_stride), the rest follow in group order
+} render_instance;
+
+// render_scene struct intended to hold the compiled, render-time copy of the scene; the fields read by the intersection loops are packed into one array per field (structure of arrays) while everything else lives in the cold surfaces and materials arrays
+typedef struct render_scene
+{
+  int sphere_count;
+  real* sphere_cx;
+  real* sphere_cy; // sphere centers
+  real* sphere_cz;
+  real* sphere_r2; // sphere radius squared
+  real* sphere_cc; // squared length of the center minus radius squared (the ray independent part of the quadratic's c term)
+  int* sphere_id; // object index of each sphere
+  
+  int plane_count;
+  real* plane_nx;
+  real* plane_ny; // unit plane normals
+  real* plane_nz;
+  real* plane_px;
+  real* plane_py; // plane positions
+  real* plane_pz;
+  int* plane_id; // object index of each plane
+  
+  int material_count;
+  material* materials; // one of each distinct material of the spheres/planes, indexed by their surfaces' material field
+  surface* surfaces; // indexed by object index
+  
+  int light_count;
+  render_light* lights;
+  
+  int object_count; // number of objects the scene was compiled from (surfaces/materials have this many entries)
+  
+  bvh_node* nodes; // bounding volume hierarchy over the spheres (planes have no bounds so they're tested against every ray after the hierarchy)
+  int node_count;
+  double build_area; // summed surface area of the hierarchy's nodes right after it was built
+  
+  double camera_width; // size of the camera's view plane, taken from the camera object
+  double camera_height;
+  
+  char* storage; // binary scene file every array points into when the scene was loaded from one (see load_scene_file()), NULL when compile_scene() allocated them one by one
+  size_t storage_size;
+  int storage_mapped; // storage is a private mapping of the file rather than a malloc'd copy
+  int nodes_built; // the file had no hierarchy so nodes was built (and allocated) after loading it
+  
+  int group_count;
+  struct render_scene* groups; // every group compiled on its own (spheres, materials and hierarchy in the group's space), shared by all of its instances
+  int instance_stride; // number of spheres in the largest group, which spaces out the hit indices of the instances
+  int instance_count;
+  render_instance* instances;
+  bvh_node* instance_nodes; // bounding volume hierarchy over the instances' world space bounds, whose leaves hold instances instead of spheres
+  int instance_node_count;
+  
+  real* light_radius; // distance from each light beyond which it's culled (INFINITY unless --light-cutoff is set); this and the light hierarchy are never stored in binary scene files
+  int* light_order; // light indices in the order the light hierarchy's leaves cover them
+  bvh_node* light_nodes; // bounding volume hierarchy over the regions the lights can reach (their radius, narrowed to the spot cone for spot lights), see build_light_bvh()
+  int light_node_count;
+} render_scene;
+
+#define SCENE_FILE_MAGIC "RTSCENE" // first 8 bytes of a binary scene file (including the terminating 0)
+#define SCENE_FILE_VERSION 2 // bumped whenever the layout of the file or of the structs stored in it changes
+#define SCENE_FILE_ALIGN 64 // every array of a binary scene file starts at a multiple of this many bytes into the file (a cache line, and the widest SIMD load)
+#define SCENE_FILE_ARRAYS 17 // number of arrays stored, in the order listed by scene_file_arrays()
+
+// scene_file_header struct intended to hold the header at the start of a binary scene file, which is the render scene itself laid out as it is in memory (arrays of reals,
+// materials, surfaces, lights and hierarchy nodes) so a mapped file can be rendered without being parsed
+typedef struct scene_file_header
+{
+  char magic[8]; // SCENE_FILE_MAGIC
+  int version; // SCENE_FILE_VERSION
+  int byte_order; // 0x01020304 as stored by the machine that wrote the file
+  int real_size; // sizeof(real) of the build that wrote the file, which has to match the one reading it
+  int struct_sizes[4]; // sizes of material, surface, render_light and bvh_node, so a build whose structs are laid out differently refuses the file
+  int object_count;
+  int material_count;
+  int sphere_count;
+  int plane_count;
+  int light_count;
+  int node_count; // 0 when the file was written without its hierarchy, which is then built when it's loaded
+  double build_area;
+  double camera_width;
+  double camera_height;
+  unsigned long long offsets[SCENE_FILE_ARRAYS]; // where each array starts, in bytes from the start of the file
+  unsigned long long file_size;
+} scene_file_header;
+
+// keyframe struct intended to hold one entry of the --keyframes file: where an object (or the camera) is in a given frame
+typedef struct keyframe
+{
+  int frame;
+  int object; // index of the object in the scene file (0-indexed like the parser's error messages)
+  double position[3]; // stored flipped the same way the parser flips the object's own position
+} keyframe;
+
+// cached_scene struct intended to hold one parsed and compiled scene of the render server's cache, which is keyed by a hash of the scene file's contents
+typedef struct cached_scene
+{
+  unsigned long long hash; // hash_bytes() of the scene file
+  size_t size; // length of the scene file, compared along with the hash
+  render_scene scene;
+  int users; // renders currently tracing the scene, which keep it from being evicted
+  int cached; // 0 when the scene didn't fit in a full cache (every cached scene was being rendered), so its last user frees it
+  unsigned long long last_used; // cache_clock when the scene was last looked up; the smallest one is evicted first
+} cached_scene;
+
+// function prototypes for the render server's scene cache placed after the cached_scene struct as they require it
+cached_scene* acquire_scene(json_reader* json, int* hit); // looks the scene up in the cache (parsing and compiling it on a miss) and takes a use on it, or returns NULL if it doesn't parse
+
+void release_scene(cached_scene* entry); // gives back a use taken by acquire_scene()
+
+cached_scene* lookup_scene(unsigned long long hash, size_t size); // takes a use on the cached scene with the given hash and size, or returns NULL when it isn't cached
+
+int serve_scene(int fd, FILE* in, char* request, cached_scene** current); // answers a "scene" request by making the scene the connection's current one (0 when the connection has to be dropped)
+
+void serve_tile(int fd, char* request, cached_scene* current); // answers a "tile" request by rendering the tile of the connection's current scene and sending back its pixels
+
+// dist_worker struct intended to hold the coordinator's connection to one render server of --workers, along with the tile it's rendering and the part of its reply received so far
+typedef struct dist_worker
+{
+  char* address;
+  int fd; // -1 once the worker died, stalled or answered out of turn; it isn't used again
+  int tile; // index of the tile it's rendering (-1 while idle)
+  double deadline; // now_seconds() by which the tile (or the answer to the scene) has to be back
+  char* reply; // bytes received but not used yet
+  size_t reply_size;
+  size_t reply_capacity;
+  size_t expected; // number of pixel bytes following the "tile LENGTH" line of the reply being received (0 while still waiting for that line)
+} dist_worker;
+
+// function prototypes for the distributed renderer placed after the dist_worker struct as they require it
+void distribute_frame(char* scene_file, struct image_data* image, int width, int height); // renders the frame by handing its tiles out to the --workers, putting the image together from their replies
+
+void connect_workers(); // connects to every render server of --workers (once, on the first frame)
+
+void check_scene_answer(dist_worker* w, char* line); // drops the worker unless it answered the scene request with "ok" and the same render settings as ours
+
+void drop_worker(dist_worker* w, char* reason); // closes the connection to a worker which died, stalled or answered out of turn, so it's never used again
+
+int receive_reply(dist_worker* w); // reads whatever the worker has sent into its reply buffer, returning 0 when it hung up
+
+int take_reply_line(dist_worker* w, char* line, size_t size); // moves the first complete line out of the worker's reply buffer (0 when there's none yet)
+
+int wait_reply_line(dist_worker* w, char* line, size_t size); // waits (until the worker's deadline) for the next line of its reply, returning 0 when it doesn't come
+
+int render_image_tile(struct render_scene* rs, int width, int height, struct tile* t, struct image_data* pixels); // renders one tile of the image into pixels of the tile's size, exactly as a whole image render would (0 when out of memory)
+
+void copy_tile_pixels(struct image_data* image, int width, struct tile* t, const char* pixels); // puts the tile's pixels (packed rgb, row by row) into their place in the image
+
+unsigned long long hash_bytes(const char* data, size_t size); // 64 bit FNV-1a hash of the given bytes
+
+// ray_info struct intended to hold a ray along with the terms of the sphere quadratic which only depend on the ray, so the sphere kernels compute them once per ray instead of once per sphere
+typedef struct ray_info
+{
+  real o[3]; // origin
+  real d[3]; // direction (normalized)
+  real o_d; // origin dot direction
+  real o_o; // origin dot origin
+  render_scene* scene; // render scene whose packed spheres the kernels intersect (the active scene, or the group of an instance the ray has been moved into)
+} ray_info;
+
+// function prototypes for the sphere kernels placed after the ray_info struct as they require it to be defined as a parameter
+void setup_ray(real Ro[3], real Rd[3], ray_info* ray); // fills in a ray_info for the given ray (against the active scene)
+
+real sphere_hit(ray_info* ray, real cx, real cy, real cz, real cc); // sphere intersection on the packed center/cc fields of the compiled scene
+
+void sphere_kernel_scalar(ray_info* ray, int start, int count, real* t_out); // intersects the ray with count packed spheres one at a time
+
+void select_simd_kernels(char* name); // picks the widest sphere/packet kernels the cpu supports (or the ones named on the command line)
+
+int simd_kernels_supported(char* name); // checks whether the cpu can run the sphere kernel with the given name
+
+int run_selftest(); // checks that every sphere kernel picks the same nearest hit as sphere_intersection() over random rays and spheres (--selftest)
+
+int selftest_ambiguous(real* Ro, real* Rd, real* C, real r, double tolerance); // whether the ray grazes the sphere or starts on its surface, where rounding may put the formulas on opposite sides
+
+// bvh_item struct intended to hold the bounds of one primitive while the hierarchy is being built
+typedef struct bvh_item
+{
+  double min[3];
+  double max[3];
+  double centroid[3];
+  int prim; // index into the compiled sphere (or instance) arrays
+} bvh_item;
+
+// function prototypes for the bounding volume hierarchy placed after the bvh structs as they require them to be defined as parameters
+int bvh_build_node(bvh_node* nodes, int* node_count, bvh_item* items, int start, int end, int depth); // recursively builds the node for items [start, end) into nodes using the surface area heuristic and returns its index
+
+int bvh_traverse(real Ro[3], real Rd[3], real distance, int current_index, int any_hit, real* best_t, int* best_i); // walks the hierarchy (and the planes) looking for the closest hit, or for any hit when any_hit is set
+
+int sphere_bvh_walk(ray_info* ray, real inv_Rd[3], real distance, int current_index, int any_hit, real scale, int id_base, real* best_t, int* best_i); // walks the sphere hierarchy of the ray's scene (the active scene or a group)
+
+int instance_traverse(real Ro[3], real Rd[3], real inv_Rd[3], real distance, int current_index, int any_hit, real* best_t, int* best_i); // walks the instance hierarchy and, inside every instance entered, its group's hierarchy
+
+render_instance* hit_instance(int index); // instance which placed the sphere with the given hit index (one past the active scene's objects)
+
+material* hit_material(int index); // material of the object or instanced sphere with the given hit index
+
+surface* hit_surface(int index, surface* scratch); // surface of the object or instanced sphere with the given hit index, in world space
+
+int ray_box(real Ro[3], real inv_Rd[3], real* min, real* max, real t_limit); // slab test which checks whether the ray enters the box before t_limit
+
+
+// interned key names: next_key() looks every key up once and parse_scene() compares the returned numbers, which index json_keys
+#define KEY_TYPE 0
+#define KEY_WIDTH 1
+#define KEY_HEIGHT 2
+#define KEY_RADIUS 3
+#define KEY_RADIAL_A2 4
+#define KEY_RADIAL_A1 5
+#define KEY_RADIAL_A0 6
+#define KEY_ANGULAR_A0 7
+#define KEY_THETA 8
+#define KEY_REFLECTIVITY 9
+#define KEY_REFRACTIVITY 10
+#define KEY_IOR 11
+#define KEY_COLOR 12
+#define KEY_DIFFUSE_COLOR 13
+#define KEY_SPECULAR_COLOR 14
+#define KEY_POSITION 15
+#define KEY_NORMAL 16
+#define KEY_DIRECTION 17
+#define KEY_FRAME 18
+#define KEY_OBJECT 19
+#define KEY_NAME 20
+#define KEY_OBJECTS 21
+#define KEY_GROUP 22
+#define KEY_SCALE 23
+#define KEY_SHININESS 24
+#define KEY_MATERIAL 25
+#define KEY_COUNT 26
+
+const char* json_keys[KEY_COUNT] = {"type", "width", "height", "radius", "radial-a2", "radial-a1", "radial-a0", "angular-a0", "theta", "reflectivity", "refractivity", "ior", "color", "diffuse_color", "specular_color", "position", "normal", "direction", "frame", "object",
+                                    "name", "objects", "group", "scale", "shininess", "material"};
+
+#define PACKET_MAX 8 // largest supported packet width/height in pixels
+#define PACKET_LANES (PACKET_MAX * PACKET_MAX)
 
-double fang(Object* light, double direction[3], double theta); // performs angular attenuation
+// ray_packet struct intended to hold a square bundle of primary rays (one lane per ray, stored as separate arrays so the packet kernels can load several lanes at once) along with each lane's closest hit
+typedef struct ray_packet
+{
+  int lanes;
+  real dx[PACKET_LANES];
+  real dy[PACKET_LANES]; // normalized directions
+  real dz[PACKET_LANES];
+  real inv_dx[PACKET_LANES];
+  real inv_dy[PACKET_LANES]; // reciprocal directions for the slab tests
+  real inv_dz[PACKET_LANES];
+  real o[3]; // origin shared by every lane
+  real o_d[PACKET_LANES]; // origin dot direction (see ray_info)
+  int active[PACKET_LANES]; // 0 for lanes outside the image
+  real best_t[PACKET_LANES]; // -INFINITY for inactive lanes so they never enter a node or record a hit
+  int best_i[PACKET_LANES];
+} ray_packet;
+
+void packet_traverse(ray_packet* packet); // walks the hierarchy once for the whole packet and finds the closest hit of every lane
 
-void direct_shade(double Ron[3], double Rdn[3], double Rd[3], double distance_to_light, int best_i, Object* light, double* color); // uses a light source to compute diffuse/specular/frad/fang calculations and adds it to given color vector
+int packet_enter_scalar(ray_packet* packet, bvh_node* node); // returns 1 if any lane of the packet enters the node before its closest hit so far
 
-void shade(double Ro[3], double Rd[3], double best_t, int best_i, Object** lights, int ior, int depth, double* color); // master shade function which is recursively called and handles shading
+void packet_sphere_scalar(ray_packet* packet, real cx, real cy, real cz, real c, int i); // intersects every lane of the packet with one packed sphere, updating each lane's closest hit
 
 
 // header_data buffer which is intended to contain all relevant header information of ppm file
@@ -127,1513 +831,6455 @@ header_data *header_buffer;
 // global image_data buffer
 image_data *image_buffer;
 
-// global set of objects from json file
-Object** objects;
+int bench_report = 0; // set from the command line; prints a json report of the run to stdout (see print_bench_report())
+char* compare_file = NULL; // reference image given with --compare (e.g. the same scene rendered by the double build), numbered per frame like the output of a batch
+int compare_max_diff = -1; // largest per channel difference from the reference image (0-255), -1 when nothing was compared
+long long compare_diff_pixels = 0; // number of pixels which differ from the reference image at all
+double parse_seconds = 0; // wall time spent in each phase of the run
+double build_seconds = 0; // (compiling the render scene and building its hierarchy)
+double render_seconds = 0;
+double write_seconds = 0;
+
+int map_output = 0; // set from the command line; renders straight into an mmap'd output file instead of a malloc'd image_buffer
+unsigned char* output_map = NULL; // the mapped output file (header followed by the pixels image_buffer points at), NULL when image_buffer was malloc'd
+size_t output_map_size = 0;
+int output_fd = -1;
+
+// global set of objects from json file, stored contiguously in one arena which grows geometrically as objects are read in
+Object* objects;
+int object_count = 0; // number of objects currently in the arena
+int object_capacity = 0; // number of objects the arena has room for before it has to grow
+
+// global groups of the scene file along with their member spheres, which are kept out of the object arena (so only the group itself takes up an object index) and are only ever
+// rendered through instances
+scene_group* scene_groups = NULL;
+int scene_group_count = 0;
+int scene_group_capacity = 0;
+Object* group_members = NULL;
+int group_member_count = 0;
+int group_member_capacity = 0;
+
+// global named materials of the scene file; like a group, a material only takes up one object index, and the spheres/planes using it get copies of its fields when they're parsed
+scene_material* scene_materials = NULL;
+int scene_material_count = 0;
+int scene_material_capacity = 0;
 
 double glob_width = 0; // global width, intended to store camera width
 double glob_height = 0; // global height, intended to store camera height
 
+int thread_count = 0; // number of render threads, set from the command line (defaults to the number of online cores)
+
+int max_depth = 7; // max number of reflection/refraction bounces followed from a primary hit, set from the command line
+
+double min_weight = 0; // secondary rays whose color would be scaled by less than this (in every channel) aren't traced, set from the command line (0 only drops rays that can't contribute at all)
+double light_cutoff = 0; // lights are culled where their radial attenuation times their brightest channel falls below this, set from the command line (0 never culls by distance)
+int light_samples = 0; // number of lights drawn by importance at every shaded point, set from the command line (0 shades every light that reaches the point)
+int pixel_samples = 1; // number of times every primary hit is shaded (with its own light samples) and averaged, set from the command line with --spp
+
+#define TILE_SIZE 32 // width/height in pixels of a render tile
+
+ray_counts ray_totals; // rays traced by all render workers during the last render
+
+int stats_mode = 0; // set from the command line; 0 = no --stats report, 1 = readable summary, 2 = json
+render_stats stats_totals; // --stats counters of all render workers merged
+render_stats* worker_stats = NULL; // each worker's own counters, kept for the per-thread part of the report
+int worker_stats_count = 0;
+__thread render_stats* thread_stats; // counters of the render worker running on this thread, so the intersection code can count without being handed the worker
+
+char* progressive_file = NULL; // output file a preview is written to after every coarse pass, set from the command line (NULL renders the image in a single pass)
+
+#define PROGRESSIVE_STEP 8 // grid step of the first (coarsest) progressive pass; must divide TILE_SIZE so every block stays inside its tile
+
+char** scene_files = NULL; // scene of every frame when the input is a .txt list of scene files
+int scene_file_count = 0;
+
+char* keyframe_file = NULL; // --keyframes json file which animates the scene over a numbered sequence of frames, set from the command line
+int frame_count = 0; // number of frames rendered from the keyframes, set from the command line (0 renders through the last keyframe)
+keyframe* keyframes = NULL; // sorted by object and then by frame
+int keyframe_count = 0;
+int* first_keyframe = NULL; // index of every object's first keyframe (object_count + 1 entries, so an object's keyframes end where the next one's start)
+double* scene_positions = NULL; // positions the objects have in the scene file, which the keyframes move them away from (3 per object)
+int camera_object = -1; // index of the camera object whose keyframes move the view (the last camera, which is also the one whose width/height are used)
+
+char* serve_path = NULL; // unix domain socket the render server listens on, set from the command line (NULL renders the one image given on the command line)
+int serve_workers = 0; // number of connections the render server answers (and renders it runs) at once, set from the command line (defaults to the number of online cores)
+int cache_capacity = 8; // number of parsed and compiled scenes the render server keeps, set from the command line
+
+#define SERVE_MAX_SCENE_BYTES (1 << 30) // largest scene a client may send the render server (1 GiB); anything larger is refused before a byte is allocated
+#define SERVE_MAX_PIXELS (1 << 25) // largest image (width x height, e.g. 8192 x 4096) a request may ask the render server for, which bounds every buffer a render allocates
+
+cached_scene** scene_cache = NULL; // the render server's cache of up to cache_capacity scenes
+int cache_count = 0;
+unsigned long long cache_clock = 0; // counts cache lookups, so the least recently used scene is the one with the smallest last_used
+pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER; // guards the cache along with the use counts of its scenes
+pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER; // held while a scene is parsed and compiled, since the parser fills the global object arena
+__thread jmp_buf* error_jump = NULL; // set by the render server while it loads a scene or writes an image, so an error abandons that request instead of exiting
+
+char* worker_list = NULL; // comma separated addresses of the render servers the tiles of every frame are handed out to, set from the command line (NULL renders locally)
+double tile_timeout = 30; // seconds a worker gets to answer a scene or send back a tile before it's given up on and its tile handed to another, set from the command line
+dist_worker* dist_workers = NULL; // connections to the render servers of worker_list, opened on the first frame and kept for the rest of a batch
+int dist_worker_count = 0;
+
+#define DIST_TILE_SIZE 64 // width/height in pixels of the tiles a distributed render hands out (larger than TILE_SIZE since every one costs a round trip)
+
+int aa_samples = 1; // refined pixels are supersampled with aa_samples x aa_samples stratified rays, set from the command line (1 turns anti-aliasing off)
+double aa_threshold = 0.1; // largest color difference (per channel, on the 0-1 scale) tolerated between neighbouring pixels before they're refined
+
+int packet_size = 0; // width/height in pixels of the primary ray packets (0 traces every primary ray on its own)
+
+// global compiled render scene of the command line render, compiled from the objects before every frame (see update_compiled_scene())
+render_scene compiled_scene;
+
+__thread render_scene* active_scene; // compiled scene being traced by the render worker running on this thread, set along with thread_stats so the intersection code doesn't need to be handed it
+
+pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER; // guards the ray/stats totals and render time raycasting() leaves behind, since the render server runs several renders at once
+
+#define BVH_MAX_LEAF 8 // leaves are always split above this many primitives (if the centroids allow it)
+#define BVH_BINS 12 // number of buckets used when evaluating split candidates along an axis
+#define BVH_MAX_DEPTH 60 // builder depth limit which keeps traversal within its fixed size stack
+#define BVH_REFIT_LIMIT 2.0 // a refit hierarchy is rebuilt once its nodes' summed surface area has grown to this many times what it was when built
+char* build_mode = "compiled"; // how the last frame's render scene came about: "compiled" from scratch, "refit" in place, "rebuilt" when refitting degraded the hierarchy too much,
+                               // "loaded" from a binary scene file or "loaded+built" from one written without its hierarchy
+int scene_file_loaded = 0; // set when the current frame's render scene was loaded from a binary scene file, which update_compiled_scene() then leaves alone
+int convert_mode = 0; // set from the command line; converts a json scene to a binary scene file instead of rendering (see convert_scene())
+int convert_bvh = 1; // cleared from the command line to leave the hierarchy out of converted scenes
+int selftest_mode = 0; // set from the command line; checks the sphere kernels against sphere_intersection() instead of rendering (see run_selftest())
+
+#define KERNEL_BATCH 16 // max number of spheres handed to the sphere kernel at once
+
+#define SELFTEST_RAYS 20000 // random rays every sphere kernel is checked with by --selftest
+#define SELFTEST_SPHERES 61 // random spheres they're shot at (not a multiple of any kernel's lane count, so the scalar leftovers get checked as well)
+
+// global sphere/packet kernels, set by select_simd_kernels() to the widest versions the cpu supports
+void (*sphere_kernel)(ray_info* ray, int start, int count, real* t_out) = sphere_kernel_scalar;
+int (*packet_enter)(ray_packet* packet, bvh_node* node) = packet_enter_scalar;
+void (*packet_sphere)(ray_packet* packet, real cx, real cy, real cz, real c, int i) = packet_sphere_scalar;
+char* sphere_kernel_name = "scalar";
+
 
 int main(int argc, char** argv) 
 {
-	if(argc != 5) // checks for 5 arguments which includes the argv[0] path argument as well as the 4 required arguments of format [width height input.json output.ppm]
-	{
-		fprintf(stderr, "Error: Incorrect number of arguments; format should be -> [width height input.json output.ppm]\n");
-		return -1;
-	}
-	
-	int width = atoi(argv[1]); // the width of the scene
-	int height = atoi(argv[2]); // the height of the scene
-	char* input_file = argv[3]; // a .json file to read from
-	char* output_file = argv[4]; // a .ppm file to output to
-	
-	// if statement which verifies that given length/width is not less than or equal to 0
-	if(width <= 0 || height <= 0)
-	{
-		fprintf(stderr, "Error: Given width/height must not be less than or equal to 0\n");
-		return -1;
-	}
-	
-    // block of code which checks to make sure that user inputted a .json and .ppm file for both the input and output command line arguments
-	char* temp_ptr_str;
-	int input_length = strlen(input_file);
-	int output_length = strlen(output_file);
-	
-	temp_ptr_str = input_file + (input_length - 5); // sets temp_ptr to be equal to the last 4 characters of the input_name, which should be .ppm
-	if(strcmp(temp_ptr_str, ".json") != 0)
-	{
-		fprintf(stderr, "Error: Input file must be a .json file\n");
-		return -1;
-	}
+	char* positional[4]; // the 4 required arguments of format [width height input.json output.ppm]
+	int positional_count = 0;
+	char* simd_name = NULL; // sphere kernel forced from the command line (widest supported one otherwise)
 	
-	temp_ptr_str = output_file + (output_length - 4); // sets temp_ptr to be equal to the last 4 characters of the output_name, which should be .ppm
-	if(strcmp(temp_ptr_str, ".ppm") != 0)
+	// for loop which separates the optional "--" flags from the required positional arguments
+	for(int a = 1; a < argc; a+=1)
 	{
-		fprintf(stderr, "Error: Output file must be a .ppm file\n");
-		return -1;
-	}
-	// end of .json/.ppm extension error checking	
-  
-  
-	objects = malloc(sizeof(Object*)*129); // allocates memory for global object buffer to maximally account for 128 objects
-  
-	// block of code allocating memory to global header_buffer before its use
-	header_buffer = (struct header_data*)malloc(sizeof(struct header_data)); 
-	header_buffer->file_format = (char *)malloc(100);
-	header_buffer->file_comment = (char *)malloc(1024);
-	header_buffer->file_height = (char *)malloc(100);
-	header_buffer->file_width = (char *)malloc(100);
-	header_buffer->file_maxcolor = (char *)malloc(100);
-  
-	// block of code which hardcodes file format to be read out and also stores height/width from command line. Max color value is set at 255 as well
-	strcpy(header_buffer->file_format, "P6");
-	sprintf(header_buffer->file_height, "%d", height);
-	sprintf(header_buffer->file_width, "%d", width);
-	sprintf(header_buffer->file_maxcolor, "%d", 255);
-  
-  
-	// image_buffer memory allocation here
-	image_buffer = (image_data *)malloc(sizeof(image_data) * width * height + 1); // allocates memory for image based on width * height of image as given by command line
-  
-	read_scene(input_file); // parses json input file
-	
-	raycasting(); // executes raycasting based on information read in from json file in conjunction with the global image_buffer which handles the image pixels
- 
-	write_image_data(output_file); // writes "colored" pixels to ppm file after raycasting
-  
-	return 0;
-}
-
-// function which parses information from given json input file
-void read_scene(char* filename) 
-{
-  int c;
-  FILE* json = fopen(filename, "r");
-
-  if (json == NULL) 
-  {
-    fprintf(stderr, "Error: Could not open file \"%s\"\n", filename);
-    exit(1);
-  }
-  
-  skip_ws(json);
-  
-  // Find the beginning of the list
-  expect_c(json, '[');
-
-  skip_ws(json);
-  
-  // Find the objects
-   c = fgetc(json);
-   if (c == ']')  // Quick check to see if there is an empty json file; displays an error accordingly
-   { 
-      fprintf(stderr, "Error: Empty Scene File.\n");
-      fclose(json);
-      exit(1);
-    }
-   ungetc(c, json); // ungets c after checking immediately for end of json file indicator (']')
-   
-   int i = 0; // iterator variable for objects
-
-   // while loop intended to parse through all objects
-   while (1) 
-   {
-    c = fgetc(json);
-    if (c == '{') 
-	{
-	  // error-checking variables to make sure enough UNIQUE fields have been read-in for object after it has been parsed.
-	  int camera_height_read = 0;
-	  int camera_width_read = 0;
-	  int sphere_diff_color_read = 0;
-	  int sphere_spec_color_read = 0;
-	  int sphere_position_read = 0;
-	  int sphere_radius_read = 0;
-	  int plane_diff_color_read = 0;
-	  int plane_spec_color_read = 0;
-	  int plane_position_read = 0;
-	  int plane_normal_read = 0;
-	  int light_color_read = 0;
-	  int light_position_read = 0;
-	  int light_direction_read = 0;
-	  int light_rad2_read = 0;
-	  int light_rad1_read = 0;
-	  int light_rad0_read = 0;
-	  int light_ang0_read = 0;
-	  int light_theta_read = 0;
-	  int sphere_reflectivity_read = 0;
-	  int sphere_refractivity_read = 0;
-	  int sphere_ior_read = 0;
-	  int plane_reflectivity_read = 0;
-	  int plane_refractivity_read = 0;
-	  int plane_ior_read = 0;
-	  
-      skip_ws(json);
-    
-      // Parse the object
-      char* key = next_string(json);
-      if (strcmp(key, "type") != 0) 
-	  {
-		fprintf(stderr, "Error: Expected \"type\" key on line number %d.\n", line);
-		exit(1);
-      }
-
-      skip_ws(json);
-
-      expect_c(json, ':');
-
-      skip_ws(json);
-
-      char* value = next_string(json);
-
-      if (strcmp(value, "camera") == 0) // allocates memory for camera object and stores the "kind" as corresponding number
-	  {
-		  objects[i] = malloc(sizeof(Object));
-		  objects[i]->kind = 0;
-		  
-		  
-      } 
-	  else if (strcmp(value, "sphere") == 0) // allocates memory for sphere object and stores the "kind" as corresponding number 
-	  {
-		  objects[i] = malloc(sizeof(Object));
-		  objects[i]->kind = 1;
-		  
-		  
-      } 
-	  else if (strcmp(value, "plane") == 0) // allocates memory for plane object and stores the "kind" as corresponding number
-	  {
-		  objects[i] = malloc(sizeof(Object));
-		  objects[i]->kind = 2;
-
-		  
-      } 
-	  else if (strcmp(value, "light") == 0) // allocates memory for light object and stores the "kind" as corresponding number
-	  {
-		  objects[i] = malloc(sizeof(Object));
-		  objects[i]->kind = 3;
-
-		  
-      } 
-	  else // unknown object was read in so an error is displayed
-	  {
-		fprintf(stderr, "Error: Unknown object type, \"%s\", on line number %d.\n", value, line);
-		exit(1);
-      }
-
-      skip_ws(json);
-
-	 // while loop intended to parse through the fields a single object after guaranteed first field "type"
-     while (1) 
-	 {
-	  // , }
-	  c = next_c(json);
-	  if (c == '}') 
-	  {
-	    // stop parsing this object
-		// block of error checking code to first identify the current object that's finished parsing, and then checks to see if enough fields have been read in for that object.
-		if(objects[i]->kind == 0)
+		if(strcmp(argv[a], "--threads") == 0 && a + 1 < argc)
 		{
-			if(camera_width_read != 1 || camera_height_read != 1)
+			thread_count = atoi(argv[++a]);
+			if(thread_count <= 0)
 			{
-				fprintf(stderr, "Error: Object #%d (0-indexed) is a camera which should have two unique fields: width/height\n", i);
-				exit(1);
+				fprintf(stderr, "Error: --threads must be greater than 0\n");
+				return -1;
 			}
 		}
-		else if(objects[i]->kind == 1)
+		else if(strcmp(argv[a], "--packet") == 0 && a + 1 < argc)
 		{
-			if(sphere_diff_color_read != 1 ||  sphere_spec_color_read != 1 ||  sphere_position_read != 1 || sphere_radius_read != 1)
+			packet_size = atoi(argv[++a]);
+			if(packet_size != 0 && packet_size != 4 && packet_size != 8) // tiles must split evenly into packets
 			{
-				fprintf(stderr, "Error: Object #%d (0-indexed) is a sphere which should have four unique fields: diffuse_color/specular_color/position/radius\n", i);
-				exit(1);
+				fprintf(stderr, "Error: --packet must be 0, 4 or 8\n");
+				return -1;
 			}
-			if(sphere_reflectivity_read != 1)
-				objects[i]->sphere.reflectivity = 0;
-			if(sphere_refractivity_read != 1)
-				objects[i]->sphere.refractivity = 0;
-			if(sphere_ior_read != 1)
-				objects[i]->sphere.ior = 1;
-			if((objects[i]->sphere.reflectivity + objects[i]->sphere.refractivity) > 1) 
+		}
+		else if(strcmp(argv[a], "--max-depth") == 0 && a + 1 < argc)
+		{
+			max_depth = atoi(argv[++a]);
+			if(max_depth < 0)
 			{
-				fprintf(stderr, "Error: Object #%d (0-indexed) is a sphere which has an invalid combination of reflectivity/refractivity values; refractivity + refractivity must not be greater than 1.\n", i);
-				exit(1);
+				fprintf(stderr, "Error: --max-depth must not be negative\n");
+				return -1;
 			}
-			
 		}
-		else if(objects[i]->kind == 2)
+		else if(strcmp(argv[a], "--min-weight") == 0 && a + 1 < argc)
 		{
-			if(plane_diff_color_read != 1 ||  plane_spec_color_read != 1 || plane_position_read != 1 || plane_normal_read != 1)
+			min_weight = atof(argv[++a]);
+			if(!(min_weight >= 0))
 			{
-				fprintf(stderr, "Error: Object #%d (0-indexed) is a plane which should have four unique fields: diffuse_color/specular_color/position/normal\n", i);
-				exit(1);
+				fprintf(stderr, "Error: --min-weight must not be negative\n");
+				return -1;
 			}
-			if(plane_reflectivity_read != 1)
-				objects[i]->plane.reflectivity = 0;
-			if(plane_refractivity_read != 1)
-				objects[i]->plane.refractivity = 0;
-			if(plane_ior_read != 1)
-				objects[i]->plane.ior = 1;
-			if((objects[i]->plane.reflectivity + objects[i]->plane.refractivity) > 1) 
+		}
+		else if(strcmp(argv[a], "--light-cutoff") == 0 && a + 1 < argc)
+		{
+			light_cutoff = atof(argv[++a]);
+			if(!(light_cutoff >= 0))
 			{
-				fprintf(stderr, "Error: Object #%d (0-indexed) is a plane which has an invalid combination of reflectivity/refractivity values; refractivity + refractivity must not be greater than 1.\n", i);
-				exit(1);
+				fprintf(stderr, "Error: --light-cutoff must not be negative\n");
+				return -1;
 			}
 		}
-		else if(objects[i]->kind == 3)
+		else if(strcmp(argv[a], "--light-samples") == 0 && a + 1 < argc)
 		{
-			if(light_color_read != 1 ||  light_position_read != 1)
+			light_samples = atoi(argv[++a]);
+			if(light_samples < 0)
 			{
-				fprintf(stderr, "Error: Object #%d (0-indexed) is a light which should have at least these 2 unique fields: color/position\n", i);
-				exit(1);
+				fprintf(stderr, "Error: --light-samples must not be negative\n");
+				return -1;
 			}
-			else if(light_rad2_read == 1 && light_ang0_read == 0 && light_direction_read == 0) // point light should have at least rad2 and no angular-a0/direction
+		}
+		else if(strcmp(argv[a], "--spp") == 0 && a + 1 < argc)
+		{
+			pixel_samples = atoi(argv[++a]);
+			if(pixel_samples < 1 || pixel_samples > 1024)
 			{
-				// block of code which defaults radial values if they weren't properly set
-				if(light_rad1_read == 0)
-					objects[i]->light.radial_a1 = 0;
-				if(light_rad0_read == 0)
-					objects[i]->light.radial_a0 = 0;
-				// end of radial value check
-				
-				objects[i]->light.kind_light = 0;
+				fprintf(stderr, "Error: --spp must be between 1 and 1024\n");
+				return -1;
 			}
-			else if(light_theta_read == 1 && light_ang0_read == 1 && light_direction_read == 1) // spot light
+		}
+		else if(strcmp(argv[a], "--mmap") == 0)
+		{
+			map_output = 1;
+		}
+		else if(strcmp(argv[a], "--aa") == 0 && a + 1 < argc)
+		{
+			aa_samples = atoi(argv[++a]);
+			if(aa_samples < 1 || aa_samples > 16)
 			{
-				// block of code which defaults radial values if they weren't properly set
-				if(light_rad2_read == 0)
-					objects[i]->light.radial_a2 = 1;
-				if(light_rad1_read == 0)
-					objects[i]->light.radial_a1 = 0;
-				if(light_rad0_read == 0)
-					objects[i]->light.radial_a0 = 0;
-				// end of radial value check
-				
-				// if theta was read in but the value is 0, then it's a point light
-				if(objects[i]->light.theta == 0)
-					objects[i]->light.kind_light = 0;
-				// if theta was read in and the value is not 0, we know it's not less than 0, so it's a spot light
-				if(objects[i]->light.theta != 0)
-					objects[i]->light.kind_light = 1;
+				fprintf(stderr, "Error: --aa must be between 1 and 16\n");
+				return -1;
 			}
-			else // invalid number of fields read in for either type of light
+		}
+		else if(strcmp(argv[a], "--aa-threshold") == 0 && a + 1 < argc)
+		{
+			aa_threshold = atof(argv[++a]);
+			if(!(aa_threshold >= 0))
 			{
-					fprintf(stderr, "Error: Object #%d (0-indexed) is a light which should be either a spotlight/pointlight. (ie must have fields: direction/angular-a0/theta or just radial-a2, respectively)\n", i);
-					exit(1);
+				fprintf(stderr, "Error: --aa-threshold must not be negative\n");
+				return -1;
 			}
-
 		}
-	    i++; // increments object iterator
-		// resets all error-checking variables back to 0
-		int camera_height_read = 0;
-		int camera_width_read = 0;
-		int sphere_diff_color_read = 0;
-		int sphere_spec_color_read = 0;
-		int sphere_position_read = 0;
-		int sphere_radius_read = 0;
-		int plane_diff_color_read = 0;
-		int plane_spec_color_read = 0;
-		int plane_position_read = 0;
-		int plane_normal_read = 0;
-		int light_color_read = 0;
-		int light_position_read = 0;
-		int light_direction_read = 0;
-		int light_rad2_read = 0;
-		int light_rad1_read = 0;
-		int light_rad0_read = 0;
-		int light_ang0_read = 0;
-		int light_theta_read = 0;
-		int sphere_reflectivity_read = 0;
-		int sphere_refractivity_read = 0;
-		int sphere_ior_read = 0;
-		int plane_reflectivity_read = 0;
-		int plane_refractivity_read = 0;
-		int plane_ior_read = 0;
-	    break;
-	  } 
-	  else if (c == ',') 
-	  {
-	  // read another field
-	  skip_ws(json);
-	  char* key = next_string(json);
-	  skip_ws(json);
-	  expect_c(json, ':');
-	  skip_ws(json);  
-	  if ((strcmp(key, "width") == 0) || 
-	      (strcmp(key, "height") == 0) || // evaluates if field is either a width/height/radius/radial-a2/radial-a1/radial-a0/angular-a0/theta
-	      (strcmp(key, "radius") == 0) ||
-		  (strcmp(key, "radial-a2") == 0) || 
-	      (strcmp(key, "radial-a1") == 0) ||
-		  (strcmp(key, "radial-a0") == 0) ||
-		  (strcmp(key, "angular-a0") == 0) ||
-		  (strcmp(key, "theta") == 0) ||
-		  (strcmp(key, "reflectivity") == 0) ||
-		  (strcmp(key, "refractivity") == 0) ||
-		  (strcmp(key, "ior") == 0))
-	  {
-	    double value = next_number(json);
-		if(strcmp(key, "width") == 0 && objects[i]->kind == 0) // evaluates only if key is width and current object is a camera
+		else if(strcmp(argv[a], "--progressive") == 0)
 		{
-			objects[i]->camera.width = value;
-			glob_width = value; // stores camera width to prevent need to iterate through objects later
-			camera_width_read++; // increments error checking variable for camera width field being read
+			progressive_file = ""; // replaced by the output file name once it's known
 		}
-		else if(strcmp(key, "height") == 0 && objects[i]-> kind == 0) // evaluates only if key is height and current object is a camera
+		else if(strcmp(argv[a], "--keyframes") == 0 && a + 1 < argc)
 		{
-			objects[i]->camera.height = value; 
-			glob_height = value; // stores camera height to prevent need to iterate through objects later
-			camera_height_read++; // increments error checking variable for camera height field being read
+			keyframe_file = argv[++a];
 		}
-		else if(strcmp(key, "radius") == 0 && objects[i]-> kind == 1) // evaluates only if key is radius and current object is a sphere
+		else if(strcmp(argv[a], "--frames") == 0 && a + 1 < argc)
 		{
-			if(value <= 0) // error check to make sure a negative radius isn't read in from json file
+			frame_count = atoi(argv[++a]);
+			if(frame_count <= 0)
 			{
-				fprintf(stderr, "Error: Sphere radius should not be less than or equal to 0. Violation found on line number %d.\n", line);
-				exit(1);
+				fprintf(stderr, "Error: --frames must be greater than 0\n");
+				return -1;
 			}
-			objects[i]->sphere.radius = value;
-			sphere_radius_read++; // increments error checking variable for sphere radius field being read
 		}
-		
-		else if(strcmp(key, "radial-a2") == 0 && objects[i]-> kind == 3) // evaluates only if key is radial-a2 and current object is a light
+		else if(strcmp(argv[a], "--serve") == 0 && a + 1 < argc)
 		{
-			if(value < 0) // error check to make sure a negative radial-a2 isn't read in from json file
+			serve_path = argv[++a];
+		}
+		else if(strcmp(argv[a], "--serve-workers") == 0 && a + 1 < argc)
+		{
+			serve_workers = atoi(argv[++a]);
+			if(serve_workers <= 0)
 			{
-				fprintf(stderr, "Error: radial-a2 must be positive. Violation found on line number %d.\n", line);
-				exit(1);
+				fprintf(stderr, "Error: --serve-workers must be greater than 0\n");
+				return -1;
 			}
-			objects[i]->light.radial_a2 = value;
-			light_rad2_read++; // increments error checking variable for radial-a2 field being read
 		}
-		else if(strcmp(key, "radial-a1") == 0 && objects[i]-> kind == 3) // evaluates only if key is radial-a1 and current object is a light
+		else if(strcmp(argv[a], "--workers") == 0 && a + 1 < argc)
 		{
-			if(value < 0) // error check to make sure a negative radial-a1 isn't read in from json file
+			worker_list = argv[++a];
+			if(worker_list[0] == '\0')
 			{
-				fprintf(stderr, "Error: radial-a1 must be positive. Violation found on line number %d.\n", line);
-				exit(1);
+				fprintf(stderr, "Error: --workers needs at least one worker address\n");
+				return -1;
 			}
-			objects[i]->light.radial_a1 = value;
-			light_rad1_read++; // increments error checking variable for radial-a1 field being read
 		}
-		else if(strcmp(key, "radial-a0") == 0 && objects[i]-> kind == 3) // evaluates only if key is radial-a0 and current object is a light
+		else if(strcmp(argv[a], "--tile-timeout") == 0 && a + 1 < argc)
 		{
-			if(value < 0) // error check to make sure a negative radial-a0 isn't read in from json file
+			tile_timeout = atof(argv[++a]);
+			if(!(tile_timeout > 0))
 			{
-				fprintf(stderr, "Error: radial-a0 must be positive. Violation found on line number %d.\n", line);
-				exit(1);
+				fprintf(stderr, "Error: --tile-timeout must be greater than 0\n");
+				return -1;
 			}
-			objects[i]->light.radial_a0 = value;
-			light_rad0_read++; // increments error checking variable for radial-a0 field being read
 		}
-		else if(strcmp(key, "angular-a0") == 0 && objects[i]-> kind == 3) // evaluates only if key is angular-a0 and current object is a light
+		else if(strcmp(argv[a], "--cache") == 0 && a + 1 < argc)
 		{
-			if(value < 0) // error check to make sure a negative angular-a0 isn't read in from json file
+			cache_capacity = atoi(argv[++a]);
+			if(cache_capacity < 0)
 			{
-				fprintf(stderr, "Error: angular-a0 must be positive. Violation found on line number %d.\n", line);
-				exit(1);
+				fprintf(stderr, "Error: --cache must not be negative\n");
+				return -1;
 			}
-			objects[i]->light.angular_a0 = value;
-			light_ang0_read++; // increments error checking variable for angular-a0 field being read
 		}
-		else if(strcmp(key, "theta") == 0 && objects[i]-> kind == 3) // evaluates only if key is angular-a0 and current object is a light
+		else if(strcmp(argv[a], "--bench") == 0)
 		{
-			if(value < 0) // error check to make sure a negative theta isn't read in from json file
+			bench_report = 1;
+		}
+		else if(strcmp(argv[a], "--compare") == 0 && a + 1 < argc)
+		{
+			compare_file = argv[++a];
+		}
+		else if(strcmp(argv[a], "--convert") == 0)
+		{
+			convert_mode = 1;
+		}
+		else if(strcmp(argv[a], "--no-bvh") == 0)
+		{
+			convert_bvh = 0;
+		}
+		else if(strcmp(argv[a], "--selftest") == 0)
+		{
+			selftest_mode = 1;
+		}
+		else if(strcmp(argv[a], "--stats") == 0 && a + 1 < argc)
+		{
+			a++;
+			if(strcmp(argv[a], "text") == 0)
+				stats_mode = 1;
+			else if(strcmp(argv[a], "json") == 0)
+				stats_mode = 2;
+			else
 			{
-				fprintf(stderr, "Error: theta must be greater than or equal to 0. Violation found on line number %d.\n", line);
-				exit(1);
+				fprintf(stderr, "Error: --stats must be either text or json\n");
+				return -1;
+			}
+			if(!RENDER_STATS)
+			{
+				fprintf(stderr, "Error: --stats isn't available since this program was built without stats (RENDER_STATS=0)\n");
+				return -1;
 			}
-			objects[i]->light.theta = value;
-			light_theta_read++; // increments error checking variable for theta field being read
 		}
-		else if((strcmp(key, "reflectivity") == 0 && objects[i]->kind == 1) || (strcmp(key, "reflectivity") == 0 && objects[i]->kind == 2)) // evaluates only if key is reflectivity and current object is a sphere or plane
+		else if(strcmp(argv[a], "--simd") == 0 && a + 1 < argc)
 		{
-			if(objects[i]->kind == 1)
-			{
-				if(value < 0 || value > 1) // error check to make sure reflectivity is between 0 and 1
+			simd_name = argv[++a];
+		}
+		else if(strncmp(argv[a], "--", 2) == 0)
+		{
+			fprintf(stderr, "Error: Unknown option \"%s\"\n", argv[a]);
+			return -1;
+		}
+		else if(positional_count < 4)
+		{
+			positional[positional_count++] = argv[a];
+		}
+		else
+		{
+			positional_count++; // too many arguments, reported below
+		}
+	}
+	
+	if(selftest_mode) // the selftest makes up its own rays and spheres
+	{
+		if(positional_count != 0 || convert_mode || serve_path != NULL)
+		{
+			fprintf(stderr, "Error: --selftest takes no other arguments\n");
+			return -1;
+		}
+		return run_selftest();
+	}
+	
+	if(convert_mode) // converting a scene renders nothing, so it only takes the input and output file
+	{
+		if(positional_count != 2 || serve_path != NULL)
+		{
+			fprintf(stderr, "Error: --convert takes just an input .json and an output .rts file -> --convert [--no-bvh] input.json output.rts\n");
+			return -1;
+		}
+		convert_scene(positional[0], positional[1]);
+		return 0;
+	}
+	if(!convert_bvh)
+	{
+		fprintf(stderr, "Error: --no-bvh only applies to --convert\n");
+		return -1;
+	}
+	
+	if(serve_path != NULL) // the render server takes the size, scene and output of every image from its requests instead
+	{
+		if(positional_count != 0)
+		{
+			fprintf(stderr, "Error: --serve takes no width/height/input/output arguments; every request names its own\n");
+			return -1;
+		}
+		if(progressive_file != NULL || keyframe_file != NULL || map_output || bench_report || stats_mode || compare_file != NULL || worker_list != NULL)
+		{
+			fprintf(stderr, "Error: --serve can't be combined with --progressive, --keyframes, --mmap, --bench, --stats, --compare or --workers\n");
+			return -1;
+		}
+		
+		if(thread_count == 0) // requests are rendered side by side, so each one gets a single render thread unless told otherwise
+			thread_count = 1;
+		if(serve_workers == 0)
+		{
+			serve_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+			if(serve_workers <= 0)
+				serve_workers = 1;
+		}
+		select_simd_kernels(simd_name);
+		return serve(serve_path);
+	}
+	
+	if(positional_count != 4) // checks for the 4 required arguments of format [width height input.json output.ppm]
+	{
+		fprintf(stderr, "Error: Incorrect number of arguments; format should be -> [--threads N] [--simd scalar|sse2|avx2|avx512] [--packet 0|4|8] [--max-depth N] [--min-weight W] [--light-cutoff C] [--light-samples N] [--spp N] [--aa N] [--aa-threshold T] [--progressive] [--keyframes keys.json] [--frames N] [--mmap] [--bench] [--stats text|json] [--compare reference.ppm] [--workers A,B,...] [--tile-timeout S] [width height input.json|input.rts|scenes.txt output.ppm]\n");
+		fprintf(stderr, "       or to convert a scene to a binary scene file -> [--convert] [--no-bvh] [input.json output.rts]\n");
+		fprintf(stderr, "       or to check the sphere kernels against the original sphere intersection -> [--selftest]\n");
+		fprintf(stderr, "       or to run a render server -> [--serve socket|host:port] [--serve-workers N] [--cache N] [--threads N] [--simd ...] [--packet ...] [--max-depth N] [--min-weight W] [--light-cutoff C] [--light-samples N] [--spp N] [--aa N] [--aa-threshold T]\n");
+		return -1;
+	}
+	
+	if(thread_count == 0) // no thread count given so default to one render thread per online core
+	{
+		thread_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		if(thread_count <= 0)
+			thread_count = 1;
+	}
+	
+	select_simd_kernels(simd_name);
+	
+	int width = atoi(positional[0]); // the width of the scene
+	int height = atoi(positional[1]); // the height of the scene
+	char* input_file = positional[2]; // a .json file to read from
+	char* output_file = positional[3]; // a .ppm file to output to
+	
+	// if statement which verifies that given length/width is not less than or equal to 0
+	if(width <= 0 || height <= 0)
+	{
+		fprintf(stderr, "Error: Given width/height must not be less than or equal to 0\n");
+		return -1;
+	}
+	
+    // block of code which checks to make sure that user inputted a .json and .ppm file for both the input and output command line arguments
+	char* temp_ptr_str;
+	int input_length = strlen(input_file);
+	int output_length = strlen(output_file);
+	
+	int scene_list = 0; // set when the input is a .txt list of scene files, one per frame
+	temp_ptr_str = input_file + (input_length - 4); // sets temp_ptr to be equal to the last 4 characters of the input_name, which may be .txt
+	if(input_length >= 4 && strcmp(temp_ptr_str, ".txt") == 0)
+	{
+		scene_list = 1;
+	}
+	else if(!is_scene_file(input_file))
+	{
+		temp_ptr_str = input_file + (input_length - 5); // sets temp_ptr to be equal to the last 5 characters of the input_name, which should be .json
+		if(input_length < 5 || strcmp(temp_ptr_str, ".json") != 0)
+		{
+			fprintf(stderr, "Error: Input file must be a .json or .rts file (or a .txt list of them)\n");
+			return -1;
+		}
+	}
+	
+	temp_ptr_str = output_file + (output_length - 4); // sets temp_ptr to be equal to the last 4 characters of the output_name, which should be .ppm
+	if(strcmp(temp_ptr_str, ".ppm") != 0)
+	{
+		fprintf(stderr, "Error: Output file must be a .ppm file\n");
+		return -1;
+	}
+	// end of .json/.ppm extension error checking	
+	
+	if((scene_list || is_scene_file(input_file)) && keyframe_file != NULL)
+	{
+		fprintf(stderr, "Error: --keyframes animates a single .json scene, not a list of scenes or a binary scene file\n");
+		return -1;
+	}
+	if(frame_count > 0 && keyframe_file == NULL)
+	{
+		fprintf(stderr, "Error: --frames needs --keyframes\n");
+		return -1;
+	}
+	if(worker_list != NULL && (keyframe_file != NULL || progressive_file != NULL || stats_mode))
+	{
+		fprintf(stderr, "Error: --workers can't be combined with --keyframes (the workers are sent scene files), --progressive or --stats (the workers do the counting)\n");
+		return -1;
+	}
+  
+  
+	// block of code allocating memory to global header_buffer before its use
+	header_buffer = (struct header_data*)malloc(sizeof(struct header_data)); 
+	header_buffer->file_format = (char *)malloc(100);
+	header_buffer->file_comment = (char *)malloc(1024);
+	header_buffer->file_height = (char *)malloc(100);
+	header_buffer->file_width = (char *)malloc(100);
+	header_buffer->file_maxcolor = (char *)malloc(100);
+  
+	// block of code which hardcodes file format to be read out and also stores height/width from command line. Max color value is set at 255 as well
+	strcpy(header_buffer->file_format, "P6");
+	sprintf(header_buffer->file_height, "%d", height);
+	sprintf(header_buffer->file_width, "%d", width);
+	sprintf(header_buffer->file_maxcolor, "%d", 255);
+  
+  
+	// a batch (a list of scenes, or a scene animated by keyframes) renders a numbered sequence of frames in this one process, reusing the image buffer, the render scene and its
+	// hierarchy (which is only refit when nothing but positions changed) from frame to frame
+	int batch = scene_list || keyframe_file != NULL;
+	int frames = 1;
+	
+	double phase_start = now_seconds();
+	if(scene_list)
+	{
+		read_scene_list(input_file);
+		frames = scene_file_count;
+	}
+	else
+	{
+		if(is_scene_file(input_file))
+			load_scene_file(input_file, &compiled_scene); // binary scenes are mapped straight into the render scene instead of being parsed
+		else
+			read_scene(input_file); // parses json input file (before the output file is touched, so a bad scene never truncates it)
+	}
+	if(keyframe_file != NULL)
+	{
+		read_keyframes(keyframe_file);
+		frames = frame_count;
+	}
+	parse_seconds = now_seconds() - phase_start;
+	
+	if(!map_output) // a mapped image_buffer points into each frame's own output file instead
+		image_buffer = (image_data *)malloc(sizeof(image_data) * width * height + 1); // allocates memory for image based on width * height of image as given by command line
+	
+	char frame_output[4096]; // output file name of the current frame of a batch
+	for(int f = 0; f < frames; f+=1)
+	{
+		char* frame_scene = input_file;
+		char* frame_file = output_file;
+		if(batch)
+		{
+			numbered_output_name(output_file, f, frame_output, sizeof(frame_output));
+			frame_file = frame_output;
+		}
+		
+		if(scene_list)
+		{
+			frame_scene = scene_files[f];
+			phase_start = now_seconds();
+			if(is_scene_file(frame_scene))
+				load_scene_file(frame_scene, &compiled_scene);
+			else
+				read_scene(frame_scene);
+			parse_seconds = now_seconds() - phase_start;
+		}
+		else if(keyframe_file != NULL)
+		{
+			phase_start = now_seconds();
+			animate_frame(f);
+			parse_seconds = (f == 0 ? parse_seconds : 0) + now_seconds() - phase_start; // the first frame also pays for parsing the scene and keyframes
+		}
+		
+		if(map_output)
+			map_image_data(frame_file); // image_buffer points into the mapped output file
+		if(progressive_file != NULL)
+			progressive_file = frame_file;
+		
+		phase_start = now_seconds();
+		update_compiled_scene(); // the parsed objects aren't read again once they're compiled
+		build_seconds = now_seconds() - phase_start;
+		
+		if(worker_list != NULL)
+			distribute_frame(frame_scene, image_buffer, width, height); // the workers are sent the frame's scene file and render its tiles instead
+		else
+			raycasting(&compiled_scene, image_buffer, width, height); // executes raycasting based on information read in from json file in conjunction with the global image_buffer which handles the image pixels
+	 
+		if(compare_file != NULL) // compared before the image is written, since writing a --mmap image unmaps image_buffer
+		{
+			char compare_frame[4096];
+			char* reference = compare_file;
+			if(batch)
+			{
+				numbered_output_name(compare_file, f, compare_frame, sizeof(compare_frame));
+				reference = compare_frame;
+			}
+			compare_image(reference, image_buffer, width, height);
+			if(!bench_report)
+				fprintf(stderr, "Compared with %s: max difference %d (of 255), %lld pixels differ\n", reference, compare_max_diff, compare_diff_pixels);
+		}
+		
+		phase_start = now_seconds();
+		write_image_data(frame_file); // writes "colored" pixels to ppm file after raycasting
+		write_seconds = now_seconds() - phase_start;
+		
+		if(bench_report)
+			print_bench_report(frame_scene, width, height);
+		if(stats_mode)
+			print_stats_report();
+	}
+	
+	free_scene(); // tears down the object arena and the other global buffers
+  
+	return 0;
+}
+
+// function which parses information from given json input file into the object arena, dropping the objects of any previous frame (the arena itself is kept). The file is mapped into memory
+// (or read in whole when it can't be mapped, e.g. a pipe) and then parsed in place in a single pass by parse_scene()
+void read_scene(char* filename)
+{
+  object_count = 0;
+  glob_width = 0;
+  glob_height = 0;
+  line = 1;
+
+  json_reader json;
+  if (!open_json(filename, &json))
+    exit(1);
+  parse_scene(&json);
+  close_json(&json);
+}
+
+// maps the given json file into memory, or reads it into a malloc'd buffer when it can't be mapped, and points the reader at its start; returns 0 (having
+// printed why) when the file can't be read
+int open_json(char* filename, json_reader* json)
+{
+  int fd = open(filename, O_RDONLY);
+
+  if (fd < 0)
+  {
+    fprintf(stderr, "Error: Could not open file \"%s\"\n", filename);
+    return 0;
+  }
+
+  json->data = NULL;
+  json->size = 0;
+  json->pos = 0;
+  json->mapped = 0;
+
+  struct stat info;
+  if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+  {
+    void* map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED)
+    {
+      json->data = map;
+      json->size = info.st_size;
+      json->mapped = 1;
+    }
+  }
+
+  if (json->data == NULL) // couldn't be mapped, so the file is read in whole instead
+  {
+    size_t capacity = 65536;
+    char* copy = malloc(capacity);
+    ssize_t got;
+    while ((got = read(fd, copy + json->size, capacity - json->size)) > 0)
+    {
+      json->size += got;
+      if (json->size == capacity)
+      {
+        capacity *= 2;
+        copy = realloc(copy, capacity);
+      }
+    }
+    if (got < 0)
+    {
+      fprintf(stderr, "Error: Could not read file \"%s\"\n", filename);
+      free(copy);
+      close(fd);
+      return 0;
+    }
+    json->data = copy;
+  }
+  close(fd);
+  return 1;
+}
+
+// unmaps or frees the memory holding the json file
+void close_json(json_reader* json)
+{
+  if (json->mapped)
+    munmap((void*)json->data, json->size);
+  else
+    free((void*)json->data);
+  json->data = NULL;
+}
+
+// reads the list of scene files making up a batch, one file name per line (blank lines are skipped); the scenes themselves are only parsed as their frames come up
+void read_scene_list(char* filename)
+{
+  FILE* list = fopen(filename, "r");
+  if (list == NULL)
+  {
+    fprintf(stderr, "Error: Could not open file \"%s\"\n", filename);
+    exit(1);
+  }
+
+  char name[4096];
+  int capacity = 0;
+  while (fgets(name, sizeof(name), list) != NULL)
+  {
+    int length = strlen(name);
+    while (length > 0 && isspace((unsigned char)name[length - 1])) // strips the newline (and any trailing blanks)
+      length -= 1;
+    name[length] = 0;
+    if (length == 0)
+      continue;
+
+    if (scene_file_count == capacity)
+    {
+      capacity = (capacity == 0) ? 16 : capacity * 2;
+      scene_files = realloc(scene_files, sizeof(char*) * capacity);
+    }
+    scene_files[scene_file_count] = malloc(length + 1);
+    memcpy(scene_files[scene_file_count], name, length + 1);
+    scene_file_count += 1;
+  }
+  fclose(list);
+
+  if (scene_file_count == 0)
+  {
+    fprintf(stderr, "Error: Scene list \"%s\" doesn't name any scene files\n", filename);
+    exit(1);
+  }
+}
+
+// function which parses a json scene held in memory in a single pass, reading characters straight out of the buffer
+void parse_scene(json_reader* json)
+{
+  int c;
+
+  scene_group_count = 0; // groups and materials (and their names) only live as long as the scene file defining them
+  group_member_count = 0;
+  scene_material_count = 0;
+  
+  skip_ws(json);
+  
+  // Find the beginning of the list
+  expect_c(json, '[');
+
+  skip_ws(json);
+  
+  // Find the objects
+   if (json->data[json->pos] == ']')  // Quick check to see if there is an empty json file; displays an error accordingly (skip_ws() guarantees there's a character left)
+   { 
+      fprintf(stderr, "Error: Empty Scene File.\n");
+      fail();
+    }
+   
+   // while loop intended to parse through all objects
+   while (1) 
+   {
+    c = next_c(json);
+    if (c == '{') 
+	{
+	  parse_object(json, 0);
+      skip_ws(json);
+      c = next_c(json);
+      if (c == ',') // Should be followed by another object
+	  { 
+		// noop
+		skip_ws(json);
+      } 
+	  else if (c == ']')  // reached end of json file
+	  {
+			// every sphere of an instance gets the hit index object_count + (instance's object index) * (size of the largest group) + (its index in the group), which has to fit in an int
+			int largest = 0;
+			for(int g = 0; g < scene_group_count; g+=1)
+				if(scene_groups[g].count > largest)
+					largest = scene_groups[g].count;
+			if((long long)object_count * (largest + 1) >= INT_MAX)
+			{
+				fprintf(stderr, "Error: Too many instances of groups this large (%d objects, groups of up to %d spheres).\n", object_count, largest);
+				fail();
+			}
+			return;
+      } 
+	  else // finished parsing an object and a comma or hard bracket was expect to indicate a new object/end of object list, so display error
+	  {
+			fprintf(stderr, "Error: Expecting ',' or ']' on line %d.\n", line);
+			fail();
+      }
+    }
+    else // didn't find end of file or the beginning of an object
+	{
+		fprintf(stderr, "Error: Expecting '{' or ']' on line %d.\n", line);
+		fail();
+	}
+  }
+}
+
+// parses the fields of one object, whose opening brace has already been read, into a new object at the end of the object arena and returns its index. Groups are handed
+// off to parse_group(), which parses their member objects through here again (with in_group set)
+int parse_object(json_reader* json, int in_group)
+{
+  int c;
+  int i = 0; // index of the object currently being parsed
+
+	  // error-checking variables to make sure enough UNIQUE fields have been read-in for object after it has been parsed.
+	  int camera_height_read = 0;
+	  int camera_width_read = 0;
+	  int sphere_diff_color_read = 0;
+	  int sphere_spec_color_read = 0;
+	  int sphere_position_read = 0;
+	  int sphere_radius_read = 0;
+	  int plane_diff_color_read = 0;
+	  int plane_spec_color_read = 0;
+	  int plane_position_read = 0;
+	  int plane_normal_read = 0;
+	  int light_color_read = 0;
+	  int light_position_read = 0;
+	  int light_direction_read = 0;
+	  int light_rad2_read = 0;
+	  int light_rad1_read = 0;
+	  int light_rad0_read = 0;
+	  int light_ang0_read = 0;
+	  int light_theta_read = 0;
+	  int sphere_reflectivity_read = 0;
+	  int sphere_refractivity_read = 0;
+	  int sphere_ior_read = 0;
+	  int plane_reflectivity_read = 0;
+	  int plane_refractivity_read = 0;
+	  int plane_ior_read = 0;
+	  int instance_group_read = 0;
+	  int instance_position_read = 0;
+	  int instance_scale_read = 0;
+	  int sphere_shininess_read = 0;
+	  int plane_shininess_read = 0;
+	  int material_read = 0;
+	  
+      skip_ws(json);
+    
+      // Parse the object
+      char key_name[129]; // raw text of the current key, only kept around for error messages
+      int key = next_key(json, key_name);
+      if (key != KEY_TYPE) 
+	  {
+		fprintf(stderr, "Error: Expected \"type\" key on line number %d.\n", line);
+		fail();
+      }
+
+      skip_ws(json);
+
+      expect_c(json, ':');
+
+      skip_ws(json);
+
+      char value[129];
+      next_string(json, value);
+
+      if (strcmp(value, "camera") == 0) // allocates memory for camera object and stores the "kind" as corresponding number
+	  {
+		  i = new_object();
+		  objects[i].kind = 0;
+		  
+		  
+      } 
+	  else if (strcmp(value, "sphere") == 0) // allocates memory for sphere object and stores the "kind" as corresponding number 
+	  {
+		  i = new_object();
+		  objects[i].kind = 1;
+		  
+		  
+      } 
+	  else if (strcmp(value, "plane") == 0) // allocates memory for plane object and stores the "kind" as corresponding number
+	  {
+		  i = new_object();
+		  objects[i].kind = 2;
+
+		  
+      } 
+	  else if (strcmp(value, "light") == 0) // allocates memory for light object and stores the "kind" as corresponding number
+	  {
+		  i = new_object();
+		  objects[i].kind = 3;
+
+		  
+      } 
+	  else if (strcmp(value, "group") == 0) // a group's fields (and member objects) are parsed by parse_group()
+	  {
+		  if (in_group)
+		  {
+			fprintf(stderr, "Error: Groups can't be nested. Violation found on line number %d.\n", line);
+			fail();
+		  }
+		  return parse_group(json);
+      } 
+	  else if (strcmp(value, "material") == 0) // a material's fields are parsed by parse_material()
+	  {
+		  return parse_material(json);
+      } 
+	  else if (strcmp(value, "instance") == 0) // allocates memory for instance object and stores the "kind" as corresponding number
+	  {
+		  i = new_object();
+		  objects[i].kind = 5;
+		  objects[i].instance.scale = 1;
+		  
+		  
+      } 
+	  else // unknown object was read in so an error is displayed
+	  {
+		fprintf(stderr, "Error: Unknown object type, \"%s\", on line number %d.\n", value, line);
+		fail();
+      }
+
+      skip_ws(json);
+
+	 // while loop intended to parse through the fields a single object after guaranteed first field "type"
+     while (1) 
+	 {
+	  // , }
+	  c = next_c(json);
+	  if (c == '}') 
+	  {
+	    // stop parsing this object
+		// a material hands the object every one of its shading fields (counting each as read), so any the object sets on top of it shows up as read twice
+		if(material_read > 0 && (material_read != 1 || sphere_diff_color_read + plane_diff_color_read != 1 || sphere_spec_color_read + plane_spec_color_read != 1 ||
+			sphere_shininess_read + plane_shininess_read != 1 || sphere_reflectivity_read + plane_reflectivity_read != 1 || sphere_refractivity_read + plane_refractivity_read != 1 ||
+			sphere_ior_read + plane_ior_read != 1))
+		{
+			fprintf(stderr, "Error: Object #%d (0-indexed) takes its diffuse_color/specular_color/shininess/reflectivity/refractivity/ior from one material and can't set them itself\n", i);
+			fail();
+		}
+		// block of error checking code to first identify the current object that's finished parsing, and then checks to see if enough fields have been read in for that object.
+		if(objects[i].kind == 0)
+		{
+			if(camera_width_read != 1 || camera_height_read != 1)
+			{
+				fprintf(stderr, "Error: Object #%d (0-indexed) is a camera which should have two unique fields: width/height\n", i);
+				fail();
+			}
+		}
+		else if(objects[i].kind == 1)
+		{
+			if(sphere_diff_color_read != 1 ||  sphere_spec_color_read != 1 ||  sphere_position_read != 1 || sphere_radius_read != 1)
+			{
+				fprintf(stderr, "Error: Object #%d (0-indexed) is a sphere which should have four unique fields: diffuse_color/specular_color/position/radius\n", i);
+				fail();
+			}
+			if(sphere_reflectivity_read != 1)
+				objects[i].sphere.reflectivity = 0;
+			if(sphere_refractivity_read != 1)
+				objects[i].sphere.refractivity = 0;
+			if(sphere_ior_read != 1)
+				objects[i].sphere.ior = 1;
+			if(sphere_shininess_read != 1)
+				objects[i].sphere.shininess = 20;
+			if((objects[i].sphere.reflectivity + objects[i].sphere.refractivity) > 1) 
+			{
+				fprintf(stderr, "Error: Object #%d (0-indexed) is a sphere which has an invalid combination of reflectivity/refractivity values; refractivity + refractivity must not be greater than 1.\n", i);
+				fail();
+			}
+			
+		}
+		else if(objects[i].kind == 2)
+		{
+			if(plane_diff_color_read != 1 ||  plane_spec_color_read != 1 || plane_position_read != 1 || plane_normal_read != 1)
+			{
+				fprintf(stderr, "Error: Object #%d (0-indexed) is a plane which should have four unique fields: diffuse_color/specular_color/position/normal\n", i);
+				fail();
+			}
+			if(plane_reflectivity_read != 1)
+				objects[i].plane.reflectivity = 0;
+			if(plane_refractivity_read != 1)
+				objects[i].plane.refractivity = 0;
+			if(plane_ior_read != 1)
+				objects[i].plane.ior = 1;
+			if(plane_shininess_read != 1)
+				objects[i].plane.shininess = 20;
+			if((objects[i].plane.reflectivity + objects[i].plane.refractivity) > 1) 
+			{
+				fprintf(stderr, "Error: Object #%d (0-indexed) is a plane which has an invalid combination of reflectivity/refractivity values; refractivity + refractivity must not be greater than 1.\n", i);
+				fail();
+			}
+		}
+		else if(objects[i].kind == 3)
+		{
+			if(light_color_read != 1 ||  light_position_read != 1)
+			{
+				fprintf(stderr, "Error: Object #%d (0-indexed) is a light which should have at least these 2 unique fields: color/position\n", i);
+				fail();
+			}
+			else if(light_rad2_read == 1 && light_ang0_read == 0 && light_direction_read == 0) // point light should have at least rad2 and no angular-a0/direction
+			{
+				// block of code which defaults radial values if they weren't properly set
+				if(light_rad1_read == 0)
+					objects[i].light.radial_a1 = 0;
+				if(light_rad0_read == 0)
+					objects[i].light.radial_a0 = 0;
+				// end of radial value check
+				
+				objects[i].light.kind_light = 0;
+			}
+			else if(light_theta_read == 1 && light_ang0_read == 1 && light_direction_read == 1) // spot light
+			{
+				// block of code which defaults radial values if they weren't properly set
+				if(light_rad2_read == 0)
+					objects[i].light.radial_a2 = 1;
+				if(light_rad1_read == 0)
+					objects[i].light.radial_a1 = 0;
+				if(light_rad0_read == 0)
+					objects[i].light.radial_a0 = 0;
+				// end of radial value check
+				
+				// if theta was read in but the value is 0, then it's a point light
+				if(objects[i].light.theta == 0)
+					objects[i].light.kind_light = 0;
+				// if theta was read in and the value is not 0, we know it's not less than 0, so it's a spot light
+				if(objects[i].light.theta != 0)
+					objects[i].light.kind_light = 1;
+			}
+			else // invalid number of fields read in for either type of light
+			{
+					fprintf(stderr, "Error: Object #%d (0-indexed) is a light which should be either a spotlight/pointlight. (ie must have fields: direction/angular-a0/theta or just radial-a2, respectively)\n", i);
+					fail();
+			}
+
+		}
+		else if(objects[i].kind == 5)
+		{
+			if(instance_group_read != 1 || instance_position_read != 1 || instance_scale_read > 1)
+			{
+				fprintf(stderr, "Error: Object #%d (0-indexed) is an instance which should have two unique fields: group/position (and optionally scale)\n", i);
+				fail();
+			}
+		}
+		// resets all error-checking variables back to 0
+		int camera_height_read = 0;
+		int camera_width_read = 0;
+		int sphere_diff_color_read = 0;
+		int sphere_spec_color_read = 0;
+		int sphere_position_read = 0;
+		int sphere_radius_read = 0;
+		int plane_diff_color_read = 0;
+		int plane_spec_color_read = 0;
+		int plane_position_read = 0;
+		int plane_normal_read = 0;
+		int light_color_read = 0;
+		int light_position_read = 0;
+		int light_direction_read = 0;
+		int light_rad2_read = 0;
+		int light_rad1_read = 0;
+		int light_rad0_read = 0;
+		int light_ang0_read = 0;
+		int light_theta_read = 0;
+		int sphere_reflectivity_read = 0;
+		int sphere_refractivity_read = 0;
+		int sphere_ior_read = 0;
+		int plane_reflectivity_read = 0;
+		int plane_refractivity_read = 0;
+		int plane_ior_read = 0;
+	    break;
+	  } 
+	  else if (c == ',') 
+	  {
+	  // read another field
+	  skip_ws(json);
+	  key = next_key(json, key_name);
+	  skip_ws(json);
+	  expect_c(json, ':');
+	  skip_ws(json);  
+	  if ((key == KEY_WIDTH) || 
+	      (key == KEY_HEIGHT) || // evaluates if field is either a width/height/radius/radial-a2/radial-a1/radial-a0/angular-a0/theta
+	      (key == KEY_RADIUS) ||
+		  (key == KEY_RADIAL_A2) || 
+	      (key == KEY_RADIAL_A1) ||
+		  (key == KEY_RADIAL_A0) ||
+		  (key == KEY_ANGULAR_A0) ||
+		  (key == KEY_THETA) ||
+		  (key == KEY_REFLECTIVITY) ||
+		  (key == KEY_REFRACTIVITY) ||
+		  (key == KEY_IOR) ||
+		  (key == KEY_SHININESS) ||
+		  (key == KEY_SCALE))
+	  {
+	    double value = next_number(json);
+		if(key == KEY_WIDTH && objects[i].kind == 0) // evaluates only if key is width and current object is a camera
+		{
+			objects[i].camera.width = value;
+			glob_width = value; // stores camera width to prevent need to iterate through objects later
+			camera_width_read++; // increments error checking variable for camera width field being read
+		}
+		else if(key == KEY_HEIGHT && objects[i].kind == 0) // evaluates only if key is height and current object is a camera
+		{
+			objects[i].camera.height = value; 
+			glob_height = value; // stores camera height to prevent need to iterate through objects later
+			camera_height_read++; // increments error checking variable for camera height field being read
+		}
+		else if(key == KEY_RADIUS && objects[i].kind == 1) // evaluates only if key is radius and current object is a sphere
+		{
+			if(value <= 0) // error check to make sure a negative radius isn't read in from json file
+			{
+				fprintf(stderr, "Error: Sphere radius should not be less than or equal to 0. Violation found on line number %d.\n", line);
+				fail();
+			}
+			objects[i].sphere.radius = value;
+			sphere_radius_read++; // increments error checking variable for sphere radius field being read
+		}
+		
+		else if(key == KEY_RADIAL_A2 && objects[i].kind == 3) // evaluates only if key is radial-a2 and current object is a light
+		{
+			if(value < 0) // error check to make sure a negative radial-a2 isn't read in from json file
+			{
+				fprintf(stderr, "Error: radial-a2 must be positive. Violation found on line number %d.\n", line);
+				fail();
+			}
+			objects[i].light.radial_a2 = value;
+			light_rad2_read++; // increments error checking variable for radial-a2 field being read
+		}
+		else if(key == KEY_RADIAL_A1 && objects[i].kind == 3) // evaluates only if key is radial-a1 and current object is a light
+		{
+			if(value < 0) // error check to make sure a negative radial-a1 isn't read in from json file
+			{
+				fprintf(stderr, "Error: radial-a1 must be positive. Violation found on line number %d.\n", line);
+				fail();
+			}
+			objects[i].light.radial_a1 = value;
+			light_rad1_read++; // increments error checking variable for radial-a1 field being read
+		}
+		else if(key == KEY_RADIAL_A0 && objects[i].kind == 3) // evaluates only if key is radial-a0 and current object is a light
+		{
+			if(value < 0) // error check to make sure a negative radial-a0 isn't read in from json file
+			{
+				fprintf(stderr, "Error: radial-a0 must be positive. Violation found on line number %d.\n", line);
+				fail();
+			}
+			objects[i].light.radial_a0 = value;
+			light_rad0_read++; // increments error checking variable for radial-a0 field being read
+		}
+		else if(key == KEY_ANGULAR_A0 && objects[i].kind == 3) // evaluates only if key is angular-a0 and current object is a light
+		{
+			if(value < 0) // error check to make sure a negative angular-a0 isn't read in from json file
+			{
+				fprintf(stderr, "Error: angular-a0 must be positive. Violation found on line number %d.\n", line);
+				fail();
+			}
+			objects[i].light.angular_a0 = value;
+			light_ang0_read++; // increments error checking variable for angular-a0 field being read
+		}
+		else if(key == KEY_THETA && objects[i].kind == 3) // evaluates only if key is angular-a0 and current object is a light
+		{
+			if(value < 0) // error check to make sure a negative theta isn't read in from json file
+			{
+				fprintf(stderr, "Error: theta must be greater than or equal to 0. Violation found on line number %d.\n", line);
+				fail();
+			}
+			objects[i].light.theta = value;
+			light_theta_read++; // increments error checking variable for theta field being read
+		}
+		else if(key == KEY_SCALE && objects[i].kind == 5) // evaluates only if key is scale and current object is an instance
+		{
+			if(value <= 0) // error check to make sure an instance isn't flattened or mirrored
+			{
+				fprintf(stderr, "Error: Instance scale should not be less than or equal to 0. Violation found on line number %d.\n", line);
+				fail();
+			}
+			objects[i].instance.scale = value;
+			instance_scale_read++; // increments error checking variable for instance scale field being read
+		}
+		else if((key == KEY_REFLECTIVITY && objects[i].kind == 1) || (key == KEY_REFLECTIVITY && objects[i].kind == 2)) // evaluates only if key is reflectivity and current object is a sphere or plane
+		{
+			if(objects[i].kind == 1)
+			{
+				if(value < 0 || value > 1) // error check to make sure reflectivity is between 0 and 1
+				{
+					fprintf(stderr, "Error: reflectivity must be between 0 and 1. Violation found on line number %d.\n", line);
+					fail();
+				}
+				objects[i].sphere.reflectivity = value;
+				sphere_reflectivity_read++;
+			}
+			else
+			{
+				if(value < 0 || value > 1) // error check to make sure reflectivity is between 0 and 1
+				{
+					fprintf(stderr, "Error: reflectivity must be between 0 and 1. Violation found on line number %d.\n", line);
+					fail();
+				}
+				objects[i].plane.reflectivity = value;
+				plane_reflectivity_read++;
+			}
+		}	
+		else if((key == KEY_REFRACTIVITY && objects[i].kind == 1) || (key == KEY_REFRACTIVITY && objects[i].kind == 2)) // evaluates only if key is refractivity and current object is a sphere or plane
+		{
+			if(objects[i].kind == 1)
+			{
+				if(value < 0 || value > 1) // error check to make sure refractivity is between 0 and 1
+				{
+					fprintf(stderr, "Error: refractivity must be between 0 and 1. Violation found on line number %d.\n", line);
+					fail();
+				}
+				objects[i].sphere.refractivity = value;
+				sphere_refractivity_read++;
+			}
+			else
+			{
+				if(value < 0 || value > 1) // error check to make sure refractivity is between 0 and 1
+				{
+					fprintf(stderr, "Error: refractivity must be between 0 and 1. Violation found on line number %d.\n", line);
+					fail();
+				}
+				objects[i].plane.refractivity = value;
+				plane_refractivity_read++;
+			}
+		}	
+		else if((key == KEY_SHININESS && objects[i].kind == 1) || (key == KEY_SHININESS && objects[i].kind == 2)) // evaluates only if key is shininess and current object is a sphere or plane
+		{
+			if(value < 0) // error check to make sure the specular exponent isn't negative
+			{
+				fprintf(stderr, "Error: shininess must not be negative. Violation found on line number %d.\n", line);
+				fail();
+			}
+			if(objects[i].kind == 1)
+			{
+				objects[i].sphere.shininess = value;
+				sphere_shininess_read++;
+			}
+			else
+			{
+				objects[i].plane.shininess = value;
+				plane_shininess_read++;
+			}
+		}
+		else if((key == KEY_IOR && objects[i].kind == 1) || (key == KEY_IOR && objects[i].kind == 2)) // evaluates only if key is ior and current object is a sphere or plane
+		{
+			if(objects[i].kind == 1)
+			{
+				objects[i].sphere.ior = value;
+				sphere_ior_read++;
+			}
+			else
+			{
+				objects[i].plane.ior = value;
+				plane_ior_read++;
+			}
+		}	
+		
+		
+		else // after key was identified as width/height/radius/radial-a2/radial-a1/radial-a0/angular-a0/theta, object type is unknown so display an error
+		{
+			fprintf(stderr, "Error: Only cameras should have width/height, spheres have radius, spheres and planes have reflectivity/refractivity/ior/shininess, lights have radial-a2/radial-a1/radial-a0/angular-a0/theta, and instances have scale. Violation found on line number %d.\n", line);
+            fail();
+		}
+		
+	  } 
+	  else if ((key == KEY_COLOR) ||
+		     (key == KEY_DIFFUSE_COLOR) ||
+		     (key == KEY_SPECULAR_COLOR) ||
+		     (key == KEY_POSITION) || // evaluates if field is either a color/diffuse_color/specular_color/position/normal/direction
+		     (key == KEY_NORMAL) ||
+			 (key == KEY_DIRECTION))
+	  { 
+	    double value[3];
+	    next_vector(json, value);
+		if(key == KEY_COLOR && objects[i].kind == 3) // evaluates only if key is color and current object is a light
+		{
+			int j = 0; // iterator variable for error-checking
+			for(j = 0; j < 3; j+=1) // error checking for loop to make sure color values from object are less than 0
+			{
+				if(value[j] < 0) // assuming color value must be less than 0
+				{
+					fprintf(stderr, "Error: Light color values must not be less than 0. Violation found on line number %d.\n", line); // CHECK ERROR CHECKING ON THIS
+					fail();
+				}
+			}
+			objects[i].light.color[0] = value[0];
+			objects[i].light.color[1] = value[1]; // assigns color values from value vector to current object 
+			objects[i].light.color[2] = value[2];
+			light_color_read++;
+			
+		}
+		else if((key == KEY_DIFFUSE_COLOR && objects[i].kind == 1) || (key == KEY_DIFFUSE_COLOR && objects[i].kind == 2)) // evaluates only if key is diffuse_color and current object is a sphere or plane
+		{
+			int j = 0; // iterator variable for error-checking
+			for(j = 0; j < 3; j+=1) // error checking for loop to make sure color values from object are between 0 and 1 (inclusive)
+			{
+				if(value[j] < 0 || value[j] > 1) // assuming color value must be between 0 and 1 (inclusive) due to example json file given along with corresponding ppm output file indicating so
+				{
+					fprintf(stderr, "Error: Sphere and Plane color values should be between 0 and 1 (inclusive). Violation found on line number %d.\n", line);
+					fail();
+				}
+			}
+			if(objects[i].kind == 1)
+			{
+				objects[i].sphere.diffuse_color[0] = value[0];
+				objects[i].sphere.diffuse_color[1] = value[1]; // assigns color values from value vector to current object 
+				objects[i].sphere.diffuse_color[2] = value[2];
+				sphere_diff_color_read++; // increments error checking variable for sphere color field being read
+			}
+			else if(objects[i].kind == 2)
+			{
+				objects[i].plane.diffuse_color[0] = value[0];
+				objects[i].plane.diffuse_color[1] = value[1]; // assigns color values from value vector to current object 
+				objects[i].plane.diffuse_color[2] = value[2];
+				plane_diff_color_read++; // increments error checking variable for plane color field being read
+			}
+		}
+		else if((key == KEY_SPECULAR_COLOR && objects[i].kind == 1) || (key == KEY_SPECULAR_COLOR && objects[i].kind == 2)) // evaluates only if key is diffuse_color and current object is a sphere or plane
+		{
+			int j = 0; // iterator variable for error-checking
+			for(j = 0; j < 3; j+=1) // error checking for loop to make sure color values from object are between 0 and 1 (inclusive)
+			{
+				if(value[j] < 0 || value[j] > 1) // assuming color value must be between 0 and 1 (inclusive) due to example json file given along with corresponding ppm output file indicating so
+				{
+					fprintf(stderr, "Error: Sphere and Plane color values should be between 0 and 1 (inclusive). Violation found on line number %d.\n", line);
+					fail();
+				}
+			}
+			if(objects[i].kind == 1)
+			{
+				objects[i].sphere.specular_color[0] = value[0];
+				objects[i].sphere.specular_color[1] = value[1]; // assigns color values from value vector to current object 
+				objects[i].sphere.specular_color[2] = value[2];
+				sphere_spec_color_read++; // increments error checking variable for sphere color field being read
+			}
+			else if(objects[i].kind == 2)
+			{
+				objects[i].plane.specular_color[0] = value[0];
+				objects[i].plane.specular_color[1] = value[1]; // assigns color values from value vector to current object 
+				objects[i].plane.specular_color[2] = value[2];
+				plane_spec_color_read++; // increments error checking variable for plane color field being read
+			}
+		}
+		else if((key == KEY_POSITION && objects[i].kind == 1) || ((key == KEY_POSITION && objects[i].kind == 2)) || ((key == KEY_POSITION && objects[i].kind == 3)) || ((key == KEY_POSITION && objects[i].kind == 5))) // evaluates only if key is position and current object is a sphere or plane or light or instance
+		{
+			if(objects[i].kind == 1)
+			{
+				objects[i].sphere.position[0] = value[0];
+				objects[i].sphere.position[1] = -value[1]; // assigns position values from value vector to current sphere object 
+				objects[i].sphere.position[2] = value[2];
+				sphere_position_read++; // increments error checking variable for sphere position field being read
+			}
+			else if(objects[i].kind == 2)
+			{
+				objects[i].plane.position[0] = value[0];
+				objects[i].plane.position[1] = value[1]; // assigns position values from value vector to current plane object 
+				objects[i].plane.position[2] = value[2];
+				plane_position_read++; // increments error checking variable for plane position field being read
+			}
+			else if(objects[i].kind == 3)
+			{
+				objects[i].light.position[0] = value[0];
+				objects[i].light.position[1] = -value[1]; // assigns position values from value vector to current light object 
+				objects[i].light.position[2] = value[2];
+				light_position_read++; // increments error checking variable for light position field being read
+			}
+			else if(objects[i].kind == 5)
+			{
+				objects[i].instance.position[0] = value[0];
+				objects[i].instance.position[1] = -value[1]; // assigns position values from value vector to current instance object (flipped like the positions of the spheres it places)
+				objects[i].instance.position[2] = value[2];
+				instance_position_read++; // increments error checking variable for instance position field being read
+			}
+			else // Evaluates if there is a mismatched object field with sphere/plane/light and position, but should never happen
+			{
+				fprintf(stderr, "Error: Mismatched object field \"%s\", on line %d.\n", key_name, line);
+				fail();
+			}
+		}
+		else if(key == KEY_DIRECTION && objects[i].kind == 3) // evaluates only if key is direction and current object is a light
+		{
+			objects[i].light.direction[0] = value[0];
+			objects[i].light.direction[1] = -value[1]; // assigns direction values from value vector to current light object 
+			objects[i].light.direction[2] = value[2];
+			light_direction_read++; // increments error checking variable for light direction field being read
+		}
+		else if(key == KEY_NORMAL && objects[i].kind == 2) // evaluates only if key is normal and current object is a plane
+		{
+			objects[i].plane.normal[0] = value[0];
+			objects[i].plane.normal[1] = value[1]; // assigns normal values from value vector to current plane object 
+			objects[i].plane.normal[2] = value[2];
+			plane_normal_read++; // increments error checking variable for plane normal field being read
+		}
+		else // after key was identified as color/diffuse_color/specular_color/position/direction/normal, object type is unknown so display an error
+		{
+			fprintf(stderr, "Error: Only spheres/planes/lights/instances have positions, spheres and planes have specular/diffuse colors, lights have colors and direction, and only planes have a normal. Violation found on line number %d.\n", line);
+            fail();
+		}
+	  } 
+	  else if (key == KEY_GROUP && objects[i].kind == 5) // evaluates only if key is group and current object is an instance
+	  {
+		char name[129];
+		next_string(json, name);
+		objects[i].instance.group = find_group(name);
+		if(objects[i].instance.group == -1)
+		{
+			fprintf(stderr, "Error: Unknown group, \"%s\", on line %d. Groups have to come before their instances.\n", name, line);
+			fail();
+		}
+		instance_group_read++; // increments error checking variable for instance group field being read
+	  }
+	  else if ((key == KEY_MATERIAL && objects[i].kind == 1) || (key == KEY_MATERIAL && objects[i].kind == 2)) // evaluates only if key is material and current object is a sphere or plane
+	  {
+		char name[129];
+		next_string(json, name);
+		int k = find_material(name);
+		if(k == -1)
+		{
+			fprintf(stderr, "Error: Unknown material, \"%s\", on line %d. Materials have to come before the objects using them.\n", name, line);
+			fail();
+		}
+		scene_material* source = &scene_materials[k];
+		if(objects[i].kind == 1)
+		{
+			memcpy(objects[i].sphere.diffuse_color, source->diffuse_color, sizeof(source->diffuse_color));
+			memcpy(objects[i].sphere.specular_color, source->specular_color, sizeof(source->specular_color));
+			objects[i].sphere.shininess = source->shininess;
+			objects[i].sphere.reflectivity = source->reflectivity;
+			objects[i].sphere.refractivity = source->refractivity;
+			objects[i].sphere.ior = source->ior;
+			sphere_diff_color_read++;
+			sphere_spec_color_read++;
+			sphere_shininess_read++;
+			sphere_reflectivity_read++;
+			sphere_refractivity_read++;
+			sphere_ior_read++;
+		}
+		else
+		{
+			memcpy(objects[i].plane.diffuse_color, source->diffuse_color, sizeof(source->diffuse_color));
+			memcpy(objects[i].plane.specular_color, source->specular_color, sizeof(source->specular_color));
+			objects[i].plane.shininess = source->shininess;
+			objects[i].plane.reflectivity = source->reflectivity;
+			objects[i].plane.refractivity = source->refractivity;
+			objects[i].plane.ior = source->ior;
+			plane_diff_color_read++;
+			plane_spec_color_read++;
+			plane_shininess_read++;
+			plane_reflectivity_read++;
+			plane_refractivity_read++;
+			plane_ior_read++;
+		}
+		material_read++; // increments error checking variable for material field being read
+	  }
+	  else // unknown field was read in so display an error
+	  { 
+	    fprintf(stderr, "Error: Unknown property, \"%s\", on line %d.\n", key_name, line);
+		fail();
+	  }
+	  skip_ws(json);
+	  } 
+	  else  // expecting either a new field or the end of an object so display an error
+	  {
+		fprintf(stderr, "Error: Unexpected value on line %d. Expected either ',' or '}' to indicate next field or end of object.\n", line);
+		fail();
+	  }
+     }
+  return i;
+}
+
+// parses the fields of a group object (its "name" and the list of its member "objects") once its type has been read. The group itself only takes up one object index, while each member is
+// parsed onto the end of the object arena like any other object and then moved into the group_members arena, so only instances ever place it in the scene
+int parse_group(json_reader* json)
+{
+  int i = new_object();
+  objects[i].kind = 4;
+  int g = new_group();
+  objects[i].group.index = g;
+  scene_groups[g].first = group_member_count;
+  
+  int name_read = 0;
+  int objects_read = 0;
+  char key_name[129];
+  char name[129];
+  
+  skip_ws(json);
+  while (1)
+  {
+    int c = next_c(json);
+    if (c == '}')
+      break;
+    if (c != ',')
+    {
+      fprintf(stderr, "Error: Unexpected value on line %d. Expected either ',' or '}' to indicate next field or end of object.\n", line);
+      fail();
+    }
+    
+    skip_ws(json);
+    int key = next_key(json, key_name);
+    skip_ws(json);
+    expect_c(json, ':');
+    skip_ws(json);
+    
+    if (key == KEY_NAME)
+    {
+      next_string(json, name);
+      if (find_group(name) != -1)
+      {
+        fprintf(stderr, "Error: Group name \"%s\" is used twice. Violation found on line %d.\n", name, line);
+        fail();
+      }
+      strcpy(scene_groups[g].name, name);
+      name_read++;
+    }
+    else if (key == KEY_OBJECTS)
+    {
+      expect_c(json, '[');
+      skip_ws(json);
+      while (1)
+      {
+        c = next_c(json);
+        if (c != '{')
+        {
+          fprintf(stderr, "Error: Expecting '{' on line %d. Groups should hold at least one object.\n", line);
+          fail();
+        }
+        
+        int member = parse_object(json, 1);
+        if (objects[member].kind != 1)
+        {
+          fprintf(stderr, "Error: Groups can only hold spheres. Violation found on line %d.\n", line);
+          fail();
+        }
+        
+        // block of code which moves the member off the end of the object arena into the group_members arena
+        if (group_member_count == group_member_capacity)
+        {
+          int capacity = (group_member_capacity == 0) ? 64 : group_member_capacity * 2;
+          Object* grown = realloc(group_members, sizeof(Object) * capacity);
+          if (grown == NULL)
+          {
+            fprintf(stderr, "Error: Could not allocate memory for %d group members.\n", capacity);
+            fail();
+          }
+          group_members = grown;
+          group_member_capacity = capacity;
+        }
+        group_members[group_member_count++] = objects[member];
+        object_count--;
+        scene_groups[g].count++;
+        // end of moving the member
+        
+        skip_ws(json);
+        c = next_c(json);
+        if (c == ']')
+          break;
+        if (c != ',')
+        {
+          fprintf(stderr, "Error: Expecting ',' or ']' on line %d.\n", line);
+          fail();
+        }
+        skip_ws(json);
+      }
+      objects_read++;
+    }
+    else
+    {
+      fprintf(stderr, "Error: Groups only have name/objects fields, found \"%s\" on line %d.\n", key_name, line);
+      fail();
+    }
+    skip_ws(json);
+  }
+  
+  if (name_read != 1 || objects_read != 1)
+  {
+    fprintf(stderr, "Error: Object #%d (0-indexed) is a group which should have two unique fields: name/objects\n", i);
+    fail();
+  }
+  return i;
+}
+
+// returns the index of the group with the given name among the groups parsed so far, or -1 if there's none
+int find_group(char* name)
+{
+  for (int g = 0; g < scene_group_count; g += 1)
+  {
+    if (strcmp(scene_groups[g].name, name) == 0)
+      return g;
+  }
+  return -1;
+}
+
+// parses the fields of a material object ("name", the diffuse_color/specular_color it needs and the optional shininess/reflectivity/refractivity/ior, which default like a sphere's)
+// once its type has been read. The material takes up one object index, and its fields go into the scene_materials arena where spheres and planes look them up by name
+int parse_material(json_reader* json)
+{
+  int i = new_object();
+  objects[i].kind = 6;
+  int k = new_material();
+  objects[i].material.index = k;
+  scene_material* m = &scene_materials[k];
+  m->shininess = 20;
+  m->ior = 1;
+  
+  int name_read = 0;
+  int diffuse_read = 0;
+  int specular_read = 0;
+  int optional_read[4] = {0, 0, 0, 0}; // shininess/reflectivity/refractivity/ior
+  char key_name[129];
+  char name[129];
+  
+  skip_ws(json);
+  while (1)
+  {
+    int c = next_c(json);
+    if (c == '}')
+      break;
+    if (c != ',')
+    {
+      fprintf(stderr, "Error: Unexpected value on line %d. Expected either ',' or '}' to indicate next field or end of object.\n", line);
+      fail();
+    }
+    
+    skip_ws(json);
+    int key = next_key(json, key_name);
+    skip_ws(json);
+    expect_c(json, ':');
+    skip_ws(json);
+    
+    if (key == KEY_NAME)
+    {
+      next_string(json, name);
+      if (find_material(name) != -1)
+      {
+        fprintf(stderr, "Error: Material name \"%s\" is used twice. Violation found on line %d.\n", name, line);
+        fail();
+      }
+      strcpy(m->name, name);
+      name_read++;
+    }
+    else if (key == KEY_DIFFUSE_COLOR || key == KEY_SPECULAR_COLOR)
+    {
+      double value[3];
+      next_vector(json, value);
+      for (int j = 0; j < 3; j += 1)
+      {
+        if (value[j] < 0 || value[j] > 1)
+        {
+          fprintf(stderr, "Error: Material color values should be between 0 and 1 (inclusive). Violation found on line number %d.\n", line);
+          fail();
+        }
+      }
+      memcpy(key == KEY_DIFFUSE_COLOR ? m->diffuse_color : m->specular_color, value, sizeof(value));
+      if (key == KEY_DIFFUSE_COLOR)
+        diffuse_read++;
+      else
+        specular_read++;
+    }
+    else if (key == KEY_SHININESS || key == KEY_REFLECTIVITY || key == KEY_REFRACTIVITY || key == KEY_IOR)
+    {
+      double value = next_number(json);
+      if (key == KEY_SHININESS && value < 0)
+      {
+        fprintf(stderr, "Error: shininess must not be negative. Violation found on line number %d.\n", line);
+        fail();
+      }
+      if ((key == KEY_REFLECTIVITY || key == KEY_REFRACTIVITY) && (value < 0 || value > 1))
+      {
+        fprintf(stderr, "Error: %s must be between 0 and 1. Violation found on line number %d.\n", key_name, line);
+        fail();
+      }
+      if (key == KEY_SHININESS)
+      {
+        m->shininess = value;
+        optional_read[0]++;
+      }
+      else if (key == KEY_REFLECTIVITY)
+      {
+        m->reflectivity = value;
+        optional_read[1]++;
+      }
+      else if (key == KEY_REFRACTIVITY)
+      {
+        m->refractivity = value;
+        optional_read[2]++;
+      }
+      else
+      {
+        m->ior = value;
+        optional_read[3]++;
+      }
+    }
+    else
+    {
+      fprintf(stderr, "Error: Materials only have name/diffuse_color/specular_color/shininess/reflectivity/refractivity/ior fields, found \"%s\" on line %d.\n", key_name, line);
+      fail();
+    }
+    skip_ws(json);
+  }
+  
+  if (name_read != 1 || diffuse_read != 1 || specular_read != 1 || optional_read[0] > 1 || optional_read[1] > 1 || optional_read[2] > 1 || optional_read[3] > 1)
+  {
+    fprintf(stderr, "Error: Object #%d (0-indexed) is a material which should have three unique fields: name/diffuse_color/specular_color (and optionally shininess/reflectivity/refractivity/ior)\n", i);
+    fail();
+  }
+  if (m->reflectivity + m->refractivity > 1)
+  {
+    fprintf(stderr, "Error: Object #%d (0-indexed) is a material which has an invalid combination of reflectivity/refractivity values; refractivity + refractivity must not be greater than 1.\n", i);
+    fail();
+  }
+  return i;
+}
+
+// returns the index of the material with the given name among the materials parsed so far, or -1 if there's none
+int find_material(char* name)
+{
+  for (int k = 0; k < scene_material_count; k += 1)
+  {
+    if (strcmp(scene_materials[k].name, name) == 0)
+      return k;
+  }
+  return -1;
+}
+
+// returns the position field of the given object, or NULL for the camera (which always sits at the origin)
+double* object_position(Object* object)
+{
+	if(object->kind == 1)
+		return object->sphere.position;
+	if(object->kind == 2)
+		return object->plane.position;
+	if(object->kind == 3)
+		return object->light.position;
+	if(object->kind == 5)
+		return object->instance.position;
+	return NULL;
+}
+
+// qsort() comparison which orders keyframes by object and then by frame
+int compare_keyframes(const void* a, const void* b)
+{
+	const keyframe* ka = a;
+	const keyframe* kb = b;
+	if(ka->object != kb->object)
+		return ka->object < kb->object ? -1 : 1;
+	if(ka->frame != kb->frame)
+		return ka->frame < kb->frame ? -1 : 1;
+	return 0;
+}
+
+// function which parses the --keyframes file (once the scene is parsed, since keyframes refer to its objects by index), sorts the keyframes by object and frame and
+// remembers where every object sits in the scene file so animate_frame() can move it back there in frames it has no keyframes for
+void read_keyframes(char* filename)
+{
+	json_reader json;
+	if(!open_json(filename, &json))
+		exit(1);
+	line = 1;
+	parse_keyframes(&json);
+	close_json(&json);
+	
+	qsort(keyframes, keyframe_count, sizeof(keyframe), compare_keyframes);
+	
+	first_keyframe = malloc(sizeof(int) * (object_count + 1));
+	int k = 0;
+	int last_frame = 0;
+	for(int i = 0; i <= object_count; i+=1)
+	{
+		first_keyframe[i] = k;
+		while(k < keyframe_count && keyframes[k].object == i)
+		{
+			if(k > first_keyframe[i] && keyframes[k].frame == keyframes[k - 1].frame)
+			{
+				fprintf(stderr, "Error: Object #%d (0-indexed) has more than one keyframe for frame %d\n", i, keyframes[k].frame);
+				exit(1);
+			}
+			if(keyframes[k].frame > last_frame)
+				last_frame = keyframes[k].frame;
+			k += 1;
+		}
+	}
+	
+	if(frame_count == 0) // renders through the last keyframe unless told otherwise
+		frame_count = last_frame + 1;
+	
+	scene_positions = malloc(sizeof(double) * 3 * (object_count + 1));
+	for(int i = 0; i < object_count; i+=1)
+	{
+		double* position = object_position(&objects[i]);
+		for(int c = 0; c < 3; c+=1)
+			scene_positions[3 * i + c] = (position != NULL) ? position[c] : 0;
+		if(objects[i].kind == 0)
+			camera_object = i;
+	}
+}
+
+// function which parses a keyframe list of the form [{"frame": 0, "object": 2, "position": [x, y, z]}, ...] held in memory; every field is required, and the object's index is
+// its (0-indexed) place in the scene file, where the camera's keyframes move the view instead of an object
+void parse_keyframes(json_reader* json)
+{
+	int capacity = 0;
+	
+	skip_ws(json);
+	expect_c(json, '[');
+	skip_ws(json);
+	if(json->data[json->pos] == ']')
+	{
+		fprintf(stderr, "Error: Empty keyframe file.\n");
+		exit(1);
+	}
+	
+	while(1)
+	{
+		keyframe key_frame;
+		int frame_read = 0;
+		int object_read = 0;
+		int position_read = 0;
+		double position[3];
+		
+		expect_c(json, '{');
+		while(1)
+		{
+			char key_name[129]; // raw text of the current key, only kept around for error messages
+			skip_ws(json);
+			int key = next_key(json, key_name);
+			skip_ws(json);
+			expect_c(json, ':');
+			skip_ws(json);
+			
+			if(key == KEY_FRAME || key == KEY_OBJECT)
+			{
+				double value = next_number(json);
+				if(value < 0 || value != (int)value)
+				{
+					fprintf(stderr, "Error: \"%s\" must be a whole number that isn't negative, on line %d.\n", key_name, line);
+					exit(1);
+				}
+				if(key == KEY_FRAME)
+				{
+					key_frame.frame = (int)value;
+					frame_read++;
+				}
+				else
+				{
+					key_frame.object = (int)value;
+					object_read++;
+				}
+			}
+			else if(key == KEY_POSITION)
+			{
+				next_vector(json, position);
+				position_read++;
+			}
+			else
+			{
+				fprintf(stderr, "Error: Unknown keyframe property, \"%s\", on line %d.\n", key_name, line);
+				exit(1);
+			}
+			
+			skip_ws(json);
+			int c = next_c(json);
+			if(c == '}')
+				break;
+			if(c != ',')
+			{
+				fprintf(stderr, "Error: Unexpected value on line %d. Expected either ',' or '}' to indicate next field or end of keyframe.\n", line);
+				exit(1);
+			}
+		}
+		
+		if(frame_read != 1 || object_read != 1 || position_read != 1)
+		{
+			fprintf(stderr, "Error: Keyframe #%d (0-indexed) should have three unique fields: frame/object/position\n", keyframe_count);
+			exit(1);
+		}
+		if(key_frame.object >= object_count)
+		{
+			fprintf(stderr, "Error: Keyframe #%d (0-indexed) refers to object #%d, but the scene only has %d objects\n", keyframe_count, key_frame.object, object_count);
+			exit(1);
+		}
+		
+		// the position is flipped the way the parser flips the object's own position (planes aren't, while the camera moves like a sphere would)
+		key_frame.position[0] = position[0];
+		key_frame.position[1] = (objects[key_frame.object].kind == 2) ? position[1] : -position[1];
+		key_frame.position[2] = position[2];
+		
+		if(keyframe_count == capacity)
+		{
+			capacity = (capacity == 0) ? 64 : capacity * 2;
+			keyframes = realloc(keyframes, sizeof(keyframe) * capacity);
+		}
+		keyframes[keyframe_count++] = key_frame;
+		
+		skip_ws(json);
+		int c = next_c(json);
+		if(c == ']')
+			return;
+		if(c != ',')
+		{
+			fprintf(stderr, "Error: Expecting ',' or ']' on line %d.\n", line);
+			exit(1);
+		}
+		skip_ws(json);
+	}
+}
+
+// finds where object i is in the given frame: linearly interpolated between the keyframes around the frame, held at the first/last keyframe before/after them, or its position in
+// the scene file when it has no keyframes at all
+void keyframe_position(int i, int frame, double* position)
+{
+	int first = first_keyframe[i];
+	int end = first_keyframe[i + 1];
+	
+	if(first == end)
+	{
+		memcpy(position, &scene_positions[3 * i], sizeof(double) * 3);
+		return;
+	}
+	
+	int k = first;
+	while(k + 1 < end && keyframes[k + 1].frame <= frame) // keyframes are sorted by frame, so this stops at the last one at or before the frame
+		k += 1;
+	
+	if(frame <= keyframes[k].frame || k + 1 == end)
+	{
+		memcpy(position, keyframes[k].position, sizeof(double) * 3);
+		return;
+	}
+	
+	double t = (double)(frame - keyframes[k].frame) / (keyframes[k + 1].frame - keyframes[k].frame);
+	for(int c = 0; c < 3; c+=1)
+		position[c] = keyframes[k].position[c] + (keyframes[k + 1].position[c] - keyframes[k].position[c]) * t;
+}
+
+// moves every object to its position in the given frame; the renderer always looks from the origin, so moving the camera moves everything else the opposite way instead
+void animate_frame(int frame)
+{
+	double camera[3] = {0, 0, 0};
+	if(camera_object >= 0)
+		keyframe_position(camera_object, frame, camera);
+	
+	for(int i = 0; i < object_count; i+=1)
+	{
+		double* position = object_position(&objects[i]);
+		if(position == NULL)
+			continue;
+		
+		keyframe_position(i, frame, position);
+		for(int c = 0; c < 3; c+=1)
+			position[c] -= camera[c];
+	}
+}
+
+// turns the output file name out.ppm into out_0007.ppm for frame 7 of a batch
+void numbered_output_name(char* output_file_name, int frame, char* out, int size)
+{
+	int stem_length = strlen(output_file_name) - 4; // the name was checked to end in .ppm
+	if(snprintf(out, size, "%.*s_%04d.ppm", stem_length, output_file_name, frame) >= size)
+	{
+		fprintf(stderr, "Error: Output file name is too long.\n");
+		exit(1);
+	}
+}
+
+// appends a zeroed object to the global object arena and returns its index; the arena doubles in size whenever it runs out of room, so pointers into it are only stable once parsing is done
+int new_object()
+{
+	if(object_count == object_capacity)
+	{
+		int capacity = (object_capacity == 0) ? 64 : object_capacity * 2;
+		Object* grown = realloc(objects, sizeof(Object) * capacity);
+		if(grown == NULL)
+		{
+			fprintf(stderr, "Error: Could not allocate memory for %d objects.\n", capacity);
+			fail();
+		}
+		objects = grown;
+		object_capacity = capacity;
+	}
+	
+	memset(&objects[object_count], 0, sizeof(Object));
+	return object_count++;
+}
+
+// appends an empty group to the global scene_groups, which grow like the object arena, and returns its index
+int new_group()
+{
+	if(scene_group_count == scene_group_capacity)
+	{
+		int capacity = (scene_group_capacity == 0) ? 16 : scene_group_capacity * 2;
+		scene_group* grown = realloc(scene_groups, sizeof(scene_group) * capacity);
+		if(grown == NULL)
+		{
+			fprintf(stderr, "Error: Could not allocate memory for %d groups.\n", capacity);
+			fail();
+		}
+		scene_groups = grown;
+		scene_group_capacity = capacity;
+	}
+	
+	memset(&scene_groups[scene_group_count], 0, sizeof(scene_group));
+	return scene_group_count++;
+}
+
+// appends an empty material to the global scene_materials, which grow like the object arena, and returns its index
+int new_material()
+{
+	if(scene_material_count == scene_material_capacity)
+	{
+		int capacity = (scene_material_capacity == 0) ? 16 : scene_material_capacity * 2;
+		scene_material* grown = realloc(scene_materials, sizeof(scene_material) * capacity);
+		if(grown == NULL)
+		{
+			fprintf(stderr, "Error: Could not allocate memory for %d materials.\n", capacity);
+			fail();
+		}
+		scene_materials = grown;
+		scene_material_capacity = capacity;
+	}
+	
+	memset(&scene_materials[scene_material_count], 0, sizeof(scene_material));
+	return scene_material_count++;
+}
+
+// frees the object arena in one shot along with the other global buffers allocated by main()
+void free_scene()
+{
+	free(objects);
+	objects = NULL;
+	object_count = 0;
+	object_capacity = 0;
+	free(scene_groups);
+	free(group_members);
+	scene_groups = NULL;
+	group_members = NULL;
+	scene_group_count = scene_group_capacity = 0;
+	group_member_count = group_member_capacity = 0;
+	free(scene_materials);
+	scene_materials = NULL;
+	scene_material_count = scene_material_capacity = 0;
+	
+	if(output_map == NULL) // a mapped image_buffer is released by write_image_data()
+		free(image_buffer);
+	free(header_buffer->file_format);
+	free(header_buffer->file_comment);
+	free(header_buffer->file_height);
+	free(header_buffer->file_width);
+	free(header_buffer->file_maxcolor);
+	free(header_buffer);
+	free(worker_stats);
+	worker_stats = NULL;
+	worker_stats_count = 0;
+	
+	free_compiled_scene(&compiled_scene);
+	for(int f = 0; f < scene_file_count; f+=1)
+		free(scene_files[f]);
+	free(scene_files);
+	scene_files = NULL;
+	scene_file_count = 0;
+	free(keyframes);
+	free(first_keyframe);
+	free(scene_positions);
+	keyframes = NULL;
+	first_keyframe = NULL;
+	scene_positions = NULL;
+	keyframe_count = 0;
+}
+
+// exits after the caller has printed an error, unless the render server is loading a scene or writing an image on this thread, in which case it jumps back to the server
+// so only that request fails
+void fail()
+{
+	if(error_jump != NULL)
+		longjmp(*error_jump, 1);
+	exit(1);
+}
+
+// runs the render server: listens on a unix domain socket (or on a TCP port when given host:port), where every connection sends one request per line and gets one line back for each:
+//   render WIDTH HEIGHT OUTPUT.ppm SCENE.json   renders the scene file into the output file
+//   render WIDTH HEIGHT OUTPUT.ppm - LENGTH     renders the LENGTH bytes of json following the line
+// answered with "ok SECONDS hit|miss" (whether the scene came out of the cache) or "error MESSAGE". A distributed render (see distribute_frame()) instead sends
+//   scene LENGTH HASH                           makes the scene with the given length and hash_bytes() (in hex) the connection's current scene
+//   tile WIDTH HEIGHT X0 Y0 X1 Y1               renders the pixels [X0, X1) x [Y0, Y1) of a WIDTH x HEIGHT image of the current scene
+// where a scene which isn't cached is answered with "need", after which its LENGTH bytes are sent, and then with "ok SECONDS hit|miss SETTINGS" (see render_settings()),
+// and a tile with "tile LENGTH" followed by its LENGTH bytes of rgb pixels, row by row. A fixed pool of serve_workers threads accepts connections, so that many
+// requests render at once and further connections wait in the listen backlog
+int serve(char* socket_path)
+{
+	int listener = open_socket(socket_path, 1);
+	if(listener < 0)
+	{
+		fprintf(stderr, "Error: Could not listen on \"%s\"\n", socket_path);
+		return -1;
+	}
+	
+	signal(SIGPIPE, SIG_IGN); // a client hanging up early shows up as a failed write instead of killing the server
+	scene_cache = malloc(sizeof(cached_scene*) * (cache_capacity + 1));
+	
+	fprintf(stderr, "Serving on %s with %d workers of %d render threads each\n", socket_path, serve_workers, thread_count);
+	
+	// the calling thread acts as worker 0, so only serve_workers - 1 extra threads are started
+	pthread_t* workers = malloc(sizeof(pthread_t) * serve_workers);
+	for(int w = 1; w < serve_workers; w+=1)
+	{
+		if(pthread_create(&workers[w], NULL, serve_main, &listener) != 0)
+		{
+			fprintf(stderr, "Error: Could not start server worker %d\n", w);
+			return -1;
+		}
+	}
+	serve_main(&listener);
+	return 0; // never reached, serve_main() only returns if accept() stops working
+}
+
+// thread entry point for a render server worker: takes the next waiting connection and answers its requests, for as long as the server runs
+void* serve_main(void* arg)
+{
+	int listener = *(int*)arg;
+	
+	while(1)
+	{
+		int fd = accept(listener, NULL, NULL);
+		if(fd < 0)
+		{
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			fprintf(stderr, "Error: Could not accept connections\n");
+			exit(1);
+		}
+		serve_connection(fd);
+	}
+	
+	return NULL;
+}
+
+// answers the render requests of one connection (see serve()) until the client hangs up
+void serve_connection(int fd)
+{
+	FILE* in = fdopen(fd, "r");
+	if(in == NULL)
+	{
+		close(fd);
+		return;
+	}
+	
+	cached_scene* current = NULL; // scene of the connection's tile requests, which keeps a use on it until it's replaced or the client hangs up
+	char request[8448];
+	while(fgets(request, sizeof(request), in) != NULL)
+	{
+		char command[16];
+		int width = 0;
+		int height = 0;
+		char output[4096];
+		char scene_path[4096];
+		size_t length = 0;
+		
+		if(strncmp(request, "scene ", 6) == 0)
+		{
+			if(!serve_scene(fd, in, request, &current))
+				break; // the connection is out of step with the requests now
+			continue;
+		}
+		if(strncmp(request, "tile ", 5) == 0)
+		{
+			serve_tile(fd, request, current);
+			continue;
+		}
+		
+		int fields = sscanf(request, "%15s %d %d %4095s %4095s %zu", command, &width, &height, output, scene_path, &length);
+		int output_length = (fields >= 4) ? strlen(output) : 0;
+		if(fields < 5 || strcmp(command, "render") != 0 || (strcmp(scene_path, "-") == 0 && fields != 6))
+		{
+			dprintf(fd, "error expected: render WIDTH HEIGHT OUTPUT.ppm SCENE.json (or - LENGTH followed by the json)\n");
+			continue;
+		}
+		
+		// block of code which gets the scene's json into memory, either mapped from its file or read off the connection
+		json_reader json;
+		json.pos = 0;
+		if(strcmp(scene_path, "-") == 0)
+		{
+			if(length > SERVE_MAX_SCENE_BYTES)
+			{
+				dprintf(fd, "error the json can't be longer than %d bytes\n", SERVE_MAX_SCENE_BYTES);
+				break; // the bytes that follow aren't read, so the connection is out of step with the requests now
+			}
+			char* copy = malloc(length + 1);
+			if(copy == NULL)
+			{
+				dprintf(fd, "error out of memory for %zu bytes of json\n", length);
+				break;
+			}
+			json.data = copy;
+			json.size = fread(copy, 1, length, in);
+			json.mapped = 0;
+			if(json.size != length)
+			{
+				free(copy);
+				dprintf(fd, "error expected %zu bytes of json\n", length);
+				break; // the connection is out of step with the requests now
+			}
+		}
+		else if(!open_json(scene_path, &json))
+		{
+			dprintf(fd, "error could not read %s\n", scene_path);
+			continue;
+		}
+		// end of reading the json
+		
+		if(width <= 0 || height <= 0 || output_length < 4 || strcmp(output + output_length - 4, ".ppm") != 0)
+		{
+			close_json(&json);
+			dprintf(fd, "error width/height must be greater than 0 and the output must be a .ppm file\n");
+			continue;
+		}
+		if((long long)width * height > SERVE_MAX_PIXELS)
+		{
+			close_json(&json);
+			dprintf(fd, "error the image can't have more than %d pixels\n", SERVE_MAX_PIXELS);
+			continue;
+		}
+		
+		double start = now_seconds();
+		int hit;
+		cached_scene* entry = acquire_scene(&json, &hit);
+		close_json(&json); // the compiled scene doesn't point into the json
+		if(entry == NULL)
+		{
+			dprintf(fd, "error the scene couldn't be parsed\n");
+			continue;
+		}
+		
+		image_data* image = malloc(sizeof(image_data) * width * height + 1);
+		if(image == NULL)
+		{
+			release_scene(entry);
+			dprintf(fd, "error out of memory for a %d x %d image\n", width, height);
+			continue;
+		}
+		raycasting(&entry->scene, image, width, height);
+		release_scene(entry);
+		
+		jmp_buf jump;
+		error_jump = &jump;
+		if(setjmp(jump) == 0)
+		{
+			write_ppm(output, image, width, height);
+			error_jump = NULL;
+			dprintf(fd, "ok %.6f %s\n", now_seconds() - start, hit ? "hit" : "miss");
+		}
+		else
+		{
+			error_jump = NULL;
+			dprintf(fd, "error could not write %s\n", output);
+		}
+		free(image);
+	}
+	
+	if(current != NULL)
+		release_scene(current);
+	fclose(in);
+}
+
+// answers a "scene LENGTH HASH" request (see serve()): a scene which is cached under that hash is used as it is, otherwise "need" asks for its bytes, which are then parsed and cached
+// like a render request's. The scene becomes the connection's current one; returns 0 when the bytes didn't arrive, leaving the connection out of step with the requests
+int serve_scene(int fd, FILE* in, char* request, cached_scene** current)
+{
+	size_t length = 0;
+	unsigned long long hash = 0;
+	if(sscanf(request, "scene %zu %llx", &length, &hash) != 2)
+	{
+		dprintf(fd, "error expected: scene LENGTH HASH\n");
+		return 1;
+	}
+	
+	double start = now_seconds();
+	int hit = 1;
+	cached_scene* entry = lookup_scene(hash, length);
+	if(entry == NULL)
+	{
+		if(length > SERVE_MAX_SCENE_BYTES)
+		{
+			dprintf(fd, "error the scene can't be longer than %d bytes\n", SERVE_MAX_SCENE_BYTES);
+			return 1; // nothing was asked for, so the connection is still in step
+		}
+		char* copy = malloc(length + 1);
+		if(copy == NULL)
+		{
+			dprintf(fd, "error out of memory for %zu bytes of scene\n", length);
+			return 1;
+		}
+		dprintf(fd, "need\n");
+		json_reader json;
+		json.data = copy;
+		json.size = fread(copy, 1, length, in);
+		json.pos = 0;
+		json.mapped = 0;
+		if(json.size != length)
+		{
+			free(copy);
+			dprintf(fd, "error expected %zu bytes of scene\n", length);
+			return 0;
+		}
+		entry = acquire_scene(&json, &hit);
+		close_json(&json);
+		if(entry == NULL)
+		{
+			dprintf(fd, "error the scene couldn't be parsed\n");
+			return 1;
+		}
+	}
+	
+	if(*current != NULL)
+		release_scene(*current);
+	*current = entry;
+	
+	char settings[512];
+	render_settings(settings, sizeof(settings));
+	dprintf(fd, "ok %.6f %s %s\n", now_seconds() - start, hit ? "hit" : "miss", settings);
+	return 1;
+}
+
+// answers a "tile WIDTH HEIGHT X0 Y0 X1 Y1" request (see serve()) by rendering that tile of the connection's current scene and sending back its pixels
+void serve_tile(int fd, char* request, cached_scene* current)
+{
+	int width = 0;
+	int height = 0;
+	tile t;
+	if(sscanf(request, "tile %d %d %d %d %d %d", &width, &height, &t.x0, &t.y0, &t.x1, &t.y1) != 6)
+	{
+		dprintf(fd, "error expected: tile WIDTH HEIGHT X0 Y0 X1 Y1\n");
+		return;
+	}
+	if(current == NULL)
+	{
+		dprintf(fd, "error no scene was sent before the tile\n");
+		return;
+	}
+	if(width <= 0 || height <= 0 || t.x0 < 0 || t.y0 < 0 || t.x1 > width || t.y1 > height || t.x0 >= t.x1 || t.y0 >= t.y1)
+	{
+		dprintf(fd, "error the tile must be a non-empty part of a WIDTH x HEIGHT image\n");
+		return;
+	}
+	if((long long)(t.x1 - t.x0) * (t.y1 - t.y0) > SERVE_MAX_PIXELS)
+	{
+		dprintf(fd, "error the tile can't have more than %d pixels\n", SERVE_MAX_PIXELS);
+		return;
+	}
+	
+	size_t length = sizeof(image_data) * (t.x1 - t.x0) * (t.y1 - t.y0);
+	image_data* pixels = malloc(length + 1);
+	if(pixels == NULL || !render_image_tile(&current->scene, width, height, &t, pixels))
+	{
+		free(pixels);
+		dprintf(fd, "error out of memory for a %d x %d tile\n", t.x1 - t.x0, t.y1 - t.y0);
+		return;
+	}
+	dprintf(fd, "tile %zu\n", length);
+	send_all(fd, (const char*)pixels, length); // a client which hung up shows up as the next fgets() failing
+	free(pixels);
+}
+
+// renders the frame on the render servers of --workers: the scene file is sent to every worker (only its hash when the worker already has it cached), the image is split into
+// DIST_TILE_SIZE tiles, and every idle worker is handed the next tile until all of them have come back. A worker which hangs up, answers out of turn or takes longer than
+// tile_timeout is dropped and its tile goes back to the front of the queue for another worker; once there's no worker left the remaining tiles are rendered locally from
+// the compiled_scene main() built. Every tile renders exactly as it would in a local render (see render_image_tile()), so the image is the same either way
+void distribute_frame(char* scene_file, image_data* image, int width, int height)
+{
+	double start = now_seconds();
+	char line[1024];
+	
+	if(dist_workers == NULL)
+		connect_workers();
+	
+	json_reader json;
+	if(!open_json(scene_file, &json))
+	{
+		fprintf(stderr, "Error: Could not read %s to send to the workers\n", scene_file);
+		exit(1);
+	}
+	unsigned long long hash = hash_bytes(json.data, json.size);
+	
+	// block of code which makes the scene every worker's current scene; the requests all go out first so the workers that need to parse it do so side by side
+	char request[128];
+	snprintf(request, sizeof(request), "scene %zu %016llx\n", json.size, hash);
+	for(int w = 0; w < dist_worker_count; w+=1)
+	{
+		dist_worker* worker = &dist_workers[w];
+		worker->deadline = now_seconds() + tile_timeout;
+		if(worker->fd >= 0 && !send_all(worker->fd, request, strlen(request)))
+			drop_worker(worker, "hung up");
+	}
+	int* sent_scene = calloc(dist_worker_count + 1, sizeof(int));
+	for(int w = 0; w < dist_worker_count; w+=1)
+	{
+		dist_worker* worker = &dist_workers[w];
+		if(worker->fd < 0)
+			continue;
+		if(!wait_reply_line(worker, line, sizeof(line)))
+			drop_worker(worker, "didn't answer the scene request");
+		else if(strcmp(line, "need") == 0)
+		{
+			sent_scene[w] = 1;
+			if(!send_all(worker->fd, json.data, json.size))
+				drop_worker(worker, "hung up");
+		}
+		else
+			check_scene_answer(worker, line); // the scene was cached
+	}
+	for(int w = 0; w < dist_worker_count; w+=1)
+	{
+		dist_worker* worker = &dist_workers[w];
+		if(worker->fd < 0 || !sent_scene[w])
+			continue;
+		if(!wait_reply_line(worker, line, sizeof(line)))
+			drop_worker(worker, "didn't answer the scene request");
+		else
+			check_scene_answer(worker, line);
+	}
+	free(sent_scene);
+	close_json(&json);
+	// end of sending the scene
+	
+	// block of code which splits the image into tiles, queued so the first tile is handed out first
+	int tiles_x = (width + DIST_TILE_SIZE - 1) / DIST_TILE_SIZE;
+	int tiles_y = (height + DIST_TILE_SIZE - 1) / DIST_TILE_SIZE;
+	int tile_count = tiles_x * tiles_y;
+	tile* tiles = malloc(sizeof(tile) * tile_count);
+	int* pending = malloc(sizeof(int) * tile_count); // tiles not handed out yet, taken from the end
+	int pending_count = tile_count;
+	for(int i = 0; i < tile_count; i+=1)
+	{
+		tile* t = &tiles[i];
+		t->x0 = (i % tiles_x) * DIST_TILE_SIZE;
+		t->y0 = (i / tiles_x) * DIST_TILE_SIZE;
+		t->x1 = (t->x0 + DIST_TILE_SIZE < width) ? t->x0 + DIST_TILE_SIZE : width;
+		t->y1 = (t->y0 + DIST_TILE_SIZE < height) ? t->y0 + DIST_TILE_SIZE : height;
+		pending[tile_count - 1 - i] = i;
+	}
+	// end of tile setup
+	
+	struct pollfd* polled = malloc(sizeof(struct pollfd) * (dist_worker_count + 1));
+	int* polled_worker = malloc(sizeof(int) * (dist_worker_count + 1));
+	int done = 0;
+	while(done < tile_count)
+	{
+		// block of code which hands the next tiles to the idle workers
+		for(int w = 0; w < dist_worker_count && pending_count > 0; w+=1)
+		{
+			dist_worker* worker = &dist_workers[w];
+			if(worker->fd < 0 || worker->tile != -1)
+				continue;
+			int i = pending[--pending_count];
+			snprintf(request, sizeof(request), "tile %d %d %d %d %d %d\n", width, height, tiles[i].x0, tiles[i].y0, tiles[i].x1, tiles[i].y1);
+			worker->tile = i;
+			worker->expected = 0;
+			worker->deadline = now_seconds() + tile_timeout;
+			if(!send_all(worker->fd, request, strlen(request)))
+			{
+				pending[pending_count++] = i;
+				drop_worker(worker, "hung up");
+			}
+		}
+		// end of handing out tiles
+		
+		// block of code which waits until a busy worker has sent something or the earliest deadline has passed
+		int busy = 0;
+		double deadline = INFINITY;
+		for(int w = 0; w < dist_worker_count; w+=1)
+		{
+			if(dist_workers[w].fd < 0 || dist_workers[w].tile == -1)
+				continue;
+			polled[busy].fd = dist_workers[w].fd;
+			polled[busy].events = POLLIN;
+			polled[busy].revents = 0;
+			polled_worker[busy++] = w;
+			if(dist_workers[w].deadline < deadline)
+				deadline = dist_workers[w].deadline;
+		}
+		if(busy == 0)
+			break; // every worker is gone, so the tiles left are rendered locally below
+		double wait = deadline - now_seconds();
+		if(poll(polled, busy, wait > 0 ? (int)(wait * 1000) + 1 : 0) < 0 && errno != EINTR)
+		{
+			fprintf(stderr, "Error: Could not wait for the workers\n");
+			exit(1);
+		}
+		// end of waiting
+		
+		// block of code which takes in the finished tiles and gives up on the workers which hung up, answered something else or are out of time
+		double now = now_seconds();
+		for(int p = 0; p < busy; p+=1)
+		{
+			dist_worker* worker = &dist_workers[polled_worker[p]];
+			int i = worker->tile;
+			tile* t = &tiles[i];
+			size_t length = sizeof(image_data) * (t->x1 - t->x0) * (t->y1 - t->y0);
+			
+			if((polled[p].revents & (POLLIN | POLLHUP | POLLERR)) && !receive_reply(worker))
+			{
+				pending[pending_count++] = i;
+				drop_worker(worker, "hung up");
+				continue;
+			}
+			if(worker->expected == 0 && take_reply_line(worker, line, sizeof(line)))
+			{
+				if(sscanf(line, "tile %zu", &worker->expected) != 1 || worker->expected != length)
+				{
+					fprintf(stderr, "Warning: Worker %s answered \"%s\" to a tile request\n", worker->address, line);
+					pending[pending_count++] = i;
+					drop_worker(worker, NULL);
+					continue;
+				}
+			}
+			if(worker->expected > 0 && worker->reply_size >= worker->expected)
+			{
+				copy_tile_pixels(image, width, t, worker->reply);
+				worker->reply_size -= worker->expected;
+				memmove(worker->reply, worker->reply + worker->expected, worker->reply_size);
+				worker->expected = 0;
+				worker->tile = -1;
+				done++;
+			}
+			else if(now > worker->deadline)
+			{
+				pending[pending_count++] = i;
+				drop_worker(worker, "stalled");
+			}
+		}
+		// end of taking in tiles
+	}
+	
+	if(pending_count > 0) // only when every worker is gone
+	{
+		fprintf(stderr, "Warning: No workers left, rendering the last %d tiles locally\n", pending_count);
+		image_data* pixels = malloc(sizeof(image_data) * DIST_TILE_SIZE * DIST_TILE_SIZE + 1);
+		while(pending_count > 0)
+		{
+			tile* t = &tiles[pending[--pending_count]];
+			if(!render_image_tile(&compiled_scene, width, height, t, pixels))
+			{
+				fprintf(stderr, "Error: Out of memory rendering a tile\n");
+				exit(1);
+			}
+			copy_tile_pixels(image, width, t, (const char*)pixels);
+		}
+		free(pixels);
+	}
+	
+	free(polled);
+	free(polled_worker);
+	free(pending);
+	free(tiles);
+	
+	pthread_mutex_lock(&totals_lock);
+	render_seconds = now_seconds() - start;
+	memset(&ray_totals, 0, sizeof(ray_counts)); // the rays were traced (and counted) by the workers
+	pthread_mutex_unlock(&totals_lock);
+}
+
+// checks the worker's "ok SECONDS hit|miss SETTINGS" answer to a scene request, dropping the worker when it couldn't load the scene or renders with other settings than ours
+void check_scene_answer(dist_worker* w, char* line)
+{
+	char settings[512];
+	char worker_settings[512];
+	render_settings(settings, sizeof(settings));
+	if(sscanf(line, "ok %*f %*s %511s", worker_settings) != 1)
+	{
+		fprintf(stderr, "Warning: Worker %s couldn't load the scene (%s)\n", w->address, line);
+		drop_worker(w, NULL);
+	}
+	else if(strcmp(worker_settings, settings) != 0)
+	{
+		fprintf(stderr, "Warning: Worker %s renders with %s instead of %s\n", w->address, worker_settings, settings);
+		drop_worker(w, NULL);
+	}
+}
+
+// connects to every render server in the comma separated worker_list; one which can't be reached is left out with a warning, since the frame can still be rendered without it
+void connect_workers()
+{
+	dist_worker_count = 1;
+	for(char* c = worker_list; *c != '\0'; c+=1)
+	{
+		if(*c == ',')
+			dist_worker_count++;
+	}
+	dist_workers = calloc(dist_worker_count, sizeof(dist_worker));
+	
+	char* address = worker_list;
+	for(int w = 0; w < dist_worker_count; w+=1)
+	{
+		dist_worker* worker = &dist_workers[w];
+		size_t length = strcspn(address, ",");
+		worker->address = malloc(length + 1);
+		memcpy(worker->address, address, length);
+		worker->address[length] = '\0';
+		address += length + (address[length] == ',');
+		
+		worker->tile = -1;
+		worker->reply_capacity = 4096;
+		worker->reply = malloc(worker->reply_capacity);
+		worker->fd = open_socket(worker->address, 0);
+		if(worker->fd < 0)
+			fprintf(stderr, "Warning: Could not connect to worker %s\n", worker->address);
+	}
+}
+
+// closes the connection to the worker (printing why, unless the caller already did) so no more tiles are handed to it; whatever it was rendering is requeued by the caller
+void drop_worker(dist_worker* w, char* reason)
+{
+	if(reason != NULL)
+		fprintf(stderr, "Warning: Worker %s %s, handing its work to the others\n", w->address, reason);
+	close(w->fd);
+	w->fd = -1;
+	w->tile = -1;
+	w->reply_size = 0;
+}
+
+// reads whatever has arrived from the worker onto the end of its reply buffer (growing it to fit a whole tile); returns 0 when the worker hung up or the read failed
+int receive_reply(dist_worker* w)
+{
+	if(w->reply_capacity - w->reply_size < 65536)
+	{
+		w->reply_capacity = w->reply_capacity * 2 + 65536;
+		w->reply = realloc(w->reply, w->reply_capacity);
+	}
+	ssize_t received = recv(w->fd, w->reply + w->reply_size, w->reply_capacity - w->reply_size, 0);
+	if(received < 0 && errno == EINTR)
+		return 1;
+	if(received <= 0)
+		return 0;
+	w->reply_size += received;
+	return 1;
+}
+
+// moves the first line of the worker's reply buffer (without its newline) into line, returning 0 while no complete line has arrived yet
+int take_reply_line(dist_worker* w, char* line, size_t size)
+{
+	char* end = memchr(w->reply, '\n', w->reply_size);
+	if(end == NULL)
+		return 0;
+	size_t length = end - w->reply;
+	size_t kept = (length < size) ? length : size - 1;
+	memcpy(line, w->reply, kept);
+	line[kept] = '\0';
+	w->reply_size -= length + 1;
+	memmove(w->reply, end + 1, w->reply_size);
+	return 1;
+}
+
+// waits for the next line of the worker's reply until its deadline, returning 0 when the worker hung up or ran out of time
+int wait_reply_line(dist_worker* w, char* line, size_t size)
+{
+	while(!take_reply_line(w, line, size))
+	{
+		double wait = w->deadline - now_seconds();
+		struct pollfd polled = {w->fd, POLLIN, 0};
+		if(wait <= 0 || poll(&polled, 1, (int)(wait * 1000) + 1) == 0)
+			return 0;
+		if(!receive_reply(w))
+			return 0;
+	}
+	return 1;
+}
+
+// renders tile t of a width x height image into pixels (just the tile's size, row by row); when anti-aliasing, the window rendered reaches one pixel past the tile on every side
+// (where the image allows) so the pixels along the tile's edges are compared with the same neighbours they have in a whole image render. Returns 0 when the window couldn't be allocated
+int render_image_tile(render_scene* rs, int width, int height, tile* t, image_data* pixels)
+{
+	tile window = *t;
+	if(aa_samples > 1)
+	{
+		window.x0 = (t->x0 > 0) ? t->x0 - 1 : 0;
+		window.y0 = (t->y0 > 0) ? t->y0 - 1 : 0;
+		window.x1 = (t->x1 < width) ? t->x1 + 1 : width;
+		window.y1 = (t->y1 < height) ? t->y1 + 1 : height;
+	}
+	int window_width = window.x1 - window.x0;
+	int tile_width = t->x1 - t->x0;
+	
+	image_data* image = malloc(sizeof(image_data) * window_width * (window.y1 - window.y0) + 1);
+	if(image == NULL)
+		return 0;
+	raycasting_window(rs, image, width, height, &window, t);
+	for(int y = t->y0; y < t->y1; y+=1)
+		memcpy(&pixels[(y - t->y0) * tile_width], &image[(y - window.y0) * window_width + (t->x0 - window.x0)], sizeof(image_data) * tile_width);
+	free(image);
+	return 1;
+}
+
+// puts the pixels of tile t (packed rgb, row by row, as a worker sends them) into their place in the width pixels wide image
+void copy_tile_pixels(image_data* image, int width, tile* t, const char* pixels)
+{
+	int tile_width = t->x1 - t->x0;
+	for(int y = t->y0; y < t->y1; y+=1)
+		memcpy(&image[y * width + t->x0], pixels + sizeof(image_data) * (y - t->y0) * tile_width, sizeof(image_data) * tile_width);
+}
+
+// writes the options which change what the image looks like into out, e.g. "real=double,max-depth=7,...,aa=1,aa-threshold=0.1"; a coordinator only hands tiles to workers
+// whose settings match its own, since their tiles would otherwise show seams. The thread count, packets and simd kernels don't change the image, so they're left out
+void render_settings(char* out, size_t size)
+{
+	snprintf(out, size, "real=%s,max-depth=%d,min-weight=%.17g,light-cutoff=%.17g,light-samples=%d,spp=%d,aa=%d,aa-threshold=%.17g", (sizeof(real) == sizeof(float)) ? "float" : "double",
+		max_depth, min_weight, light_cutoff, light_samples, pixel_samples, aa_samples, aa_threshold);
+}
+
+// opens a stream socket on the given address, which is a TCP host:port when it holds a colon but no slash ("localhost:7000", or ":7000" to listen on every interface) and a unix
+// domain socket path otherwise. A listening socket is bound (replacing a unix socket left behind by an earlier server) and listening; otherwise it's connected. Returns -1 on failure
+int open_socket(char* address, int listening)
+{
+	char* colon = strrchr(address, ':');
+	if(colon == NULL || strchr(address, '/') != NULL)
+	{
+		struct sockaddr_un unix_address;
+		memset(&unix_address, 0, sizeof(unix_address));
+		unix_address.sun_family = AF_UNIX;
+		if(strlen(address) >= sizeof(unix_address.sun_path))
+			return -1;
+		strcpy(unix_address.sun_path, address);
+		
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd < 0)
+			return -1;
+		if(listening)
+			unlink(address); // a socket left behind by an earlier server would make bind() fail
+		if(listening ? (bind(fd, (struct sockaddr*)&unix_address, sizeof(unix_address)) != 0 || listen(fd, 64) != 0) : connect(fd, (struct sockaddr*)&unix_address, sizeof(unix_address)) != 0)
+		{
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+	
+	// block of code which resolves the host and port and tries every address they stand for until one works
+	char host[256];
+	size_t host_length = colon - address;
+	if(host_length >= sizeof(host))
+		return -1;
+	memcpy(host, address, host_length);
+	host[host_length] = '\0';
+	
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = listening ? AI_PASSIVE : 0;
+	struct addrinfo* results;
+	if(getaddrinfo(host_length > 0 ? host : NULL, colon + 1, &hints, &results) != 0)
+		return -1;
+	
+	int fd = -1;
+	for(struct addrinfo* r = results; r != NULL && fd < 0; r = r->ai_next)
+	{
+		fd = socket(r->ai_family, r->ai_socktype, r->ai_protocol);
+		if(fd < 0)
+			continue;
+		int on = 1;
+		if(listening)
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		else
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // requests are single short lines which shouldn't wait for more to send
+		if(listening ? (bind(fd, r->ai_addr, r->ai_addrlen) != 0 || listen(fd, 64) != 0) : connect(fd, r->ai_addr, r->ai_addrlen) != 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(results);
+	// end of resolving
+	
+	return fd;
+}
+
+// writes all size bytes to the socket, carrying on after partial writes; a peer which hung up makes it return 0 instead of raising SIGPIPE
+int send_all(int fd, const char* data, size_t size)
+{
+	while(size > 0)
+	{
+		ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+		if(sent < 0 && errno == EINTR)
+			continue;
+		if(sent <= 0)
+			return 0;
+		data += sent;
+		size -= sent;
+	}
+	return 1;
+}
+
+// hashes the given bytes with 64 bit FNV-1a, which is what the render server keys its cache by
+unsigned long long hash_bytes(const char* data, size_t size)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for(size_t i = 0; i < size; i+=1)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// returns the cached scene with the same hash and size as the given json, or NULL; cache_lock must be held
+cached_scene* find_cached_scene(unsigned long long hash, size_t size)
+{
+	for(int c = 0; c < cache_count; c+=1)
+	{
+		if(scene_cache[c]->hash == hash && scene_cache[c]->size == size)
+			return scene_cache[c];
+	}
+	return NULL;
+}
+
+// finds the scene held by the json in the cache, or parses and compiles it (one scene at a time, under load_lock) and puts it in the cache, evicting the least recently used scene
+// nobody is rendering when the cache is full. Either way the scene is returned with a use taken on it, so it can't be freed until release_scene(); NULL means it didn't parse
+cached_scene* acquire_scene(json_reader* json, int* hit)
+{
+	volatile unsigned long long hash = hash_bytes(json->data, json->size); // volatile since it's still needed after the setjmp() below, which a register copy wouldn't survive
+	
+	pthread_mutex_lock(&load_lock);
+	
+	// looked up only once load_lock is held, so a scene another worker was busy loading is found instead of being parsed twice
+	cached_scene* entry = lookup_scene(hash, json->size);
+	*hit = (entry != NULL);
+	if(entry != NULL)
+	{
+		pthread_mutex_unlock(&load_lock);
+		return entry;
+	}
+	
+	// block of code which parses the scene into the (reset) object arena, or checks it when it's a binary scene file; an error jumps back here instead of exiting
+	int binary = (json->size >= sizeof(SCENE_FILE_MAGIC) && memcmp(json->data, SCENE_FILE_MAGIC, sizeof(SCENE_FILE_MAGIC)) == 0);
+	jmp_buf jump;
+	error_jump = &jump;
+	if(setjmp(jump) != 0)
+	{
+		error_jump = NULL;
+		pthread_mutex_unlock(&load_lock);
+		return NULL;
+	}
+	if(binary)
+	{
+		check_scene_file("(request)", json->data, json->size);
+	}
+	else
+	{
+		object_count = 0;
+		glob_width = 0;
+		glob_height = 0;
+		line = 1;
+		parse_scene(json);
+	}
+	error_jump = NULL;
+	// end of parsing
+	
+	entry = calloc(1, sizeof(cached_scene));
+	if(binary) // the cache keeps an aligned copy of the file, since the json reader's mapping is closed as soon as the scene is acquired
+	{
+		char* copy = aligned_alloc(SCENE_FILE_ALIGN, (json->size + SCENE_FILE_ALIGN - 1) / SCENE_FILE_ALIGN * SCENE_FILE_ALIGN);
+		memcpy(copy, json->data, json->size);
+		bind_scene_file(&entry->scene, copy);
+		if(entry->scene.node_count == 0 && entry->scene.sphere_count > 0)
+		{
+			build_bvh(&entry->scene);
+			entry->scene.nodes_built = 1;
+		}
+		build_light_bvh(&entry->scene);
+	}
+	else
+	{
+		compile_scene(&entry->scene);
+	}
+	entry->hash = hash;
+	entry->size = json->size;
+	entry->users = 1;
+	pthread_mutex_unlock(&load_lock);
+	
+	// block of code which puts the scene in the cache, in place of the least recently used scene nobody is rendering when the cache is full
+	pthread_mutex_lock(&cache_lock);
+	entry->last_used = ++cache_clock;
+	int slot = cache_count;
+	if(cache_count == cache_capacity)
+	{
+		slot = -1;
+		for(int c = 0; c < cache_count; c+=1)
+		{
+			if(scene_cache[c]->users == 0 && (slot == -1 || scene_cache[c]->last_used < scene_cache[slot]->last_used))
+				slot = c;
+		}
+		if(slot != -1)
+		{
+			free_compiled_scene(&scene_cache[slot]->scene);
+			free(scene_cache[slot]);
+		}
+	}
+	else
+	{
+		cache_count++;
+	}
+	if(slot != -1)
+	{
+		scene_cache[slot] = entry;
+		entry->cached = 1;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	// end of caching (a scene which didn't fit is freed by its release_scene())
+	
+	return entry;
+}
+
+// returns the cached scene with the given hash and size with a use taken on it (like acquire_scene() does), or NULL when no such scene is cached
+cached_scene* lookup_scene(unsigned long long hash, size_t size)
+{
+	pthread_mutex_lock(&cache_lock);
+	cached_scene* entry = find_cached_scene(hash, size);
+	if(entry != NULL)
+	{
+		entry->users++;
+		entry->last_used = ++cache_clock;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return entry;
+}
+
+// gives back a use of the scene taken by acquire_scene(), freeing the scene if it's no longer in the cache and this was the last use
+void release_scene(cached_scene* entry)
+{
+	pthread_mutex_lock(&cache_lock);
+	entry->users--;
+	int unused = (entry->users == 0 && !entry->cached);
+	pthread_mutex_unlock(&cache_lock);
+	
+	if(unused)
+	{
+		free_compiled_scene(&entry->scene);
+		free(entry);
+	}
+}
+
+// function which handles raycasting for objects read in from json file
+void raycasting(render_scene* rs, image_data* image, int width, int height) 
+{
+		tile whole = {0, 0, width, height};
+		raycasting_window(rs, image, width, height, &whole, &whole);
+}
+
+// raycasts the pixels of the window (part of a width x height image) into an image just the size of the window; only the pixels inside refine are anti-aliased, so a window
+// which reaches one pixel past refine on every side (where the image allows) renders refine exactly like the whole image would. Pixels only depend on their own position,
+// never on the window, which is what lets a distributed render put an image together out of tiles rendered elsewhere
+void raycasting_window(render_scene* rs, image_data* image, int width, int height, tile* window, tile* refine)
+{
+		double phase_start = now_seconds();
+		
+		render_job job;
+		job.scene = rs; // the render scene is shared by every render thread from here on and never modified while rendering
+		job.image = image;
+		job.window = *window;
+		job.refine = *refine;
+		
+		// sets cx and cy values of camera (assumed to be at 0, 0)
+		job.cx = 0;
+		job.cy = 0;
+		
+		// sets width and height of image based on given width/height from command line
+		job.M = height; 
+		job.N = width; 
+		
+		// sets pixheight and pixwidth using M and N declared above as well as camera height/width stored in the compiled scene
+		job.pixheight = rs->camera_height / job.M;
+		job.pixwidth = rs->camera_width / job.N;
+		
+		// block of code which splits the window into TILE_SIZE x TILE_SIZE tiles (smaller along the right/bottom edges)
+		int window_width = job.window.x1 - job.window.x0;
+		int window_height = job.window.y1 - job.window.y0;
+		int tiles_x = (window_width + TILE_SIZE - 1) / TILE_SIZE;
+		int tiles_y = (window_height + TILE_SIZE - 1) / TILE_SIZE;
+		job.tile_count = tiles_x * tiles_y;
+		job.tiles = malloc(sizeof(tile) * job.tile_count);
+		
+		for(int ty = 0; ty < tiles_y; ty+=1)
+		{
+			for(int tx = 0; tx < tiles_x; tx+=1)
+			{
+				tile* t = &job.tiles[ty * tiles_x + tx];
+				t->x0 = job.window.x0 + tx * TILE_SIZE;
+				t->y0 = job.window.y0 + ty * TILE_SIZE;
+				t->x1 = (t->x0 + TILE_SIZE < job.window.x1) ? t->x0 + TILE_SIZE : job.window.x1;
+				t->y1 = (t->y0 + TILE_SIZE < job.window.y1) ? t->y0 + TILE_SIZE : job.window.y1;
+			}
+		}
+		// end of tile setup
+		
+		// block of code which creates one tile queue per worker (filled by run_pass())
+		job.queue_count = thread_count;
+		job.queues = malloc(sizeof(tile_queue) * job.queue_count);
+		
+		for(int q = 0; q < job.queue_count; q+=1)
+		{
+			pthread_mutex_init(&job.queues[q].lock, NULL);
+		}
+		// end of queue setup
+		
+		// the calling thread acts as worker 0, so only thread_count - 1 extra threads are started
+		render_worker* workers = malloc(sizeof(render_worker) * thread_count);
+		
+		for(int w = 0; w < thread_count; w+=1)
+		{
+			workers[w].id = w;
+			workers[w].job = &job;
+			memset(&workers[w].rays, 0, sizeof(ray_counts));
+			memset(&workers[w].stats, 0, sizeof(render_stats));
+			// every ray popped off the stack pushes at most 2 children, one level deeper, so it never holds more than 2 rays per level
+			workers[w].stack = malloc(sizeof(path_ray) * (2 * (max_depth + 1) + 1));
+			workers[w].occluders = malloc(sizeof(int) * (rs->light_count + 1));
+			workers[w].near_lights = malloc(sizeof(int) * (rs->light_count + 1));
+			workers[w].near_mask = calloc(rs->light_count / 64 + 1, sizeof(unsigned long long));
+			workers[w].light_weights = malloc(sizeof(real) * (rs->light_count + 1));
+			for(int l = 0; l < rs->light_count; l+=1)
+				workers[w].occluders[l] = -1;
+		}
+		
+		// the anti-aliasing pass compares every pixel's center ray with its neighbours', so those are kept from the first pass
+		job.base_color = NULL;
+		job.base_id = NULL;
+		if(aa_samples > 1)
+		{
+			job.base_color = malloc(sizeof(real) * 3 * window_width * window_height);
+			job.base_id = malloc(sizeof(int) * window_width * window_height);
+		}
+		
+		job.step = 0;
+		if(progressive_file != NULL)
+		{
+			// the grid is halved every pass (8, 4, 2 and finally 1); every pixel is still rendered exactly once, so the end result is the same as rendering in a single pass
+			for(job.step = PROGRESSIVE_STEP; job.step >= 1; job.step /= 2)
+			{
+				run_pass(&job, workers, 0);
+				if(job.step > 1 || aa_samples > 1) // main() writes out the finished image itself
+					write_preview(progressive_file, job.image, job.N, job.M);
+			}
+			job.step = 0;
+		}
+		else
+		{
+			run_pass(&job, workers, 0);
+		}
+		if(aa_samples > 1)
+			run_pass(&job, workers, 1); // only starts once every pixel's center ray is known
+		
+		pthread_mutex_lock(&totals_lock);
+		render_seconds = now_seconds() - phase_start;
+		ray_totals.primary = 0;
+		ray_totals.secondary = 0;
+		ray_totals.shadow = 0;
+		for(int w = 0; w < thread_count; w+=1)
+		{
+			ray_totals.primary += workers[w].rays.primary;
+			ray_totals.secondary += workers[w].rays.secondary;
+			ray_totals.shadow += workers[w].rays.shadow;
+		}
+		
+#if RENDER_STATS
+		// block of code which merges the per-thread --stats counters
+		memset(&stats_totals, 0, sizeof(render_stats));
+		free(worker_stats);
+		worker_stats = malloc(sizeof(render_stats) * thread_count);
+		worker_stats_count = thread_count;
+		for(int w = 0; w < thread_count; w+=1)
+		{
+			render_stats* ws = &workers[w].stats;
+			worker_stats[w] = *ws;
+			stats_totals.reflection_rays += ws->reflection_rays;
+			stats_totals.refraction_rays += ws->refraction_rays;
+			stats_totals.hit_checks += ws->hit_checks;
+			stats_totals.traversals += ws->traversals;
+			stats_totals.box_tests += ws->box_tests;
+			stats_totals.sphere_tests += ws->sphere_tests;
+			stats_totals.plane_tests += ws->plane_tests;
+			stats_totals.occluder_hits += ws->occluder_hits;
+			stats_totals.lights_culled += ws->lights_culled;
+			stats_totals.shaded += ws->shaded;
+			stats_totals.depth_sum += ws->depth_sum;
+			if(ws->depth_max > stats_totals.depth_max)
+				stats_totals.depth_max = ws->depth_max;
+			stats_totals.depth_cutoffs += ws->depth_cutoffs;
+			stats_totals.weight_cutoffs += ws->weight_cutoffs;
+			stats_totals.refined_pixels += ws->refined_pixels;
+			stats_totals.tiles += ws->tiles;
+			stats_totals.busy_seconds += ws->busy_seconds;
+		}
+		// end of merging
+#endif
+		pthread_mutex_unlock(&totals_lock);
+		
+		for(int q = 0; q < job.queue_count; q+=1)
+		{
+			pthread_mutex_destroy(&job.queues[q].lock);
+		}
+		
+		for(int w = 0; w < thread_count; w+=1)
+		{
+			free(workers[w].stack);
+			free(workers[w].occluders);
+			free(workers[w].near_lights);
+			free(workers[w].near_mask);
+			free(workers[w].light_weights);
+		}
+		
+		free(workers);
+		free(job.queues);
+		free(job.base_color);
+		free(job.base_id);
+		free(job.tiles);
+		return;
+}	
+
+// renders one pass over the whole image: every worker gets an equal contiguous run of tiles to start with, whatever is left over gets stolen by whoever finishes first, and the
+// calling thread acts as worker 0, so only thread_count - 1 extra threads are started (and joined before returning)
+void run_pass(render_job* job, render_worker* workers, int pass)
+{
+	job->pass = pass;
+	for(int q = 0; q < job->queue_count; q+=1)
+	{
+		job->queues[q].head = (int)((long)job->tile_count * q / job->queue_count);
+		job->queues[q].tail = (int)((long)job->tile_count * (q + 1) / job->queue_count);
+	}
+	
+	for(int w = 1; w < thread_count; w+=1)
+	{
+		if(pthread_create(&workers[w].thread, NULL, render_worker_main, &workers[w]) != 0)
+		{
+			fprintf(stderr, "Error: Could not start render thread %d.\n", w);
+			exit(1);
+		}
+	}
+	
+	render_worker_main(&workers[0]);
+	
+	for(int w = 1; w < thread_count; w+=1)
+	{
+		pthread_join(workers[w].thread, NULL);
+	}
+}
+
+// thread entry point for a render worker; keeps pulling tiles (its own first, then stolen ones) until all of them have been rendered
+void* render_worker_main(void* arg)
+{
+	render_worker* worker = (render_worker*)arg;
+	int t;
+	thread_stats = &worker->stats;
+	active_scene = worker->job->scene;
+	STAT(double start = now_seconds());
+	
+	while((t = next_tile(worker->job, worker->id)) != -1)
+	{
+		render_tile(worker, &worker->job->tiles[t]);
+		STAT(worker->stats.tiles++);
+	}
+	
+	STAT(worker->stats.busy_seconds += now_seconds() - start);
+	
+	return NULL;
+}
+
+// pops the next tile index from the head of the worker's own queue, or steals one from the tail of another worker's queue once its own is empty
+int next_tile(render_job* job, int id)
+{
+	for(int i = 0; i < job->queue_count; i+=1)
+	{
+		int own = (i == 0);
+		tile_queue* queue = &job->queues[(id + i) % job->queue_count];
+		int t = -1;
+		
+		pthread_mutex_lock(&queue->lock);
+		if(queue->head < queue->tail)
+		{
+			if(own)
+				t = queue->head++;
+			else
+				t = --queue->tail;
+		}
+		pthread_mutex_unlock(&queue->lock);
+		
+		if(t != -1)
+			return t;
+	}
+	
+	return -1; // every queue is empty
+}
+
+// renders every pixel of the given tile, either one ray at a time or in square packets of primary rays
+void render_tile(render_worker* worker, tile* t)
+{
+	if(worker->job->pass == 1)
+	{
+		refine_tile(worker, t);
+		return;
+	}
+	
+	if(worker->job->step > 0)
+	{
+		render_tile_progressive(worker, t);
+		return;
+	}
+	
+	if(packet_size > 0)
+	{
+		render_tile_packets(worker, t);
+		return;
+	}
+	
+	for (int y = t->y0; y < t->y1; y += 1) {
+		for (int x = t->x0; x < t->x1; x += 1) {
+			render_pixel(worker, x, y);
+		}
+	}
+}
+
+// computes the normalized direction of the primary ray through pixel (x, y); every primary ray starts at the assumed 0, 0, 0 camera position
+void primary_ray(render_job* job, double sx, double sy, real* Rd)
+{
+		double ray[3] = {0, 0, 1}; // Initializes temporary ray with 0, 0 for the x and y values and 1 for the assumed z value position
+		
+		ray[1] = (job->cy - (job->scene->camera_height/2) + job->pixheight * sy); // calculates y-position of ray and stores accordingly
+		ray[0] = job->cx - (job->scene->camera_width/2) + job->pixwidth * sx; // calculates x-position of ray and stores accordingly
+		// stores the calculated ray values along with the assumed z value of 1 into the Rd vector
+		Rd[0] = ray[0];
+		Rd[1] = ray[1];
+		Rd[2] = ray[2];
+		normalize(Rd); // normalizes the Rd vector
+}
+
+// shoots and shades the primary ray through pixel (x, y) and stores the resulting color at that pixel's own position in the job's image
+void render_pixel(render_worker* worker, int x, int y)
+{
+		render_job* job = worker->job;
+		real Ro[3] = {0, 0, 0}; // Initializes origin ray to the assumed 0, 0, 0 position
+		real Rd[3] = {0, 0, 0}; // Initializes direction of ray to 0, 0, 0 which will be changed
+		primary_ray(job, x + 0.5, y + 0.5, Rd);
+
+		real best_t;
+		int best_i;
+		shoot(Ro, Rd, INFINITY, -1, &best_t, &best_i); 
+		
+		finish_pixel(worker, x, y, Rd, best_t, best_i);
+}
+
+// shades the closest hit (if any) of the primary ray through pixel (x, y) and stores the resulting color at that pixel's own position in the job's image (along with the
+// color/object the anti-aliasing pass compares neighbours by)
+void finish_pixel(render_worker* worker, int x, int y, real* Rd, real best_t, int best_i)
+{
+		render_job* job = worker->job;
+		image_data current_pixel; // temp image_data struct which will hold RGB pixels
+		real color[3];
+		
+		shade_primary(worker, Rd, best_t, best_i, x, y, 0, color);
+		
+		current_pixel.r = (unsigned char)(255 * color[0]);
+		current_pixel.g = (unsigned char)(255 * color[1]); // sets current pixel's color values based on calculated colors in color vector (already clamped)
+		current_pixel.b = (unsigned char)(255 * color[2]);
+		
+		int p = pixel_index(job, x, y);
+		job->image[p] = current_pixel; // each pixel is written to its own position so no two workers ever touch the same pixel
+		
+		if(job->base_color != NULL)
+		{
+			memcpy(&job->base_color[3 * p], color, sizeof(color));
+			job->base_id[p] = (best_t > 0 && best_t != INFINITY) ? best_i : -1;
+		}
+}
+
+// returns where pixel (x, y) of the image is stored in the job's image and anti-aliasing buffers, which are laid out row by row over just the window being rendered
+int pixel_index(render_job* job, int x, int y)
+{
+	return (y - job->window.y0) * (job->window.x1 - job->window.x0) + (x - job->window.x0);
+}
+
+// shades the closest hit (if any) of a primary ray and returns its color clamped to [0, 1]; no dominant intersection leaves it black. The hit is shaded pixel_samples times,
+// each with the light sampling stream seeded from the pixel, the stream (0 for the pixel center, 1 + cell for an anti-aliasing cell) and the sample number, and the average
+// is clamped. Without --light-samples every sample is the same, so only the first is shaded
+void shade_primary(render_worker* worker, real* Rd, real best_t, int best_i, int x, int y, int stream, real* color)
+{
+		real Ro[3] = {0, 0, 0}; // primary rays all start at the assumed 0, 0, 0 position
+		color[0] = 0;
+		color[1] = 0; // initializes color to 0 (black)
+		color[2] = 0;
+		worker->rays.primary++;
+			
+		if (best_t > 0 && best_t != INFINITY && best_i != -1) { 
+			int samples = light_samples > 0 ? pixel_samples : 1;
+			for(int s = 0; s < samples; s+=1)
+			{
+				worker->random_state = pixel_hash(x, y, -1 - (stream * samples + s)); // negative sample numbers keep these apart from the anti-aliasing jitter
+				shade(worker, Ro, Rd, best_t, best_i, color);
+			}
+			if(samples > 1)
+			{
+				color[0] /= samples;
+				color[1] /= samples;
+				color[2] /= samples;
+			}
+			
+			color[0] = clamp(color[0]);
+			color[1] = clamp(color[1]);
+			color[2] = clamp(color[2]);
+		}
+}
+
+// checks whether pixel (x, y) needs anti-aliasing: its center ray hit a different object than one of its 8 neighbours' (an edge), or its color differs from one of theirs by more
+// than aa_threshold in some channel (a shadow/reflection boundary or fine texture)
+int needs_refinement(render_job* job, int x, int y)
+{
+	int center = pixel_index(job, x, y);
+	
+	for(int ny = y - 1; ny <= y + 1; ny+=1)
+	{
+		for(int nx = x - 1; nx <= x + 1; nx+=1)
+		{
+			// the window reaches past every refined pixel's neighbours unless they're outside the image
+			if(nx < job->window.x0 || ny < job->window.y0 || nx >= job->window.x1 || ny >= job->window.y1 || (nx == x && ny == y))
+				continue;
+			
+			int neighbour = pixel_index(job, nx, ny);
+			if(job->base_id[neighbour] != job->base_id[center])
+				return 1;
+			for(int k = 0; k < 3; k+=1)
+			{
+				if(fabs(job->base_color[3 * neighbour + k] - job->base_color[3 * center + k]) > aa_threshold)
+					return 1;
+			}
+		}
+	}
+	
+	return 0;
+}
+
+// second pass of anti-aliasing: every pixel of the tile (inside the job's refine region) which needs_refinement() is replaced by the average of aa_samples x aa_samples stratified
+// rays, each jittered inside its own cell of the pixel by a hash of the pixel and cell, so the image doesn't depend on the thread count or tile order
+void refine_tile(render_worker* worker, tile* t)
+{
+	render_job* job = worker->job;
+	int x0 = (t->x0 > job->refine.x0) ? t->x0 : job->refine.x0;
+	int y0 = (t->y0 > job->refine.y0) ? t->y0 : job->refine.y0;
+	int x1 = (t->x1 < job->refine.x1) ? t->x1 : job->refine.x1;
+	int y1 = (t->y1 < job->refine.y1) ? t->y1 : job->refine.y1;
+	
+	for(int y = y0; y < y1; y += 1)
+	{
+		for(int x = x0; x < x1; x += 1)
+		{
+			if(!needs_refinement(job, x, y))
+				continue;
+			
+			STAT(worker->stats.refined_pixels++);
+			double sum[3] = {0, 0, 0};
+			for(int cell = 0; cell < aa_samples * aa_samples; cell+=1)
+			{
+				double sx = x + (cell % aa_samples + pixel_random(x, y, 2 * cell)) / aa_samples;
+				double sy = y + (cell / aa_samples + pixel_random(x, y, 2 * cell + 1)) / aa_samples;
+				
+				real Ro[3] = {0, 0, 0};
+				real Rd[3];
+				primary_ray(job, sx, sy, Rd);
+				
+				real best_t;
+				int best_i;
+				real color[3];
+				shoot(Ro, Rd, INFINITY, -1, &best_t, &best_i);
+				shade_primary(worker, Rd, best_t, best_i, x, y, 1 + cell, color);
+				
+				sum[0] += color[0];
+				sum[1] += color[1];
+				sum[2] += color[2];
+			}
+			
+			image_data current_pixel;
+			current_pixel.r = (unsigned char)(255 * sum[0] / (aa_samples * aa_samples));
+			current_pixel.g = (unsigned char)(255 * sum[1] / (aa_samples * aa_samples));
+			current_pixel.b = (unsigned char)(255 * sum[2] / (aa_samples * aa_samples));
+			job->image[pixel_index(job, x, y)] = current_pixel;
+		}
+	}
+}
+
+// returns a pseudo random number in [0, 1) which only depends on the pixel and the sample number (a hash, so any thread can compute any pixel's samples in any order)
+double pixel_random(int x, int y, int sample)
+{
+	return pixel_hash(x, y, sample) * (1.0 / 4294967296.0);
+}
+
+// mixes the pixel coordinates and sample number into 32 well scrambled bits
+unsigned int pixel_hash(int x, int y, int sample)
+{
+	unsigned int h = (unsigned int)x * 0x8da6b343u ^ (unsigned int)y * 0xd8163841u ^ (unsigned int)sample * 0xcb1ab31fu;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+// steps the worker's light sampling stream (a 32 bit linear congruential generator) and returns its state scrambled the same way pixel_hash() scrambles, as a number in [0, 1)
+double next_random(render_worker* worker)
+{
+	worker->random_state = worker->random_state * 1664525u + 1013904223u;
+	unsigned int h = worker->random_state;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h * (1.0 / 4294967296.0);
+}
+
+// renders the tile's pixels on the current progressive pass's grid (every step-th pixel along both axes) which weren't already on the previous pass's grid, twice as coarse,
+// and fills the step x step block each one stands for with its color so the preview has no holes. Every block holds only its own corner pixel from this or a coarser pass,
+// so nothing already rendered is ever painted over. Pixels are traced one at a time since the grids are too sparse for packets
+void render_tile_progressive(render_worker* worker, tile* t)
+{
+	render_job* job = worker->job;
+	int step = job->step;
+	
+	for(int y = t->y0; y < t->y1; y += step)
+	{
+		for(int x = t->x0; x < t->x1; x += step)
+		{
+			if(step < PROGRESSIVE_STEP && x % (2 * step) == 0 && y % (2 * step) == 0) // already rendered by the previous pass
+				continue;
+			
+			render_pixel(worker, x, y);
+			
+			image_data current_pixel = job->image[pixel_index(job, x, y)];
+			for(int by = y; by < y + step && by < t->y1; by+=1)
+			{
+				for(int bx = x; bx < x + step && bx < t->x1; bx+=1)
 				{
-					fprintf(stderr, "Error: reflectivity must be between 0 and 1. Violation found on line number %d.\n", line);
-					exit(1);
+					job->image[pixel_index(job, bx, by)] = current_pixel;
 				}
-				objects[i]->sphere.reflectivity = value;
-				sphere_reflectivity_read++;
 			}
-			else
+		}
+	}
+}
+
+// renders the tile in packet_size x packet_size bundles of primary rays; each bundle walks the hierarchy once and is then shaded one ray at a time, so the result is identical to render_pixel()
+void render_tile_packets(render_worker* worker, tile* t)
+{
+	render_job* job = worker->job;
+	ray_packet packet;
+	
+	for(int py = t->y0; py < t->y1; py += packet_size)
+	{
+		for(int px = t->x0; px < t->x1; px += packet_size)
+		{
+			// block of code which fills the lanes of the packet row by row; lanes falling outside the tile (along the right/bottom image edges) are left inactive
+			for(int l = 0; l < packet_size * packet_size; l+=1)
+			{
+				int x = px + l % packet_size;
+				int y = py + l / packet_size;
+				real Rd[3] = {0, 0, 1};
+				
+				packet.active[l] = (x < t->x1 && y < t->y1);
+				if(packet.active[l])
+					primary_ray(job, x + 0.5, y + 0.5, Rd);
+				
+				packet.dx[l] = Rd[0];
+				packet.dy[l] = Rd[1];
+				packet.dz[l] = Rd[2];
+				packet.inv_dx[l] = 1 / Rd[0];
+				packet.inv_dy[l] = 1 / Rd[1];
+				packet.inv_dz[l] = 1 / Rd[2];
+			}
+			packet.lanes = packet_size * packet_size;
+			packet.o[0] = 0;
+			packet.o[1] = 0; // every primary ray starts at the assumed 0, 0, 0 position
+			packet.o[2] = 0;
+			// end of filling lanes
+			
+			packet_traverse(&packet);
+			
+			for(int l = 0; l < packet.lanes; l+=1)
+			{
+				if(!packet.active[l])
+					continue;
+				real Rd[3] = {packet.dx[l], packet.dy[l], packet.dz[l]};
+				finish_pixel(worker, px + l % packet_size, py + l / packet_size, Rd, packet.best_t[l], packet.best_i[l]);
+			}
+		}
+	}
+}
+
+// walks the hierarchy once for the whole packet of primary rays, finding the closest hit of every active lane with the same arithmetic and tie-breaking as bvh_traverse()
+void packet_traverse(ray_packet* packet)
+{
+	render_scene* rs = active_scene;
+	int lanes = packet->lanes;
+	real* o = packet->o;
+	real o_o = sqr(o[0]) + sqr(o[1]) + sqr(o[2]); // shared by every lane (see setup_ray())
+	
+	for(int l = 0; l < lanes; l+=1)
+	{
+		packet->best_t[l] = packet->active[l] ? INFINITY : -INFINITY;
+		packet->best_i[l] = -1;
+		packet->o_d[l] = o[0] * packet->dx[l] + o[1] * packet->dy[l] + o[2] * packet->dz[l];
+	}
+	
+	int stack[BVH_MAX_DEPTH + 4];
+	int stack_size = 0;
+	
+	if(rs->node_count > 0)
+		stack[stack_size++] = 0;
+	
+	while(stack_size > 0)
+	{
+		bvh_node* node = &rs->nodes[stack[--stack_size]];
+		
+		STAT(thread_stats->box_tests++);
+		if(!packet_enter(packet, node)) // the whole packet skips the node only when no lane can find a closer hit inside it
+			continue;
+		
+		if(node->count == 0) // inner node so visit both children
+		{
+			stack[stack_size++] = node->offset;
+			stack[stack_size++] = (int)(node - rs->nodes) + 1;
+			continue;
+		}
+		
+		STAT(thread_stats->sphere_tests += (long long)node->count * lanes);
+		for(int p = node->offset; p < node->offset + node->count; p+=1)
+		{
+			real o_c = o[0] * rs->sphere_cx[p] + o[1] * rs->sphere_cy[p] + o[2] * rs->sphere_cz[p];
+			real c = o_o - 2 * o_c + rs->sphere_cc[p]; // the c term only depends on the shared origin so it's computed once for all lanes
+			packet_sphere(packet, rs->sphere_cx[p], rs->sphere_cy[p], rs->sphere_cz[p], c, rs->sphere_id[p]);
+		}
+	}
+	
+	// instances are walked one lane at a time, since every instance moves the shared origin somewhere else
+	if(rs->instance_count > 0)
+	{
+		for(int l = 0; l < lanes; l+=1)
+		{
+			if(!packet->active[l])
+				continue;
+			real Rd[3] = {packet->dx[l], packet->dy[l], packet->dz[l]};
+			real inv_Rd[3] = {packet->inv_dx[l], packet->inv_dy[l], packet->inv_dz[l]};
+			instance_traverse(o, Rd, inv_Rd, INFINITY, -1, 0, &packet->best_t[l], &packet->best_i[l]);
+		}
+	}
+	
+	// planes have no bounds so every lane tests every plane
+	STAT(thread_stats->plane_tests += (long long)rs->plane_count * lanes);
+	STAT(thread_stats->traversals += lanes);
+	for(int p = 0; p < rs->plane_count; p+=1)
+	{
+		int i = rs->plane_id[p];
+		for(int l = 0; l < lanes; l+=1)
+		{
+			real Rd[3] = {packet->dx[l], packet->dy[l], packet->dz[l]};
+			real t = plane_hit(o, Rd, rs->plane_px[p], rs->plane_py[p], rs->plane_pz[p], rs->plane_nx[p], rs->plane_ny[p], rs->plane_nz[p]);
+			if(packet->active[l] && t > 0 && (t < packet->best_t[l] || (t == packet->best_t[l] && i < packet->best_i[l])))
+			{
+				packet->best_t[l] = t;
+				packet->best_i[l] = i;
+			}
+		}
+	}
+}
+
+// returns 1 if any lane of the packet enters the node before its closest hit so far (same slab test as ray_box(); inactive lanes have a -INFINITY limit so they never do)
+int packet_enter_scalar(ray_packet* packet, bvh_node* node)
+{
+	real* o = packet->o;
+	
+	for(int l = 0; l < packet->lanes; l+=1)
+	{
+		real inv_Rd[3] = {packet->inv_dx[l], packet->inv_dy[l], packet->inv_dz[l]};
+		if(ray_box(o, inv_Rd, node->min, node->max, packet->best_t[l]))
+			return 1;
+	}
+	
+	return 0;
+}
+
+// intersects every lane of the packet with one packed sphere whose c term has already been computed for the shared origin (same operations as sphere_hit())
+void packet_sphere_scalar(ray_packet* packet, real cx, real cy, real cz, real c, int i)
+{
+	for(int l = 0; l < packet->lanes; l+=1)
+	{
+		real d_c = packet->dx[l] * cx + packet->dy[l] * cy + packet->dz[l] * cz;
+		real hb = packet->o_d[l] - d_c;
+		real det = hb * hb - c;
+		if(det < 0)
+			continue;
+		det = sqrt(det);
+		real t = -hb - det;
+		if(!(t > 0))
+			t = -hb + det;
+		if(t > 0 && (t < packet->best_t[l] || (t == packet->best_t[l] && i < packet->best_i[l])))
+		{
+			packet->best_t[l] = t;
+			packet->best_i[l] = i;
+		}
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// AVX2 version of packet_enter_scalar() which tests AVX_LANES lanes per instruction
+__attribute__((target("avx2")))
+int packet_enter_avx2(ray_packet* packet, bvh_node* node)
+{
+	vec_avx ox = AVX(set1)(packet->o[0]), oy = AVX(set1)(packet->o[1]), oz = AVX(set1)(packet->o[2]);
+	vec_avx min_x = AVX(set1)(node->min[0]), min_y = AVX(set1)(node->min[1]), min_z = AVX(set1)(node->min[2]);
+	vec_avx max_x = AVX(set1)(node->max[0]), max_y = AVX(set1)(node->max[1]), max_z = AVX(set1)(node->max[2]);
+	vec_avx mins[3] = {min_x, min_y, min_z}, maxs[3] = {max_x, max_y, max_z}, origins[3] = {ox, oy, oz};
+	real* inv[3] = {packet->inv_dx, packet->inv_dy, packet->inv_dz};
+	
+	for(int l = 0; l < packet->lanes; l+=AVX_LANES)
+	{
+		vec_avx t_near = AVX(setzero)();
+		vec_avx t_far = AVX(loadu)(&packet->best_t[l]);
+		for(int k = 0; k < 3; k+=1)
+		{
+			vec_avx inv_d = AVX(loadu)(&inv[k][l]);
+			vec_avx t0 = AVX(mul)(AVX(sub)(mins[k], origins[k]), inv_d);
+			vec_avx t1 = AVX(mul)(AVX(sub)(maxs[k], origins[k]), inv_d);
+			vec_avx swap = AVX(cmp)(t0, t1, _CMP_GT_OQ);
+			vec_avx lo = AVX(blendv)(t0, t1, swap);
+			vec_avx hi = AVX(blendv)(t1, t0, swap);
+			t_near = AVX(blendv)(t_near, lo, AVX(cmp)(lo, t_near, _CMP_GT_OQ));
+			t_far = AVX(blendv)(t_far, hi, AVX(cmp)(hi, t_far, _CMP_LT_OQ));
+		}
+		if(AVX(movemask)(AVX(cmp)(t_near, t_far, _CMP_LE_OQ)))
+			return 1;
+	}
+	
+	return 0;
+}
+
+// AVX2 version of packet_sphere_scalar() which intersects AVX_LANES lanes per instruction
+__attribute__((target("avx2")))
+void packet_sphere_avx2(ray_packet* packet, real cx, real cy, real cz, real c, int i)
+{
+	vec_avx vcx = AVX(set1)(cx), vcy = AVX(set1)(cy), vcz = AVX(set1)(cz), vc = AVX(set1)(c);
+	vec_avx zero = AVX(setzero)(), miss = AVX(set1)(-1), sign = AVX(set1)(-0.0);
+	
+	for(int l = 0; l < packet->lanes; l+=AVX_LANES)
+	{
+		vec_avx d_c = AVX(add)(AVX(add)(AVX(mul)(AVX(loadu)(&packet->dx[l]), vcx), AVX(mul)(AVX(loadu)(&packet->dy[l]), vcy)), AVX(mul)(AVX(loadu)(&packet->dz[l]), vcz));
+		vec_avx hb = AVX(sub)(AVX(loadu)(&packet->o_d[l]), d_c);
+		vec_avx det = AVX(sub)(AVX(mul)(hb, hb), vc);
+		vec_avx hit = AVX(cmp)(det, zero, _CMP_GE_OQ);
+		if(AVX(movemask)(hit) == 0) // none of the lanes hit the sphere
+			continue;
+		det = AVX(sqrt)(AVX(and)(det, hit));
+		vec_avx neg_hb = AVX(xor)(hb, sign);
+		vec_avx t0 = AVX(sub)(neg_hb, det);
+		vec_avx t1 = AVX(add)(neg_hb, det);
+		vec_avx t = AVX(blendv)(miss, t1, AVX(cmp)(t1, zero, _CMP_GT_OQ));
+		t = AVX(blendv)(t, t0, AVX(cmp)(t0, zero, _CMP_GT_OQ));
+		t = AVX(blendv)(miss, t, hit);
+		
+		// lanes which found a strictly closer hit are updated with a blend, while exact ties fall back to comparing object indices lane by lane
+		vec_avx best = AVX(loadu)(&packet->best_t[l]);
+		vec_avx valid = AVX(cmp)(t, zero, _CMP_GT_OQ);
+		int closer = AVX(movemask)(AVX(and)(valid, AVX(cmp)(t, best, _CMP_LT_OQ)));
+		int tied = AVX(movemask)(AVX(and)(valid, AVX(cmp)(t, best, _CMP_EQ_OQ)));
+		if(closer == 0 && tied == 0)
+			continue;
+		
+		real t_lanes[AVX_LANES];
+		AVX(storeu)(t_lanes, t);
+		for(int k = 0; k < AVX_LANES; k+=1)
+		{
+			if(((closer >> k) & 1) || (((tied >> k) & 1) && i < packet->best_i[l + k]))
+			{
+				packet->best_t[l + k] = t_lanes[k];
+				packet->best_i[l + k] = i;
+			}
+		}
+	}
+}
+
+// AVX-512 version of packet_enter_scalar() which tests AVX512_LANES lanes per instruction
+__attribute__((target("avx512f")))
+int packet_enter_avx512(ray_packet* packet, bvh_node* node)
+{
+	vec_avx512 mins[3] = {AVX512(set1)(node->min[0]), AVX512(set1)(node->min[1]), AVX512(set1)(node->min[2])};
+	vec_avx512 maxs[3] = {AVX512(set1)(node->max[0]), AVX512(set1)(node->max[1]), AVX512(set1)(node->max[2])};
+	vec_avx512 origins[3] = {AVX512(set1)(packet->o[0]), AVX512(set1)(packet->o[1]), AVX512(set1)(packet->o[2])};
+	real* inv[3] = {packet->inv_dx, packet->inv_dy, packet->inv_dz};
+	
+	for(int l = 0; l < packet->lanes; l+=AVX512_LANES)
+	{
+		vec_avx512 t_near = AVX512(setzero)();
+		vec_avx512 t_far = AVX512(loadu)(&packet->best_t[l]);
+		for(int k = 0; k < 3; k+=1)
+		{
+			vec_avx512 inv_d = AVX512(loadu)(&inv[k][l]);
+			vec_avx512 t0 = AVX512(mul)(AVX512(sub)(mins[k], origins[k]), inv_d);
+			vec_avx512 t1 = AVX512(mul)(AVX512(sub)(maxs[k], origins[k]), inv_d);
+			mask_avx512 swap = AVX512_CMP(t0, t1, _CMP_GT_OQ);
+			vec_avx512 lo = AVX512(mask_blend)(swap, t0, t1);
+			vec_avx512 hi = AVX512(mask_blend)(swap, t1, t0);
+			t_near = AVX512(mask_blend)(AVX512_CMP(lo, t_near, _CMP_GT_OQ), t_near, lo);
+			t_far = AVX512(mask_blend)(AVX512_CMP(hi, t_far, _CMP_LT_OQ), t_far, hi);
+		}
+		if(AVX512_CMP(t_near, t_far, _CMP_LE_OQ))
+			return 1;
+	}
+	
+	return 0;
+}
+
+// AVX-512 version of packet_sphere_scalar() which intersects AVX512_LANES lanes per instruction
+__attribute__((target("avx512f")))
+void packet_sphere_avx512(ray_packet* packet, real cx, real cy, real cz, real c, int i)
+{
+	vec_avx512 vcx = AVX512(set1)(cx), vcy = AVX512(set1)(cy), vcz = AVX512(set1)(cz), vc = AVX512(set1)(c);
+	vec_avx512 zero = AVX512(setzero)(), miss = AVX512(set1)(-1);
+	
+	for(int l = 0; l < packet->lanes; l+=AVX512_LANES)
+	{
+		vec_avx512 d_c = AVX512(add)(AVX512(add)(AVX512(mul)(AVX512(loadu)(&packet->dx[l]), vcx), AVX512(mul)(AVX512(loadu)(&packet->dy[l]), vcy)), AVX512(mul)(AVX512(loadu)(&packet->dz[l]), vcz));
+		vec_avx512 hb = AVX512(sub)(AVX512(loadu)(&packet->o_d[l]), d_c);
+		vec_avx512 det = AVX512(sub)(AVX512(mul)(hb, hb), vc);
+		mask_avx512 hit = AVX512_CMP(det, zero, _CMP_GE_OQ);
+		if(hit == 0) // none of the lanes hit the sphere
+			continue;
+		det = AVX512(sqrt)(AVX512(mask_blend)(hit, zero, det));
+		vec_avx512 neg_hb = AVX512(sub)(zero, hb);
+		vec_avx512 t0 = AVX512(sub)(neg_hb, det);
+		vec_avx512 t1 = AVX512(add)(neg_hb, det);
+		vec_avx512 t = AVX512(mask_blend)(AVX512_CMP(t1, zero, _CMP_GT_OQ), miss, t1);
+		t = AVX512(mask_blend)(AVX512_CMP(t0, zero, _CMP_GT_OQ), t, t0);
+		t = AVX512(mask_blend)(hit, miss, t);
+		
+		// lanes which found a strictly closer hit are updated with a blend, while exact ties fall back to comparing object indices lane by lane
+		vec_avx512 best = AVX512(loadu)(&packet->best_t[l]);
+		mask_avx512 valid = AVX512_CMP(t, zero, _CMP_GT_OQ);
+		mask_avx512 closer = valid & AVX512_CMP(t, best, _CMP_LT_OQ);
+		mask_avx512 tied = valid & AVX512_CMP(t, best, _CMP_EQ_OQ);
+		if(closer == 0 && tied == 0)
+			continue;
+		
+		real t_lanes[AVX512_LANES];
+		AVX512(storeu)(t_lanes, t);
+		for(int k = 0; k < AVX512_LANES; k+=1)
+		{
+			if(((closer >> k) & 1) || (((tied >> k) & 1) && i < packet->best_i[l + k]))
+			{
+				packet->best_t[l + k] = t_lanes[k];
+				packet->best_i[l + k] = i;
+			}
+		}
+	}
+}
+#endif
+
+// function which formats the P6 header (format, width/height and max color, each followed by whitespace) into out and returns its length. The format and max color are the
+// ones main() hardcodes into the header_buffer, spelled out here since the render server writes images of every size without one
+int format_header(char* out, int size, int width, int height)
+{
+	int length = snprintf(out, size, "P6\n%d %d\n255\n", width, height);
+	
+	if(length < 0 || length >= size)
+	{
+		fprintf(stderr, "Error: Output file header couldn't be formatted.\n");
+		exit(1); // exits out of program due to error
+	}
+	
+	return length;
+}
+
+// function which creates (or truncates) the output file at its final size, maps it into memory, writes the header into it and points the global image_buffer at the bytes right after the header, so the
+// pixels are rendered straight into the page cache and never have to be written out at all
+void map_image_data(char* output_file_name)
+{
+	int width = atoi(header_buffer->file_width);
+	int height = atoi(header_buffer->file_height);
+	char header[512];
+	int header_length = format_header(header, sizeof(header), width, height);
+	size_t pixel_count = (size_t)width * height;
+	
+	output_fd = open(output_file_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(output_fd < 0)
+	{
+		fprintf(stderr, "Error: Output file couldn't be created/modified.\n");
+		exit(1); // exits out of program due to error
+	}
+	
+	output_map_size = header_length + sizeof(image_data) * pixel_count;
+	if(ftruncate(output_fd, output_map_size) != 0)
+	{
+		fprintf(stderr, "Error: Output file couldn't be resized.\n");
+		exit(1); // exits out of program due to error
+	}
+	
+	output_map = mmap(NULL, output_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, output_fd, 0);
+	if(output_map == MAP_FAILED)
+	{
+		fprintf(stderr, "Error: Output file couldn't be mapped.\n");
+		exit(1); // exits out of program due to error
+	}
+	
+	memcpy(output_map, header, header_length);
+	image_buffer = (image_data*)(output_map + header_length); // image_data is just 3 unsigned chars, so the pixels need no alignment
+}
+
+// publishes the image rendered so far: a mapped output file just gets its dirty pages scheduled for writeback, while otherwise the image is written to a temporary file next to
+// the output which is then renamed over it, so anything watching the output only ever sees complete frames
+void write_preview(char* output_file_name, image_data* image, int width, int height)
+{
+	if(output_map != NULL)
+	{
+		msync(output_map, output_map_size, MS_ASYNC);
+		return;
+	}
+	
+	char temp_name[4096];
+	if(snprintf(temp_name, sizeof(temp_name), "%s.partial", output_file_name) >= (int)sizeof(temp_name))
+	{
+		fprintf(stderr, "Error: Output file name is too long.\n");
+		exit(1); // exits out of program due to error
+	}
+	
+	write_ppm(temp_name, image, width, height);
+	if(rename(temp_name, output_file_name) != 0)
+	{
+		fprintf(stderr, "Error: Output file couldn't be replaced.\n");
+		exit(1); // exits out of program due to error
+	}
+}
+
+// returns a monotonic wall clock time in seconds
+double now_seconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// prints a single line json object describing the run (phase wall times, ray counts/throughput and peak resident memory) to stdout, so benchmark runs can be collected and compared across versions
+void print_bench_report(char* input_file, int width, int height)
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage); // ru_maxrss is in kilobytes on linux
+	
+	long long total_rays = ray_totals.primary + ray_totals.secondary + ray_totals.shadow;
+	
+	printf("{\"scene\": \"%s\", \"width\": %d, \"height\": %d, \"threads\": %d, \"simd\": \"%s\", \"packet\": %d, \"objects\": %d, ", input_file, width, height, thread_count, sphere_kernel_name, packet_size, compiled_scene.object_count);
+	printf("\"parse_s\": %.6f, \"build_s\": %.6f, \"build\": \"%s\", \"render_s\": %.6f, \"write_s\": %.6f, ", parse_seconds, build_seconds, build_mode, render_seconds, write_seconds);
+	printf("\"primary_rays\": %lld, \"secondary_rays\": %lld, \"shadow_rays\": %lld, \"rays_per_s\": %.0f, ", ray_totals.primary, ray_totals.secondary, ray_totals.shadow, render_seconds > 0 ? total_rays / render_seconds : 0);
+	printf("\"peak_rss_kb\": %ld, \"precision\": \"%s\"", usage.ru_maxrss, REAL_NAME);
+	if(compare_max_diff >= 0)
+		printf(", \"max_diff\": %d, \"diff_pixels\": %lld", compare_max_diff, compare_diff_pixels);
+	printf("}\n");
+	fflush(stdout);
+}
+
+// reads the reference P6 image (which must be width x height with a max color of 255) and records the largest difference of any channel between it and the rendered image,
+// along with how many pixels differ at all, into compare_max_diff/compare_diff_pixels
+void compare_image(char* file_name, image_data* image, int width, int height)
+{
+	FILE* fh = fopen(file_name, "rb");
+	if(fh == NULL)
+	{
+		fprintf(stderr, "Error: Reference image \"%s\" couldn't be opened.\n", file_name);
+		exit(1); // exits out of program due to error
+	}
+	
+	int reference_width, reference_height, max_color;
+	if(fscanf(fh, "P6 %d %d %d", &reference_width, &reference_height, &max_color) != 3 || fgetc(fh) == EOF)
+	{
+		fprintf(stderr, "Error: Reference image \"%s\" isn't a P6 ppm file.\n", file_name);
+		exit(1); // exits out of program due to error
+	}
+	if(reference_width != width || reference_height != height || max_color != 255)
+	{
+		fprintf(stderr, "Error: Reference image \"%s\" is %dx%d (max color %d) but the rendered image is %dx%d (max color 255).\n", file_name, reference_width, reference_height, max_color, width, height);
+		exit(1); // exits out of program due to error
+	}
+	
+	size_t pixel_count = (size_t)width * height;
+	image_data* reference = malloc(sizeof(image_data) * pixel_count + 1);
+	if(fread(reference, sizeof(image_data), pixel_count, fh) != pixel_count)
+	{
+		fprintf(stderr, "Error: Reference image \"%s\" is shorter than its header says.\n", file_name);
+		exit(1); // exits out of program due to error
+	}
+	fclose(fh);
+	
+	compare_max_diff = 0;
+	compare_diff_pixels = 0;
+	for(size_t i = 0; i < pixel_count; i+=1)
+	{
+		int diff[3] = {abs(image[i].r - reference[i].r), abs(image[i].g - reference[i].g), abs(image[i].b - reference[i].b)};
+		int pixel_diff = diff[0] > diff[1] ? diff[0] : diff[1];
+		if(diff[2] > pixel_diff)
+			pixel_diff = diff[2];
+		if(pixel_diff > 0)
+			compare_diff_pixels++;
+		if(pixel_diff > compare_max_diff)
+			compare_max_diff = pixel_diff;
+	}
+	
+	free(reference);
+}
+
+// prints the --stats report: the phase timers and ray counts of the run along with the merged per-thread counters, either as a readable summary on stderr or as a single line of json on stdout
+void print_stats_report()
+{
+#if RENDER_STATS
+	render_stats* st = &stats_totals;
+	double tests_per_ray = st->traversals > 0 ? (double)(st->box_tests + st->sphere_tests + st->plane_tests) / st->traversals : 0;
+	double average_depth = st->shaded > 0 ? (double)st->depth_sum / st->shaded : 0;
+	
+	if(stats_mode == 2)
+	{
+		printf("{\"parse_s\": %.6f, \"build_s\": %.6f, \"build\": \"%s\", \"render_s\": %.6f, \"write_s\": %.6f, ", parse_seconds, build_seconds, build_mode, render_seconds, write_seconds);
+		printf("\"primary_rays\": %lld, \"reflection_rays\": %lld, \"refraction_rays\": %lld, \"hit_checks\": %lld, \"shadow_rays\": %lld, \"occluder_hits\": %lld, \"lights_culled\": %lld, ",
+				ray_totals.primary, st->reflection_rays, st->refraction_rays, st->hit_checks, ray_totals.shadow, st->occluder_hits, st->lights_culled);
+		printf("\"traversals\": %lld, \"box_tests\": %lld, \"sphere_tests\": %lld, \"plane_tests\": %lld, \"tests_per_ray\": %.2f, ", st->traversals, st->box_tests, st->sphere_tests, st->plane_tests, tests_per_ray);
+		printf("\"shaded\": %lld, \"depth_avg\": %.3f, \"depth_max\": %d, \"depth_cutoffs\": %lld, \"weight_cutoffs\": %lld, \"refined_pixels\": %lld, \"threads\": [", st->shaded, average_depth, st->depth_max, st->depth_cutoffs, st->weight_cutoffs, st->refined_pixels);
+		for(int w = 0; w < worker_stats_count; w+=1)
+			printf("%s{\"tiles\": %d, \"busy_s\": %.6f}", w > 0 ? ", " : "", worker_stats[w].tiles, worker_stats[w].busy_seconds);
+		printf("]}\n");
+		fflush(stdout);
+		return;
+	}
+	
+	fprintf(stderr, "Stats:\n");
+	fprintf(stderr, "  time (s):           parse %.4f, build %.4f (%s), render %.4f, write %.4f\n", parse_seconds, build_seconds, build_mode, render_seconds, write_seconds);
+	fprintf(stderr, "  rays:               %lld primary, %lld reflection, %lld refraction, %lld hit checks, %lld shadow (%.1f%% answered by the cached occluder)\n",
+			ray_totals.primary, st->reflection_rays, st->refraction_rays, st->hit_checks, ray_totals.shadow, ray_totals.shadow > 0 ? 100.0 * st->occluder_hits / ray_totals.shadow : 0);
+	fprintf(stderr, "  lights culled:      %lld (points out of a light's reach, which get no shadow ray towards it)\n", st->lights_culled);
+	fprintf(stderr, "  intersection tests: %lld box, %lld sphere, %lld plane (%.2f per ray over %lld scene queries)\n", st->box_tests, st->sphere_tests, st->plane_tests, tests_per_ray, st->traversals);
+	fprintf(stderr, "  shaded hits:        %lld, bounce depth %.3f on average and %d at most\n", st->shaded, average_depth, st->depth_max);
+	fprintf(stderr, "  rays cut off:       %lld at --max-depth %d, %lld below --min-weight %g\n", st->depth_cutoffs, max_depth, st->weight_cutoffs, min_weight);
+	if(aa_samples > 1)
+		fprintf(stderr, "  anti-aliasing:      %lld pixels refined with %d samples each\n", st->refined_pixels, aa_samples * aa_samples);
+	for(int w = 0; w < worker_stats_count; w+=1)
+		fprintf(stderr, "  thread %d:           %d tiles in %.4f s\n", w, worker_stats[w].tiles, worker_stats[w].busy_seconds);
+#endif
+}
+
+// write_image_data function takes in the output_file_name to know where to write out to; the file is truncated (not appended to) and rewritten by write_ppm(), unless it was mapped
+void write_image_data(char* output_file_name)
+{
+	// a mapped image_buffer already lives in the output file, so all that's left is unmapping it
+	if(output_map != NULL)
+	{
+		if(munmap(output_map, output_map_size) != 0 || close(output_fd) != 0)
+		{
+			fprintf(stderr, "Error: Output file couldn't be written.\n");
+			exit(1); // exits out of program due to error
+		}
+		output_map = NULL;
+		output_fd = -1;
+		image_buffer = NULL;
+		return;
+	}
+	
+	write_ppm(output_file_name, image_buffer, atoi(header_buffer->file_width), atoi(header_buffer->file_height));
+}
+
+// writes the P6 header and the already packed RGB triples of the given width x height image to the given file (truncating it) together in a single writev() call, looped
+// only if the kernel takes fewer bytes than asked
+void write_ppm(char* file_name, image_data* image, int width, int height)
+{
+	char header[512];
+	int header_length = format_header(header, sizeof(header), width, height);
+	size_t pixel_count = (size_t)width * height;
+	
+	int fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644); // file will be created if one does not exist
+	if(fd < 0) 
+	{
+		fprintf(stderr, "Error: Output file couldn't be created/modified.\n");
+		fail(); // exits out of program due to error (or abandons the request of a render server)
+	}
+	
+	struct iovec parts[2];
+	parts[0].iov_base = header;
+	parts[0].iov_len = header_length;
+	parts[1].iov_base = image;
+	parts[1].iov_len = sizeof(image_data) * pixel_count;
+	
+	struct iovec* part = parts;
+	int part_count = 2;
+	while(part_count > 0)
+	{
+		ssize_t written = writev(fd, part, part_count);
+		if(written < 0)
+		{
+			fprintf(stderr, "Error: Output file couldn't be written.\n");
+			close(fd);
+			fail(); // exits out of program due to error (or abandons the request of a render server)
+		}
+		
+		// skips past whatever was written, which may end partway through one of the parts
+		while(part_count > 0 && (size_t)written >= part->iov_len)
+		{
+			written -= part->iov_len;
+			part++;
+			part_count--;
+		}
+		if(part_count > 0)
+		{
+			part->iov_base = (char*)part->iov_base + written;
+			part->iov_len -= written;
+		}
+	}
+	
+	if(close(fd) != 0)
+	{
+		fprintf(stderr, "Error: Output file couldn't be written.\n");
+		fail(); // exits out of program due to error (or abandons the request of a render server)
+	}
+}
+
+// function which takes in an origin ray, direction of the ray (normalized), position of the sphere object, and radius of the sphere object and determines if there's an intersection at the current point.
+// This is the original full quadratic, which the renderer no longer calls (see sphere_hit()) but --selftest keeps as the reference the sphere kernels are checked against
+real sphere_intersection(real* Ro, real* Rd, real* C, real r)
+{
+	real a = sqr(Rd[0]) + sqr(Rd[1]) + sqr(Rd[2]);
+	real b = (2 * (Ro[0] * Rd[0] - Rd[0] * C[0] + Ro[1] * Rd[1] - Rd[1] * C[1] + Ro[2] * Rd[2] - Rd[2] * C[2]));
+	real c = sqr(Ro[0]) - 2*Ro[0]*C[0] + sqr(C[0]) + sqr(Ro[1]) - 2*Ro[1]*C[1] + sqr(C[1]) + sqr(Ro[2]) - 2*Ro[2]*C[2] + sqr(C[2]) - sqr(r);
+		
+	real det = sqr(b) - 4 * a * c;
+	if(det < 0) return -1; // if determinant is negative then there's no sphere intersection so return -1
+	
+	det = sqrt(det);
+	
+	real t0 = (-b - det) / (2 * a);	
+	if(t0 > 0) return t0; // t0 indicates a sphere intersection so return it
+	real t1 = (-b + det) / (2 * a);
+	if(t1 > 0) return t1; // t1 indicates a sphere intersection so return it
+	
+	return -1; // didn't find a sphere intersection so return -1
+}
+
+// fills in the ray_info for the given ray, precomputing the parts of the sphere quadratic which don't depend on the sphere
+void setup_ray(real Ro[3], real Rd[3], ray_info* ray)
+{
+	for(int k = 0; k < 3; k+=1)
+	{
+		ray->o[k] = Ro[k];
+		ray->d[k] = Rd[k];
+	}
+	ray->o_d = Ro[0] * Rd[0] + Ro[1] * Rd[1] + Ro[2] * Rd[2];
+	ray->o_o = sqr(Ro[0]) + sqr(Ro[1]) + sqr(Ro[2]);
+	ray->scene = active_scene;
+}
+
+// sphere intersection on the packed center/cc fields of the compiled scene. Since every ray direction is normalized the quadratic's a term is always 1, so this solves t^2 + 2*hb*t + c = 0 using half of b:
+// hb = Ro.Rd - Rd.C and c = Ro.Ro - 2*Ro.C + (C.C - r^2), where C.C - r^2 (cc) is stored per sphere. The SIMD kernels below perform exactly the same operations in the same order so every kernel returns bit-identical distances
+real sphere_hit(ray_info* ray, real cx, real cy, real cz, real cc)
+{
+	real d_c = ray->d[0] * cx + ray->d[1] * cy + ray->d[2] * cz;
+	real o_c = ray->o[0] * cx + ray->o[1] * cy + ray->o[2] * cz;
+	real hb = ray->o_d - d_c;
+	real c = ray->o_o - 2 * o_c + cc;
+	
+	real det = hb * hb - c;
+	if(det < 0) return -1; // if determinant is negative then there's no sphere intersection so return -1
+	
+	det = sqrt(det);
+	
+	real t0 = -hb - det;
+	if(t0 > 0) return t0; // t0 indicates a sphere intersection so return it
+	real t1 = -hb + det;
+	if(t1 > 0) return t1; // t1 indicates a sphere intersection so return it
+	
+	return -1; // didn't find a sphere intersection so return -1
+}
+
+// intersects the ray with the count packed spheres starting at start, one at a time (fallback kernel, also used for the leftovers of the SIMD kernels)
+void sphere_kernel_scalar(ray_info* ray, int start, int count, real* t_out)
+{
+	render_scene* rs = ray->scene;
+	for(int i = 0; i < count; i+=1)
+	{
+		int p = start + i;
+		t_out[i] = sphere_hit(ray, rs->sphere_cx[p], rs->sphere_cy[p], rs->sphere_cz[p], rs->sphere_cc[p]);
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// intersects the ray with SSE_LANES packed spheres per instruction (2 doubles or 4 floats) using SSE2
+__attribute__((target("sse2")))
+void sphere_kernel_sse2(ray_info* ray, int start, int count, real* t_out)
+{
+	render_scene* rs = ray->scene;
+	vec_sse dx = SSE(set1)(ray->d[0]), dy = SSE(set1)(ray->d[1]), dz = SSE(set1)(ray->d[2]);
+	vec_sse ox = SSE(set1)(ray->o[0]), oy = SSE(set1)(ray->o[1]), oz = SSE(set1)(ray->o[2]);
+	vec_sse o_d = SSE(set1)(ray->o_d), o_o = SSE(set1)(ray->o_o);
+	vec_sse two = SSE(set1)(2), zero = SSE(setzero)(), miss = SSE(set1)(-1), sign = SSE(set1)(-0.0);
+	int i = 0;
+	
+	for(; i + SSE_LANES <= count; i+=SSE_LANES)
+	{
+		int p = start + i;
+		vec_sse cx = SSE(loadu)(&rs->sphere_cx[p]), cy = SSE(loadu)(&rs->sphere_cy[p]), cz = SSE(loadu)(&rs->sphere_cz[p]);
+		vec_sse d_c = SSE(add)(SSE(add)(SSE(mul)(dx, cx), SSE(mul)(dy, cy)), SSE(mul)(dz, cz));
+		vec_sse o_c = SSE(add)(SSE(add)(SSE(mul)(ox, cx), SSE(mul)(oy, cy)), SSE(mul)(oz, cz));
+		vec_sse hb = SSE(sub)(o_d, d_c);
+		vec_sse c = SSE(add)(SSE(sub)(o_o, SSE(mul)(two, o_c)), SSE(loadu)(&rs->sphere_cc[p]));
+		vec_sse det = SSE(sub)(SSE(mul)(hb, hb), c);
+		vec_sse hit = SSE(cmpge)(det, zero);
+		det = SSE(sqrt)(SSE(and)(det, hit)); // misses are zeroed before the square root and masked out below
+		vec_sse neg_hb = SSE(xor)(hb, sign);
+		vec_sse t0 = SSE(sub)(neg_hb, det);
+		vec_sse t1 = SSE(add)(neg_hb, det);
+		vec_sse use_t0 = SSE(cmpgt)(t0, zero);
+		vec_sse use_t1 = SSE(andnot)(use_t0, SSE(cmpgt)(t1, zero));
+		vec_sse t = SSE(or)(SSE(and)(use_t0, t0), SSE(and)(use_t1, t1));
+		vec_sse found = SSE(and)(hit, SSE(or)(use_t0, use_t1));
+		SSE(storeu)(&t_out[i], SSE(or)(SSE(and)(found, t), SSE(andnot)(found, miss)));
+	}
+	
+	sphere_kernel_scalar(ray, start + i, count - i, t_out + i);
+}
+
+// intersects the ray with AVX_LANES packed spheres per instruction (4 doubles or 8 floats) using AVX2
+__attribute__((target("avx2")))
+void sphere_kernel_avx2(ray_info* ray, int start, int count, real* t_out)
+{
+	render_scene* rs = ray->scene;
+	vec_avx dx = AVX(set1)(ray->d[0]), dy = AVX(set1)(ray->d[1]), dz = AVX(set1)(ray->d[2]);
+	vec_avx ox = AVX(set1)(ray->o[0]), oy = AVX(set1)(ray->o[1]), oz = AVX(set1)(ray->o[2]);
+	vec_avx o_d = AVX(set1)(ray->o_d), o_o = AVX(set1)(ray->o_o);
+	vec_avx two = AVX(set1)(2), zero = AVX(setzero)(), miss = AVX(set1)(-1), sign = AVX(set1)(-0.0);
+	int i = 0;
+	
+	for(; i + AVX_LANES <= count; i+=AVX_LANES)
+	{
+		int p = start + i;
+		vec_avx cx = AVX(loadu)(&rs->sphere_cx[p]), cy = AVX(loadu)(&rs->sphere_cy[p]), cz = AVX(loadu)(&rs->sphere_cz[p]);
+		vec_avx d_c = AVX(add)(AVX(add)(AVX(mul)(dx, cx), AVX(mul)(dy, cy)), AVX(mul)(dz, cz));
+		vec_avx o_c = AVX(add)(AVX(add)(AVX(mul)(ox, cx), AVX(mul)(oy, cy)), AVX(mul)(oz, cz));
+		vec_avx hb = AVX(sub)(o_d, d_c);
+		vec_avx c = AVX(add)(AVX(sub)(o_o, AVX(mul)(two, o_c)), AVX(loadu)(&rs->sphere_cc[p]));
+		vec_avx det = AVX(sub)(AVX(mul)(hb, hb), c);
+		vec_avx hit = AVX(cmp)(det, zero, _CMP_GE_OQ);
+		det = AVX(sqrt)(AVX(and)(det, hit)); // misses are zeroed before the square root and masked out below
+		vec_avx neg_hb = AVX(xor)(hb, sign);
+		vec_avx t0 = AVX(sub)(neg_hb, det);
+		vec_avx t1 = AVX(add)(neg_hb, det);
+		vec_avx t = AVX(blendv)(miss, t1, AVX(cmp)(t1, zero, _CMP_GT_OQ));
+		t = AVX(blendv)(t, t0, AVX(cmp)(t0, zero, _CMP_GT_OQ));
+		AVX(storeu)(&t_out[i], AVX(blendv)(miss, t, hit));
+	}
+	
+	sphere_kernel_scalar(ray, start + i, count - i, t_out + i);
+}
+
+// intersects the ray with AVX512_LANES packed spheres per instruction (8 doubles or 16 floats) using AVX-512
+__attribute__((target("avx512f")))
+void sphere_kernel_avx512(ray_info* ray, int start, int count, real* t_out)
+{
+	render_scene* rs = ray->scene;
+	vec_avx512 dx = AVX512(set1)(ray->d[0]), dy = AVX512(set1)(ray->d[1]), dz = AVX512(set1)(ray->d[2]);
+	vec_avx512 ox = AVX512(set1)(ray->o[0]), oy = AVX512(set1)(ray->o[1]), oz = AVX512(set1)(ray->o[2]);
+	vec_avx512 o_d = AVX512(set1)(ray->o_d), o_o = AVX512(set1)(ray->o_o);
+	vec_avx512 two = AVX512(set1)(2), zero = AVX512(setzero)(), miss = AVX512(set1)(-1);
+	int i = 0;
+	
+	for(; i + AVX512_LANES <= count; i+=AVX512_LANES)
+	{
+		int p = start + i;
+		vec_avx512 cx = AVX512(loadu)(&rs->sphere_cx[p]), cy = AVX512(loadu)(&rs->sphere_cy[p]), cz = AVX512(loadu)(&rs->sphere_cz[p]);
+		vec_avx512 d_c = AVX512(add)(AVX512(add)(AVX512(mul)(dx, cx), AVX512(mul)(dy, cy)), AVX512(mul)(dz, cz));
+		vec_avx512 o_c = AVX512(add)(AVX512(add)(AVX512(mul)(ox, cx), AVX512(mul)(oy, cy)), AVX512(mul)(oz, cz));
+		vec_avx512 hb = AVX512(sub)(o_d, d_c);
+		vec_avx512 c = AVX512(add)(AVX512(sub)(o_o, AVX512(mul)(two, o_c)), AVX512(loadu)(&rs->sphere_cc[p]));
+		vec_avx512 det = AVX512(sub)(AVX512(mul)(hb, hb), c);
+		mask_avx512 hit = AVX512_CMP(det, zero, _CMP_GE_OQ);
+		det = AVX512(sqrt)(AVX512(mask_blend)(hit, zero, det)); // misses are zeroed before the square root and masked out below
+		vec_avx512 neg_hb = AVX512(sub)(zero, hb);
+		vec_avx512 t0 = AVX512(sub)(neg_hb, det);
+		vec_avx512 t1 = AVX512(add)(neg_hb, det);
+		vec_avx512 t = AVX512(mask_blend)(AVX512_CMP(t1, zero, _CMP_GT_OQ), miss, t1);
+		t = AVX512(mask_blend)(AVX512_CMP(t0, zero, _CMP_GT_OQ), t, t0);
+		AVX512(storeu)(&t_out[i], AVX512(mask_blend)(hit, miss, t));
+	}
+	
+	sphere_kernel_scalar(ray, start + i, count - i, t_out + i);
+}
+#endif
+
+#ifdef DEBUG
+// debug build wrapper which checks every result of the selected sphere kernel against the scalar kernel
+void (*sphere_kernel_checked)(ray_info* ray, int start, int count, real* t_out);
+
+void sphere_kernel_debug(ray_info* ray, int start, int count, real* t_out)
+{
+	real expected[KERNEL_BATCH];
+	sphere_kernel_checked(ray, start, count, t_out);
+	sphere_kernel_scalar(ray, start, count, expected);
+	for(int i = 0; i < count; i+=1)
+	{
+		if(t_out[i] != expected[i])
+		{
+			fprintf(stderr, "Error: %s sphere kernel returned %.17g for sphere %d but the scalar kernel returned %.17g.\n", sphere_kernel_name, t_out[i], ray->scene->sphere_id[start + i], expected[i]);
+			exit(1);
+		}
+	}
+}
+#endif
+
+// picks the widest sphere/packet kernels supported by the cpu, or the ones named on the command line (which must also be supported)
+void select_simd_kernels(char* name)
+{
+	int found = 0;
+	sphere_kernel = sphere_kernel_scalar;
+	packet_enter = packet_enter_scalar;
+	packet_sphere = packet_sphere_scalar;
+	sphere_kernel_name = "scalar";
+	
+	if(name == NULL || strcmp(name, "scalar") == 0)
+		found = 1;
+	
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	// candidates are listed narrowest to widest so that without a name the last supported one wins
+	struct {
+		char* name;
+		int supported;
+		void (*kernel)(ray_info*, int, int, real*);
+		int (*enter)(ray_packet*, bvh_node*);
+		void (*sphere)(ray_packet*, real, real, real, real, int);
+	} candidates[3] = {
+		{"sse2", __builtin_cpu_supports("sse2"), sphere_kernel_sse2, packet_enter_scalar, packet_sphere_scalar}, // packets only get vector kernels from AVX2 up
+		{"avx2", __builtin_cpu_supports("avx2"), sphere_kernel_avx2, packet_enter_avx2, packet_sphere_avx2},
+		{"avx512", __builtin_cpu_supports("avx512f"), sphere_kernel_avx512, packet_enter_avx512, packet_sphere_avx512}
+	};
+	
+	for(int k = 0; k < 3; k+=1)
+	{
+		if(candidates[k].supported && (name == NULL || strcmp(name, candidates[k].name) == 0))
+		{
+			sphere_kernel = candidates[k].kernel;
+			packet_enter = candidates[k].enter;
+			packet_sphere = candidates[k].sphere;
+			sphere_kernel_name = candidates[k].name;
+			found = 1;
+		}
+	}
+#endif
+	
+	if(!found)
+	{
+		fprintf(stderr, "Error: Sphere kernel \"%s\" is unknown or not supported by this cpu.\n", name);
+		exit(1);
+	}
+	
+#ifdef DEBUG
+	sphere_kernel_checked = sphere_kernel;
+	sphere_kernel = sphere_kernel_debug;
+#endif
+}
+
+// checks whether the cpu supports the sphere kernel with the given name (the same test select_simd_kernels() makes)
+int simd_kernels_supported(char* name)
+{
+	if(strcmp(name, "scalar") == 0)
+		return 1;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(strcmp(name, "sse2") == 0)
+		return __builtin_cpu_supports("sse2");
+	if(strcmp(name, "avx2") == 0)
+		return __builtin_cpu_supports("avx2");
+	if(strcmp(name, "avx512") == 0)
+		return __builtin_cpu_supports("avx512f");
+#endif
+	return 0;
+}
+
+// --selftest: shoots SELFTEST_RAYS random rays at SELFTEST_SPHERES random spheres (packed like compile_scene() packs them) through every sphere kernel the cpu supports, and
+// checks that each kernel returns the same distances as the scalar kernel bit for bit and picks the same nearest sphere as the original sphere_intersection(), at the same
+// distance to within rounding (the two solve the quadratic differently). Rays which graze a sphere, start on one or hit two spheres at almost the same distance are skipped,
+// since rounding may legitimately settle those either way. Returns 0 when every kernel passed (so make test can run it)
+int run_selftest()
+{
+	double tolerance = (sizeof(real) == sizeof(float)) ? 1e-3 : 1e-9; // relative distance difference allowed between the two formulas
+	double rounding = (sizeof(real) == sizeof(float)) ? 1e-5 : 1e-12; // how close to grazing (relative to the quadratic's terms) a ray has to be before it's skipped
+	
+	// block of code which builds a render scene holding just the random spheres
+	render_scene rs;
+	memset(&rs, 0, sizeof(rs));
+	rs.sphere_count = SELFTEST_SPHERES;
+	rs.sphere_cx = malloc(sizeof(real) * SELFTEST_SPHERES);
+	rs.sphere_cy = malloc(sizeof(real) * SELFTEST_SPHERES);
+	rs.sphere_cz = malloc(sizeof(real) * SELFTEST_SPHERES);
+	rs.sphere_cc = malloc(sizeof(real) * SELFTEST_SPHERES);
+	rs.sphere_id = malloc(sizeof(int) * SELFTEST_SPHERES);
+	real centers[SELFTEST_SPHERES][3];
+	real radii[SELFTEST_SPHERES];
+	for(int s = 0; s < SELFTEST_SPHERES; s+=1)
+	{
+		for(int k = 0; k < 3; k+=1)
+			centers[s][k] = 20 * pixel_random(s, k, 0) - 10;
+		radii[s] = 0.2 + 2 * pixel_random(s, 3, 0);
+		rs.sphere_cx[s] = centers[s][0];
+		rs.sphere_cy[s] = centers[s][1];
+		rs.sphere_cz[s] = centers[s][2];
+		rs.sphere_cc[s] = sqr(rs.sphere_cx[s]) + sqr(rs.sphere_cy[s]) + sqr(rs.sphere_cz[s]) - sqr(radii[s]);
+		rs.sphere_id[s] = s;
+	}
+	active_scene = &rs;
+	// end of building the scene
+	
+	char* names[4] = {"scalar", "sse2", "avx2", "avx512"};
+	int failures = 0;
+	for(int k = 0; k < 4; k+=1)
+	{
+		if(!simd_kernels_supported(names[k]))
+		{
+			fprintf(stderr, "Selftest: %s kernel isn't supported by this cpu, skipped\n", names[k]);
+			continue;
+		}
+		select_simd_kernels(names[k]);
+		
+		int kernel_failures = 0;
+		int skipped = 0;
+		for(int r = 0; r < SELFTEST_RAYS; r+=1)
+		{
+			// a random origin (often inside a sphere) and a random normalized direction
+			real Ro[3];
+			real Rd[3];
+			for(int a = 0; a < 3; a+=1)
+			{
+				Ro[a] = 30 * pixel_random(r, a, 1) - 15;
+				Rd[a] = 2 * pixel_random(r, a, 2) - 1;
+			}
+			if(sqr(Rd[0]) + sqr(Rd[1]) + sqr(Rd[2]) < 0.01)
+				Rd[2] = 1;
+			normalize(Rd);
+			
+			// block of code which finds the nearest hit with the original intersection, noting rays whose nearest hit rounding could change
+			int ref_i = -1;
+			real ref_t = INFINITY;
+			real second_t = INFINITY;
+			int ambiguous = 0;
+			for(int s = 0; s < SELFTEST_SPHERES; s+=1)
 			{
-				if(value < 0 || value > 1) // error check to make sure reflectivity is between 0 and 1
+				real t = sphere_intersection(Ro, Rd, centers[s], radii[s]);
+				if(t > 0 && t < ref_t)
 				{
-					fprintf(stderr, "Error: reflectivity must be between 0 and 1. Violation found on line number %d.\n", line);
-					exit(1);
+					second_t = ref_t;
+					ref_t = t;
+					ref_i = s;
 				}
-				objects[i]->plane.reflectivity = value;
-				plane_reflectivity_read++;
-			}
-		}	
-		else if((strcmp(key, "refractivity") == 0 && objects[i]->kind == 1) || (strcmp(key, "refractivity") == 0 && objects[i]->kind == 2)) // evaluates only if key is refractivity and current object is a sphere or plane
-		{
-			if(objects[i]->kind == 1)
-			{
-				if(value < 0 || value > 1) // error check to make sure refractivity is between 0 and 1
+				else if(t > 0 && t < second_t)
 				{
-					fprintf(stderr, "Error: refractivity must be between 0 and 1. Violation found on line number %d.\n", line);
-					exit(1);
+					second_t = t;
 				}
-				objects[i]->sphere.refractivity = value;
-				sphere_refractivity_read++;
+				ambiguous |= selftest_ambiguous(Ro, Rd, centers[s], radii[s], rounding);
 			}
-			else
+			if(second_t - ref_t <= tolerance * (1 + ref_t))
+				ambiguous = 1;
+			// end of the reference
+			
+			// block of code which finds the nearest hit with the kernel, in batches like sphere_bvh_walk() hands them out, checking every distance against the scalar kernel
+			ray_info ray;
+			setup_ray(Ro, Rd, &ray);
+			int best_i = -1;
+			real best_t = INFINITY;
+			for(int p = 0; p < SELFTEST_SPHERES; p += KERNEL_BATCH)
 			{
-				if(value < 0 || value > 1) // error check to make sure refractivity is between 0 and 1
+				int n = (SELFTEST_SPHERES - p < KERNEL_BATCH) ? SELFTEST_SPHERES - p : KERNEL_BATCH;
+				real t_batch[KERNEL_BATCH];
+				real t_scalar[KERNEL_BATCH];
+				sphere_kernel(&ray, p, n, t_batch);
+				sphere_kernel_scalar(&ray, p, n, t_scalar);
+				for(int i = 0; i < n; i+=1)
 				{
-					fprintf(stderr, "Error: refractivity must be between 0 and 1. Violation found on line number %d.\n", line);
-					exit(1);
+					if(t_batch[i] != t_scalar[i])
+					{
+						fprintf(stderr, "Error: %s kernel returned %.17g for sphere %d of ray %d but the scalar kernel returned %.17g\n", names[k], t_batch[i], p + i, r, t_scalar[i]);
+						kernel_failures++;
+					}
+					if(t_batch[i] > 0 && t_batch[i] < best_t)
+					{
+						best_t = t_batch[i];
+						best_i = p + i;
+					}
 				}
-				objects[i]->plane.refractivity = value;
-				plane_refractivity_read++;
 			}
-		}	
-		else if((strcmp(key, "ior") == 0 && objects[i]->kind == 1) || (strcmp(key, "ior") == 0 && objects[i]->kind == 2)) // evaluates only if key is ior and current object is a sphere or plane
-		{
-			if(objects[i]->kind == 1)
+			// end of the kernel
+			
+			if(ambiguous)
 			{
-				objects[i]->sphere.ior = value;
-				sphere_ior_read++;
+				skipped++;
+				continue;
 			}
-			else
+			if(best_i != ref_i || (ref_i != -1 && fabs(best_t - ref_t) > tolerance * (1 + ref_t)))
 			{
-				objects[i]->plane.ior = value;
-				plane_ior_read++;
+				fprintf(stderr, "Error: %s kernel picked sphere %d at %.17g for ray %d but sphere_intersection() picked sphere %d at %.17g\n", names[k], best_i, best_t, r, ref_i, ref_t);
+				kernel_failures++;
 			}
-		}	
+		}
+		
+		if(kernel_failures == 0)
+			fprintf(stderr, "Selftest: %s kernel matches sphere_intersection() on %d random rays (%d grazing or tied rays skipped)\n", names[k], SELFTEST_RAYS - skipped, skipped);
+		failures += kernel_failures;
+	}
+	
+	active_scene = NULL;
+	free(rs.sphere_cx);
+	free(rs.sphere_cy);
+	free(rs.sphere_cz);
+	free(rs.sphere_cc);
+	free(rs.sphere_id);
+	return (failures == 0) ? 0 : 1;
+}
+
+// checks (in double precision, whatever real is) whether the ray grazes the sphere or starts on its surface to within the tolerance, i.e. whether the quadratic's discriminant or
+// its c term is close enough to 0 for rounding to put sphere_intersection() and the kernels on opposite sides of it
+int selftest_ambiguous(real* Ro, real* Rd, real* C, real r, double tolerance)
+{
+	double hb = 0;
+	double c = -(double)r * r;
+	for(int k = 0; k < 3; k+=1)
+	{
+		double oc = (double)Ro[k] - C[k];
+		hb += oc * Rd[k];
+		c += oc * oc;
+	}
+	double scale = hb * hb + fabs(c) + 1;
+	return fabs(hb * hb - c) <= tolerance * scale || fabs(c) <= tolerance * scale;
+}
+
+// plane intersection on the packed position/normal fields of the compiled scene (the normal must already be normalized)
+real plane_hit(real* Ro, real* Rd, real px, real py, real pz, real nx, real ny, real nz)
+{
+	real Vd = ((nx * Rd[0]) + (ny * Rd[1]) + (nz * Rd[2]));
+	if(Vd == 0) // parallel ray so no intersection
+	{
+		return -1;
+	}
+	real Vo = -((nx * Ro[0]) + (ny * Ro[1]) + (nz * Ro[2])) + sqrt(sqr(px - Ro[0]) + sqr(py - Ro[1]) + sqr(pz - Ro[2]));
+
+	
+	real t = Vo/Vd;
+		
+	if(t > 0) // found plane intersection so return t
+	{
+		return t;
+	}
+	
+	return -1; // didn't find a plane intersection so return -1
+}
+
+// next_c() returns the next character of the json buffer and provides error checking and line number maintenance
+int next_c(json_reader* json)
+{
+  if (json->pos >= json->size) {
+    fprintf(stderr, "Error: Unexpected end of file on line number %d.\n", line);
+    fail();
+  }
+  int c = (unsigned char)json->data[json->pos++];
+#ifdef DEBUG
+  printf("next_c: '%c'\n", c);
+#endif
+  if (c == '\n') {
+    line += 1;
+  }
+  return c;
+}
+
+// expect_c() checks that the next character is d.  If it is not it emits an error.
+void expect_c(json_reader* json, int d)
+{
+  int c = next_c(json);
+  if (c == d) return;
+  fprintf(stderr, "Error: Expected '%c' on line %d.\n", d, line);
+  fail();
+}
+
+// skip_ws() skips white space in the buffer, and like next_c() emits an error if the buffer runs out.
+void skip_ws(json_reader* json)
+{
+  while (json->pos < json->size && isspace((unsigned char)json->data[json->pos])) {
+    if (json->data[json->pos] == '\n') {
+      line += 1;
+    }
+    json->pos += 1;
+  }
+  if (json->pos >= json->size) {
+    fprintf(stderr, "Error: Unexpected end of file on line number %d.\n", line);
+    fail();
+  }
+}
+
+// next_string() gets the next string from the buffer into the given (129 character) buffer and emits an error if a string can not be obtained.
+void next_string(json_reader* json, char* buffer)
+{
+  int c = next_c(json);
+  if (c != '"') {
+    fprintf(stderr, "Error: Expected string on line %d.\n", line);
+    fail();
+  }
+  c = next_c(json);
+  int i = 0;
+  while (c != '"') {
+    if (i >= 128) {
+      fprintf(stderr, "Error: Strings longer than 128 characters in length are not supported.\n");
+      fail();
+    }
+    if (c == '\\') {
+      fprintf(stderr, "Error: Strings with escape codes are not supported.\n");
+      fail();
+    }
+    if (c < 32 || c > 126) {
+      fprintf(stderr, "Error: Strings may contain only ascii characters.\n");
+      fail();
+    }
+    buffer[i] = c;
+    i += 1;
+    c = next_c(json);
+  }
+  buffer[i] = 0;
+}
+
+// next_key() reads the next string like next_string() and interns it; the returned number indexes json_keys, or is -1 for a key the parser doesn't know.
+int next_key(json_reader* json, char* buffer)
+{
+  next_string(json, buffer);
+  for (int k = 0; k < KEY_COUNT; k += 1) {
+    if (strcmp(buffer, json_keys[k]) == 0) {
+      return k;
+    }
+  }
+  return -1;
+}
+
+// function which reads next number from the buffer, wrapped around error checking if nothing is read in. Since the buffer isn't null terminated, the characters
+// which can make up a number are copied out first and handed to strtod() (which accepts the same numbers fscanf("%lf") did)
+double next_number(json_reader* json)
+{
+  char token[64];
+  int length = 0;
+
+  skip_ws(json); // fscanf() skipped leading whitespace as well
+  while (json->pos + length < json->size && length < 63) {
+    int c = (unsigned char)json->data[json->pos + length];
+    if (!isalnum(c) && c != '+' && c != '-' && c != '.') {
+      break;
+    }
+    token[length] = c;
+    length += 1;
+  }
+  token[length] = 0;
+
+  char* end;
+  double value = strtod(token, &end);
+  if(end == token) // error checking to make sure a number was read in
+  {
+	  fprintf(stderr, "Error: Expected a number on line %d.\n", line);
+      fail();
+  }
+  json->pos += end - token; // only the characters strtod() used up are consumed
+  return value;
+}
+
+// function which reads next vector from file into v
+void next_vector(json_reader* json, double* v)
+{
+  expect_c(json, '[');
+  skip_ws(json);
+  v[0] = next_number(json);
+  skip_ws(json);
+  expect_c(json, ',');
+  skip_ws(json);
+  v[1] = next_number(json);
+  skip_ws(json);
+  expect_c(json, ',');
+  skip_ws(json);
+  v[2] = next_number(json);
+  skip_ws(json);
+  expect_c(json, ']');
+}
+
+// normalizes given vector
+void normalize(real* v) 
+{
+  real len = sqrt(sqr(v[0]) + sqr(v[1]) + sqr(v[2]));
+  v[0] /= len;
+  v[1] /= len;
+  v[2] /= len;
+}
+
+// copies the parsed (double) vector v into out, which is float in the float build
+void copy_vector(real* out, double* v)
+{
+  out[0] = v[0];
+  out[1] = v[1];
+  out[2] = v[2];
+}
+
+// squares given value
+real sqr(real v) 
+{
+  return v*v;
+}
+
+// clamping helper function to make sure color isn't outside of 0-1 range (inclusive)
+real clamp(real value)
+{
+    if (value < 0)
+        return 0;
+    else if (value > 1)
+        return 1;
+    else
+        return value;
+}
+
+// does radial attenutation calculations and returns value accordingly
+real frad(render_light* light, real dl)
+{
+	real return_value = (1 / ((light->radial_a2 * sqr(dl)) + (light->radial_a1 * dl) + light->radial_a0));
+	
+	return return_value;
+}
+
+// does angular attenutation calculations and returns value accordingly
+real fang(render_light* light, real direction[3])
+{
+	if(light->kind_light != 1) // not spot light so return 1
+		return 1.0;
+		
+	real v0_vl = (light->direction[0] * direction[0]) + (light->direction[1] * direction[1]) +  (light->direction[2] * direction[2]);
+	
+	if(v0_vl < light->cos_theta) // outside of the spot light's cone
+		return 0;
+	
+	if(light->angular_power >= 0)
+		return ipow(v0_vl, light->angular_power);
+	return pow(v0_vl, light->angular_a0);
+}
+
+// returns the distance beyond which the light can't add more than --light-cutoff to a point, i.e. where frad() times its brightest channel falls below the cutoff. frad() only falls off
+// (its coefficients are never negative and a2 is never 0), so that's the positive root of a2 d^2 + a1 d + a0 = brightest / cutoff, or 0 when the light is never that bright
+double light_reach(render_light* light)
+{
+	if(light_cutoff <= 0)
+		return INFINITY;
+	
+	double brightest = fmax(light->color[0], fmax(light->color[1], light->color[2]));
+	double a2 = light->radial_a2;
+	double a1 = light->radial_a1;
+	double c = light->radial_a0 - brightest / light_cutoff;
+	if(c >= 0)
+		return 0;
+	return -2 * c / (a1 + sqrt(a1 * a1 - 4 * a2 * c)); // the root's stable form, since -a1 + sqrt(...) loses digits when a2 * c is small
+}
+
+// estimates how much the light can add to a point at the given distance without tracing its shadow ray: its brightest channel times frad() and, for spot lights, fang() of
+// the direction from the light to the point (which point lights don't need). Lights which add nothing (or can't be weighed, like one sitting right on the point) get 0, so they're never drawn
+real light_importance(render_light* light, real distance, real light_to_point[3])
+{
+	real brightest = fmax(light->color[0], fmax(light->color[1], light->color[2]));
+	real importance = brightest * frad(light, distance);
+	if(light->kind_light == 1)
+		importance *= fang(light, light_to_point);
+	return (importance > 0 && isfinite(importance)) ? importance : 0;
+}
+
+// computes the bounding box of the region the light reaches: the ball of the given radius around it, which a spot light narrows down to its cone. Along each axis the cone reaches as
+// far as its direction closest to that axis (cos of the angle left over once theta is taken off), or not at all past the light when every direction in it points away. Plane hits see the
+// cone mirrored in y (see shade()), so a spot light's y bounds cover both. The box is padded like sphere_bounds() pads spheres
+void light_bounds(render_light* light, double radius, double* min, double* max)
+{
+	double theta = acos(fmin(1, fmax(-1, (double)light->cos_theta))) + 1e-6; // (widened slightly so a point right on the edge of the cone is never cut off by rounding)
+	for(int k = 0; k < 3; k+=1)
+	{
+		double reach_up = radius;
+		double reach_down = radius;
+		if(light->kind_light == 1)
+		{
+			double angle_up = acos(fmin(1, fmax(-1, (double)light->direction[k]))) - theta;
+			double angle_down = acos(fmin(1, fmax(-1, -(double)light->direction[k]))) - theta;
+			reach_up = (angle_up <= 0) ? radius : (angle_up < M_PI / 2 ? radius * cos(angle_up) : 0);
+			reach_down = (angle_down <= 0) ? radius : (angle_down < M_PI / 2 ? radius * cos(angle_down) : 0);
+			if(k == 1)
+				reach_up = reach_down = fmax(reach_up, reach_down);
+		}
+		
+		double center = light->position[k];
+		double pad = BOUNDS_PAD * (fabs(center) + 1);
+		min[k] = center - reach_down * (1 + BOUNDS_PAD) - pad;
+		max[k] = center + reach_up * (1 + BOUNDS_PAD) + pad;
+	}
+}
+
+// does diffuse color calculations and returns value accordingly
+void diffuse_calculation(real n[3], real l[3], real il[3], real kd[3], real* output)
+{
+	real n_l = (n[0] * l[0]) + (n[1] * l[1]) + (n[2] * l[2]);
+	// ambient constant would go here in the future
+    if (n_l > 0) 
+	{
+        output[0] = (kd[0] * il[0]) * n_l;
+        output[1] = (kd[1] * il[1]) * n_l;
+        output[2] = (kd[2] * il[2]) * n_l;
+    }
+    else 
+	{
+        output[0] = 0;
+        output[1] = 0;
+        output[2] = 0;
+    }
+}
+
+// does specular color calculations and returns value accordingly
+void specular_calculation(real n[3], real l[3], real il[3], real ks[3], real v[3], real r[3], real ns, real* output)
+{
+    real n_l = (n[0] * l[0]) + (n[1] * l[1]) + (n[2] * l[2]);
+	real v_r = (v[0] * r[0]) + (v[1] * r[1]) + (v[2] * r[2]);
+	
+    if (n_l > 0 && v_r > 0) 
+	{
+        real vr_ns_power = pow(v_r, ns);
+        output[0] = (ks[0] * il[0]) * vr_ns_power;
+        output[1] = (ks[1] * il[1]) * vr_ns_power;
+        output[2] = (ks[2] * il[2]) * vr_ns_power;
+    }
+    else 
+	{
+        output[0] = 0;
+        output[1] = 0;
+        output[2] = 0;
+    }
+}
+
+// does specular color calculations like specular_calculation() for a whole number exponent, raising with ipow() instead of pow()
+void specular_calculation_int(real n[3], real l[3], real il[3], real ks[3], real v[3], real r[3], int ns, real* output)
+{
+    real n_l = (n[0] * l[0]) + (n[1] * l[1]) + (n[2] * l[2]);
+	real v_r = (v[0] * r[0]) + (v[1] * r[1]) + (v[2] * r[2]);
+	
+    if (n_l > 0 && v_r > 0) 
+	{
+        real vr_ns_power = ipow(v_r, ns);
+        output[0] = (ks[0] * il[0]) * vr_ns_power;
+        output[1] = (ks[1] * il[1]) * vr_ns_power;
+        output[2] = (ks[2] * il[2]) * vr_ns_power;
+    }
+    else 
+	{
+        output[0] = 0;
+        output[1] = 0;
+        output[2] = 0;
+    }
+}
+
+// raises base to a non-negative whole number power by repeated squaring, a handful of multiplies for the exponents shininess and angular-a0 usually take instead of a pow() call
+real ipow(real base, int exponent)
+{
+	real result = 1;
+	while(exponent > 0)
+	{
+		if(exponent & 1)
+			result *= base;
+		base *= base;
+		exponent >>= 1;
+	}
+	return result;
+}
+
+
+// body of direct_shade() for one material class, which is always inlined into it with a constant shading so every class gets a copy of its own: a SHADE_DIFFUSE material (whose
+// specular color is 0, so its specular term always is as well) skips the reflected light vector and the specular term altogether, while the others raise theirs with ipow() or pow()
+static inline __attribute__((always_inline)) void direct_shade_kernel(real Ron[3], real Rdn[3], real Rd[3], real distance_to_light, surface* sf, material* m, render_light* light, real* color, const int shading)
+{
+	// initializes necessary n, l, r, v, and nv vectors as well as diffuse and specular vectors
+	real n[3]; 
+	real l[3];
+	real r[3]; // reflection of l
+	real v[3];
+	real diffuse[3] = {0, 0, 0};
+	real specular[3] = {0, 0, 0};
+	real object_direction[3];
+	
+	if(sf->kind == 1) // determine some necessary variables according to sphere fields
+	{									
+		n[0] = Ron[0] - sf->position[0];
+		n[1] = Ron[1] - sf->position[1]; // sets normal to the Ron vector minus the closest object's (sphere in this case) position
+		n[2] = Ron[2] - sf->position[2];
+	}
+	
+	if(sf->kind == 2) // determine some necessary variables according to plane fields
+	{									
+		n[0] = sf->normal[0];
+		n[1] = sf->normal[1]; // sets normal to the closets object's (plane in this case) normal
+		n[2] = sf->normal[2];
+		
+		Rdn[1] *= -1; // inverts y-coordinate of Rdn to display properly
+	}
+	
+	normalize(n);
+	
+	l[0] = Rdn[0];
+	l[1] = Rdn[1]; // sets l vector to the Rdn vector
+	l[2] = Rdn[2];
+	
+	normalize(l);
+	
+	v[0] = Rd[0];
+	v[1] = Rd[1]; // sets v vector to the Rd vector
+	v[2] = Rd[2];
+	 
+	// passes in corresponding variables for diffuse and specular calculators, using the diffuse/specular vectors as output
+	diffuse_calculation(n, l, light->color, m->diffuse_color, diffuse);
+	if(shading != SHADE_DIFFUSE)
+	{
+		// calculating reflection variable: l reflected about the normal, exactly as reflect_vector() would (it works out the same normalized normal again)
+		real temp_scalar = 2 * ((n[0]*l[0]) + (n[1]*l[1]) + (n[2]*l[2]));
+		r[0] = l[0] - n[0] * temp_scalar;
+		r[1] = l[1] - n[1] * temp_scalar;
+		r[2] = l[2] - n[2] * temp_scalar;
+		// end of calculating reflection variable
 		
+		if(shading == SHADE_WHOLE_POWER)
+			specular_calculation_int(n, l, light->color, m->specular_color, v, r, m->power, specular);
+		else
+			specular_calculation(n, l, light->color, m->specular_color, v, r, m->shininess, specular);
+	}
 		
-		else // after key was identified as width/height/radius/radial-a2/radial-a1/radial-a0/angular-a0/theta, object type is unknown so display an error
+	object_direction[0] = Rdn[0] * -1;
+	object_direction[1] = Rdn[1] * -1; 
+	object_direction[2] = Rdn[2] * -1;
+	
+	real fang_val = 0;
+	real frad_val = 0;
+	
+	if(light->kind_light == 2) // light is neither a point/spotlight, but rather a temporary light object intended to hold reflection/refraction values, so don't to any attenuation and just set fang_val and frad_val both to 1
+	{
+		fang_val = 1;
+		frad_val = 1;
+	}
+	
+	if(light->kind_light != 2) // light is either a point/spotlight, so do attenuation accordingly
+	{
+		fang_val = fang(light, object_direction);									
+		frad_val = frad(light, distance_to_light);
+	}
+	
+	color[0] += frad_val * fang_val * (diffuse[0] + specular[0]); 
+	color[1] += frad_val * fang_val * (diffuse[1] + specular[1]); 
+	color[2] += frad_val * fang_val * (diffuse[2] + specular[2]); 
+}
+
+// uses the light to compute the diffuse/specular/frad/fang shading of the hit and adds it to the given color, through the kernel of the hit's material class
+void direct_shade(real Ron[3], real Rdn[3], real Rd[3], real distance_to_light, int best_i, render_light* light, real* color)
+{
+	material* m = hit_material(best_i); // diffuse/specular colors of the closest object
+	surface scratch;
+	surface* sf = hit_surface(best_i, &scratch);
+	
+	if(m->shading == SHADE_DIFFUSE)
+		direct_shade_kernel(Ron, Rdn, Rd, distance_to_light, sf, m, light, color, SHADE_DIFFUSE);
+	else if(m->shading == SHADE_WHOLE_POWER)
+		direct_shade_kernel(Ron, Rdn, Rd, distance_to_light, sf, m, light, color, SHADE_WHOLE_POWER);
+	else
+		direct_shade_kernel(Ron, Rdn, Rd, distance_to_light, sf, m, light, color, SHADE_POWER);
+}
+
+
+// sets up secondary ray b (0 = reflection, 1 = refraction) of the hit the given ray found at Ron: it starts slightly offset from Ron along its own (normalized) direction
+void bounce_ray(path_ray* ray, real Ron[3], int b, real* Ro_bounce, real* Rd_bounce)
+{
+	real bounce_vector[3] = {0, 0, 0};
+	if(b == 0)
+		reflect_vector(ray->Rd, Ron, ray->index, bounce_vector);
+	else
+		refract_vector(ray->Rd, Ron, ray->ior, ray->index, bounce_vector);
+	
+	for(int k = 0; k < 3; k+=1)
+	{
+		Ro_bounce[k] = Ron[k] + bounce_vector[k] * (real).01;
+		Rd_bounce[k] = bounce_vector[k];
+	}
+	normalize(Rd_bounce);
+}
+
+// master function which shades a primary hit along with its whole tree of reflected/refracted rays. Instead of recursing, every pending secondary ray is kept on the given (per-thread) stack together with its throughput weight, i.e. how much of
+// its color ends up in the pixel; since direct_shade() is linear in the color of a reflection/refraction "light", a child's weight is just its parent's weight times what direct_shade() would have scaled its color by
+void shade(render_worker* worker, real Ro[3], real Rd[3], real best_t, int best_i, real* color)
+{
+	path_ray* stack = worker->stack;
+	render_light* lights = active_scene->lights;
+	
+	int stack_size = 0;
+	
+	// block of code which pushes the primary hit with a weight of 1
+	path_ray* root = &stack[stack_size++];
+	for(int k = 0; k < 3; k+=1)
+	{
+		root->Ro[k] = Ro[k];
+		root->Rd[k] = Rd[k];
+		root->weight[k] = 1;
+	}
+	root->t = best_t;
+	root->index = best_i;
+	root->ior = 1;
+	root->depth = 0;
+	// end of pushing primary hit
+	
+	while(stack_size > 0)
+	{
+		path_ray ray = stack[--stack_size]; // copied out since pushing children reuses its slot
+		STAT(worker->stats.shaded++);
+		STAT(worker->stats.depth_sum += ray.depth);
+		STAT(if(ray.depth > worker->stats.depth_max) worker->stats.depth_max = ray.depth);
+		real local_color[3] = {0, 0, 0}; // color of this hit before it's scaled by the ray's weight
+		
+		real Ron[3] = {0, 0, 0}; // Initializes new origin ray to the assumed 0, 0, 0 position
+		real Rdn[3] = {0, 0, 0}; // Initializes new direction of ray to 0, 0, 0 which will be changed
+		
+		Ron[0] = (ray.t * ray.Rd[0]) + ray.Ro[0];
+		Ron[1] = (ray.t * ray.Rd[1]) + ray.Ro[1]; // sets Ron using previously calculated object intersection
+		Ron[2] = (ray.t * ray.Rd[2]) + ray.Ro[2];
+		
+		normalize(ray.Rd);
+		
+		// the two secondary rays are only set up (see bounce_ray()) once they're about to be shot, so e.g. a material that doesn't refract only pays for its refraction vector
+		// when the reflection ray finds nothing and the refraction ray has to be checked as well
+		real Ro_bounce[2][3]; // [0] = reflection, [1] = refraction
+		real Rd_bounce[2][3];
+		int bounce_ready[2] = {0, 0};
+		
+		material* m = hit_material(ray.index);
+		real bounce_scale[2] = {m->reflectivity, m->refractivity};
+		
+		// block of code which decides which of the two secondary rays can still contribute. direct_shade() never scales a reflection/refraction "light" by more than
+		// its color times (diffuse + specular), so a ray whose weight is already bounded below min_weight (e.g. every refraction ray of an object with refractivity 0) is dead
+		real max_weight = ray.weight[0];
+		if(ray.weight[1] > max_weight) max_weight = ray.weight[1];
+		if(ray.weight[2] > max_weight) max_weight = ray.weight[2];
+		real max_factor = 0;
+		for(int k = 0; k < 3; k+=1)
 		{
-			fprintf(stderr, "Error: Only cameras should have width/height, spheres have radius, spheres and planes have reflectivity/refractivity/ior, and lights have radial-a2/radial-a1/radial-a0/angular-a0/theta. Violation found on line number %d.\n", line);
-            exit(1);
+			real f = fabs(m->diffuse_color[k]) + fabs(m->specular_color[k]);
+			if(f > max_factor) max_factor = f;
 		}
 		
-	  } 
-	  else if ((strcmp(key, "color") == 0) ||
-		     (strcmp(key, "diffuse_color") == 0) ||
-		     (strcmp(key, "specular_color") == 0) ||
-		     (strcmp(key, "position") == 0) || // evaluates if field is either a color/diffuse_color/specular_color/position/normal/direction
-		     (strcmp(key, "normal") == 0) ||
-			 (strcmp(key, "direction") == 0))
-	  { 
-	    double* value = next_vector(json);
-		if(strcmp(key, "color") == 0 && objects[i]->kind == 3) // evaluates only if key is color and current object is a light
+		int bounce_live[2];
+		for(int b = 0; b < 2; b+=1)
 		{
-			int j = 0; // iterator variable for error-checking
-			for(j = 0; j < 3; j+=1) // error checking for loop to make sure color values from object are less than 0
-			{
-				if(value[j] < 0) // assuming color value must be less than 0
-				{
-					fprintf(stderr, "Error: Light color values must not be less than 0. Violation found on line number %d.\n", line); // CHECK ERROR CHECKING ON THIS
-					exit(1);
-				}
-			}
-			objects[i]->light.color[0] = value[0];
-			objects[i]->light.color[1] = value[1]; // assigns color values from value vector to current object 
-			objects[i]->light.color[2] = value[2];
-			light_color_read++;
-			
+			real bound = max_weight * fabs(bounce_scale[b]) * max_factor;
+			bounce_live[b] = ray.depth + 1 <= max_depth && bound > 0 && bound >= min_weight;
+			STAT(if(bound > 0 && bound < min_weight) worker->stats.weight_cutoffs++);
+			STAT(if(bound > 0 && bound >= min_weight && ray.depth + 1 > max_depth) worker->stats.depth_cutoffs++);
 		}
-		else if((strcmp(key, "diffuse_color") == 0 && objects[i]->kind == 1) || (strcmp(key, "diffuse_color") == 0 && objects[i]->kind == 2)) // evaluates only if key is diffuse_color and current object is a sphere or plane
+		// end of deciding which secondary rays are live
+		
+		// shoot out the live reflection/refraction rays with the new ray origins and the reflection/refraction vectors as the new directions
+		real bounce_t[2] = {INFINITY, INFINITY};
+		int bounce_o[2] = {-1, -1};
+		for(int b = 0; b < 2; b+=1)
 		{
-			int j = 0; // iterator variable for error-checking
-			for(j = 0; j < 3; j+=1) // error checking for loop to make sure color values from object are between 0 and 1 (inclusive)
+			worker->rays.secondary += bounce_live[b];
+			if(bounce_live[b])
 			{
-				if(value[j] < 0 || value[j] > 1) // assuming color value must be between 0 and 1 (inclusive) due to example json file given along with corresponding ppm output file indicating so
-				{
-					fprintf(stderr, "Error: Sphere and Plane color values should be between 0 and 1 (inclusive). Violation found on line number %d.\n", line);
-					exit(1);
-				}
-			}
-			if(objects[i]->kind == 1)
-			{
-				objects[i]->sphere.diffuse_color[0] = value[0];
-				objects[i]->sphere.diffuse_color[1] = value[1]; // assigns color values from value vector to current object 
-				objects[i]->sphere.diffuse_color[2] = value[2];
-				sphere_diff_color_read++; // increments error checking variable for sphere color field being read
+				STAT(b == 0 ? worker->stats.reflection_rays++ : worker->stats.refraction_rays++);
+				bounce_ray(&ray, Ron, b, Ro_bounce[b], Rd_bounce[b]);
+				bounce_ready[b] = 1;
+				shoot(Ro_bounce[b], Rd_bounce[b], INFINITY, ray.index, &bounce_t[b], &bounce_o[b]);
 			}
-			else if(objects[i]->kind == 2)
+		}
+		int bounce_hit = bounce_o[0] != -1 || bounce_o[1] != -1;
+		
+		// the object's own color only shows up if one of its secondary rays hits something, so when no live ray did, the dead ones are still checked, but only with a cheaper any-hit query
+		for(int b = 0; b < 2 && !bounce_hit; b+=1)
+		{
+			if(!bounce_live[b])
 			{
-				objects[i]->plane.diffuse_color[0] = value[0];
-				objects[i]->plane.diffuse_color[1] = value[1]; // assigns color values from value vector to current object 
-				objects[i]->plane.diffuse_color[2] = value[2];
-				plane_diff_color_read++; // increments error checking variable for plane color field being read
+				worker->rays.secondary++;
+				STAT(worker->stats.hit_checks++);
+				if(!bounce_ready[b])
+					bounce_ray(&ray, Ron, b, Ro_bounce[b], Rd_bounce[b]);
+				bounce_hit = shoot_any(Ro_bounce[b], Rd_bounce[b], INFINITY, ray.index);
 			}
 		}
-		else if((strcmp(key, "specular_color") == 0 && objects[i]->kind == 1) || (strcmp(key, "specular_color") == 0 && objects[i]->kind == 2)) // evaluates only if key is diffuse_color and current object is a sphere or plane
+		
+		// checks if there was either a reflection or refraction "interesection" found
+		if(bounce_hit)
 		{
-			int j = 0; // iterator variable for error-checking
-			for(j = 0; j < 3; j+=1) // error checking for loop to make sure color values from object are between 0 and 1 (inclusive)
+			for(int b = 0; b < 2; b+=1)
 			{
-				if(value[j] < 0 || value[j] > 1) // assuming color value must be between 0 and 1 (inclusive) due to example json file given along with corresponding ppm output file indicating so
+				// checks to see if there was an intersection based on value of returned object index; won't ever be 0 since 0 is the camera's index (dead rays are never shot, so they're skipped here as well)
+				if(bounce_o[b] < 1)
+					continue;
+				
+				// the direction direct_shade() treats as pointing at the reflection/refraction "light": the hit point (the scaled direction) minus the new ray origin
+				real Rd_light[3];
+				Rd_light[0] = Rd_bounce[b][0] * bounce_t[b] - Ron[0];
+				Rd_light[1] = Rd_bounce[b][1] * bounce_t[b] - Ron[1]; 
+				Rd_light[2] = Rd_bounce[b][2] * bounce_t[b] - Ron[2];
+				normalize(Rd_light);
+				
+				// a stack allocated reflection/refraction "light" whose color is the reflectivity/refractivity, so direct_shade() returns the factor the child's color is scaled by
+				render_light bounce_light;
+				bounce_light.kind_light = 2; // a type of "flag" value to indicate that the light isn't a point/spotlight but rather a special "reflection/refraction light"
+				bounce_light.color[0] = bounce_scale[b];
+				bounce_light.color[1] = bounce_scale[b];
+				bounce_light.color[2] = bounce_scale[b];
+				
+				real factor[3] = {0, 0, 0};
+				direct_shade(Ron, Rd_light, ray.Rd, -1, ray.index, &bounce_light, factor); // pass in -1 as distance_to_light because it won't be used since this is a reflection/refraction
+				
+				real weight[3];
+				weight[0] = ray.weight[0] * factor[0];
+				weight[1] = ray.weight[1] * factor[1];
+				weight[2] = ray.weight[2] * factor[2];
+				
+				// rays whose color would be scaled below min_weight (or to nothing at all) are dropped without being traced any further
+				if((weight[0] == 0 && weight[1] == 0 && weight[2] == 0) || (weight[0] < min_weight && weight[1] < min_weight && weight[2] < min_weight))
 				{
-					fprintf(stderr, "Error: Sphere and Plane color values should be between 0 and 1 (inclusive). Violation found on line number %d.\n", line);
-					exit(1);
+					STAT(if(weight[0] != 0 || weight[1] != 0 || weight[2] != 0) worker->stats.weight_cutoffs++);
+					continue;
+				}
+				
+				path_ray* child = &stack[stack_size++];
+				for(int k = 0; k < 3; k+=1)
+				{
+					child->Ro[k] = Ro_bounce[b][k];
+					child->Rd[k] = Rd_bounce[b][k];
+					child->weight[k] = weight[k];
 				}
+				child->t = bounce_t[b];
+				child->index = bounce_o[b];
+				child->ior = (int)hit_material(bounce_o[b])->ior; // index of refraction of the intersected object (passed on as an int, as it always has been)
+				child->depth = ray.depth + 1;
 			}
-			if(objects[i]->kind == 1)
+			
+			// adding existing color of the object to newly calculated color vector			
+			real color_diff = 1 - m->reflectivity - m->refractivity;
+			
+			local_color[0] += m->diffuse_color[0] * color_diff;
+			local_color[1] += m->diffuse_color[1] * color_diff;
+			local_color[2] += m->diffuse_color[2] * color_diff;
+		}
+		// otherwise there was neither a reflection/refraction "intersection" so the object's own color is left out (background)
+		
+		// only the lights whose bounds hold the point are visited, in index order (so the colors add up exactly as if every light was); each is then checked against its radius and
+		// spot cone before any shadow ray is spent on it. fang() is 0 outside the cone, so that check never changes the image, while the radius only culls under --light-cutoff
+		int near_count = light_candidates(active_scene, Ron, worker->near_mask, worker->near_lights);
+		STAT(worker->stats.lights_culled += active_scene->light_count - near_count);
+		surface scratch;
+		int on_plane = (hit_surface(ray.index, &scratch)->kind == 2);
+		
+		// --light-samples: when more lights reach the point than are sampled, every light is only weighed here (by its brightest channel, frad() at this distance and fang(),
+		// without a shadow ray) and the lights actually shaded are drawn below
+		int sampled = (light_samples > 0 && near_count > light_samples);
+		real total_weight = 0;
+		for(int c = 0; c < near_count; c+=1) // new for loop which iterates for every light near enough to the point
+		{							
+			int j = worker->near_lights[c];
+			if(sampled)
+				worker->light_weights[c] = total_weight; // culled lights add nothing to the running sum, so they can't be drawn
+			Rdn[0] = lights[j].position[0] - Ron[0];
+			Rdn[1] = lights[j].position[1] - Ron[1]; // sets Rdn using current light's position and the previously calculated Ron vector
+			Rdn[2] = lights[j].position[2] - Ron[2];
+			
+			real distance_to_light = sqrt(sqr(Rdn[0]) + sqr(Rdn[1]) + sqr(Rdn[2]));  // calculates the distance to the light using the Rdn vector
+			if(distance_to_light > active_scene->light_radius[j])
 			{
-				objects[i]->sphere.specular_color[0] = value[0];
-				objects[i]->sphere.specular_color[1] = value[1]; // assigns color values from value vector to current object 
-				objects[i]->sphere.specular_color[2] = value[2];
-				sphere_spec_color_read++; // increments error checking variable for sphere color field being read
+				STAT(worker->stats.lights_culled++);
+				continue;
 			}
-			else if(objects[i]->kind == 2)
+			if(sampled && lights[j].kind_light != 1)
 			{
-				objects[i]->plane.specular_color[0] = value[0];
-				objects[i]->plane.specular_color[1] = value[1]; // assigns color values from value vector to current object 
-				objects[i]->plane.specular_color[2] = value[2];
-				plane_spec_color_read++; // increments error checking variable for plane color field being read
+				total_weight += light_importance(&lights[j], distance_to_light, NULL); // point lights are weighed without their direction
+				worker->light_weights[c] = total_weight;
+				continue;
 			}
-		}
-		else if((strcmp(key, "position") == 0 && objects[i]->kind == 1) || ((strcmp(key, "position") == 0 && objects[i]->kind == 2)) || ((strcmp(key, "position") == 0 && objects[i]->kind == 3))) // evaluates only if key is position and current object is a sphere or plane or light
-		{
-			if(objects[i]->kind == 1)
+			normalize(Rdn);
+			
+			// the direction from the light to the point exactly as direct_shade() hands it to fang() (which flips y on planes)
+			real light_to_point[3] = {-Rdn[0], on_plane ? Rdn[1] : -Rdn[1], -Rdn[2]};
+			if(lights[j].kind_light == 1 && fang(&lights[j], light_to_point) == 0)
 			{
-				objects[i]->sphere.position[0] = value[0];
-				objects[i]->sphere.position[1] = -value[1]; // assigns position values from value vector to current sphere object 
-				objects[i]->sphere.position[2] = value[2];
-				sphere_position_read++; // increments error checking variable for sphere position field being read
+				STAT(worker->stats.lights_culled++);
+				continue;
 			}
-			else if(objects[i]->kind == 2)
+			if(sampled)
 			{
-				objects[i]->plane.position[0] = value[0];
-				objects[i]->plane.position[1] = value[1]; // assigns position values from value vector to current plane object 
-				objects[i]->plane.position[2] = value[2];
-				plane_position_read++; // increments error checking variable for plane position field being read
+				total_weight += light_importance(&lights[j], distance_to_light, light_to_point);
+				worker->light_weights[c] = total_weight;
+				continue;
+			}
+			worker->rays.shadow++;
+			
+			// shoots ray to check if there's a "shadow object" using Ron and Rdn vector as well as the previously calculated distance_to_light value as the max distance for the ray
+			if(!occluded(Ron, Rdn, distance_to_light, ray.index, &worker->occluders[j])) // no shadow object was found between the point and the light
+			{ 						
+				// since no shadow was found, direct_shade is called to color the point accordingly
+				direct_shade(Ron, Rdn, ray.Rd, distance_to_light, ray.index, &lights[j], local_color);
 			}
-			else if(objects[i]->kind == 3)
+			// otherwise shadow was found so the light adds nothing
+		}
+		
+		// draws light_samples lights (with replacement) with a chance proportional to their importance, by binary searching the running sum for the first light past a random
+		// point of it, and scales each one's contribution by the inverse of its chance of being drawn times the number of draws. On average the point so gets exactly what
+		// shading every light would have given it, for at most light_samples shadow rays
+		for(int s = 0; sampled && total_weight > 0 && isfinite(total_weight) && s < light_samples; s+=1)
+		{
+			real u = next_random(worker) * total_weight;
+			int low = 0;
+			int high = near_count - 1;
+			while(low < high)
 			{
-				objects[i]->light.position[0] = value[0];
-				objects[i]->light.position[1] = -value[1]; // assigns position values from value vector to current light object 
-				objects[i]->light.position[2] = value[2];
-				light_position_read++; // increments error checking variable for light position field being read
+				int mid = (low + high) / 2;
+				if(worker->light_weights[mid] > u)
+					high = mid;
+				else
+					low = mid + 1;
 			}
-			else // Evaluates if there is a mismatched object field with sphere/plane/light and position, but should never happen
+			
+			int j = worker->near_lights[low];
+			Rdn[0] = lights[j].position[0] - Ron[0];
+			Rdn[1] = lights[j].position[1] - Ron[1];
+			Rdn[2] = lights[j].position[2] - Ron[2];
+			real distance_to_light = sqrt(sqr(Rdn[0]) + sqr(Rdn[1]) + sqr(Rdn[2]));
+			normalize(Rdn);
+			real light_to_point[3] = {-Rdn[0], on_plane ? Rdn[1] : -Rdn[1], -Rdn[2]};
+			real weight = light_importance(&lights[j], distance_to_light, light_to_point); // worked out again rather than from the running sum, which rounding has blurred
+			if(!(weight > 0))
+				continue; // only reachable when rounding lands u exactly on the sum's end
+			worker->rays.shadow++;
+			
+			if(!occluded(Ron, Rdn, distance_to_light, ray.index, &worker->occluders[j]))
 			{
-				fprintf(stderr, "Error: Mismatched object field \"%s\", on line %d.\n", key, line);
-				exit(1);
+				real light_color[3] = {0, 0, 0};
+				direct_shade(Ron, Rdn, ray.Rd, distance_to_light, ray.index, &lights[j], light_color);
+				real scale = total_weight / (light_samples * weight);
+				local_color[0] += light_color[0] * scale;
+				local_color[1] += light_color[1] * scale;
+				local_color[2] += light_color[2] * scale;
 			}
 		}
-		else if(strcmp(key, "direction") == 0 && objects[i]->kind == 3) // evaluates only if key is direction and current object is a light
+		
+		color[0] += ray.weight[0] * local_color[0];
+		color[1] += ray.weight[1] * local_color[1];
+		color[2] += ray.weight[2] * local_color[2];
+	}
+}
+
+// encapsulates functionality for shooting a ray out into the scene and indirectly returning a distance to the intersected object as well as an index
+void shoot(real Ro[3], real Rd[3], real distance, int current_index, real* final_distance, int* final_index)
+{
+	real best_t = INFINITY;
+	int best_i = -1;
+	bvh_traverse(Ro, Rd, distance, current_index, 0, &best_t, &best_i);
+	*final_distance = best_t; // returns distance to object through pointer 
+	*final_index = best_i; // returns intersected object index through pointer
+}
+
+// shoots a ray out into the scene and returns 1 as soon as anything is hit within distance, without looking for the closest hit
+int shoot_any(real Ro[3], real Rd[3], real distance, int current_index)
+{
+	real best_t = INFINITY;
+	int best_i = -1;
+	return bvh_traverse(Ro, Rd, distance, current_index, 1, &best_t, &best_i);
+}
+
+// shadow ray query: neighbouring pixels tend to be shadowed by the same object, so the object which last blocked this light (on this thread) is tested on its own first and
+// only if it doesn't block the ray is the whole scene searched for any blocker. Only spheres and planes are in the compiled scene, so cameras/lights are never tested at all
+int occluded(real Ro[3], real Rd[3], real distance, int current_index, int* last_occluder)
+{
+	int i = *last_occluder;
+	if(i >= 0 && i != current_index)
+	{
+		surface scratch;
+		surface* sf = hit_surface(i, &scratch);
+		real t;
+		if(i >= active_scene->object_count) // a sphere of an instance is tested in its group's space (where its slot points), exactly like instance_traverse() tests it
+		{
+			render_instance* instance = hit_instance(i);
+			render_scene* group = &active_scene->groups[instance->group];
+			int slot = sf->slot;
+			real Ro_local[3];
+			for(int c = 0; c < 3; c+=1)
+				Ro_local[c] = (Ro[c] - instance->position[c]) * instance->inv_scale;
+			ray_info ray;
+			setup_ray(Ro_local, Rd, &ray);
+			t = sphere_hit(&ray, group->sphere_cx[slot], group->sphere_cy[slot], group->sphere_cz[slot], group->sphere_cc[slot]) * instance->scale;
+		}
+		else if(sf->kind == 1)
 		{
-			objects[i]->light.direction[0] = value[0];
-			objects[i]->light.direction[1] = -value[1]; // assigns direction values from value vector to current light object 
-			objects[i]->light.direction[2] = value[2];
-			light_direction_read++; // increments error checking variable for light direction field being read
+			ray_info ray;
+			setup_ray(Ro, Rd, &ray);
+			t = sphere_hit(&ray, active_scene->sphere_cx[sf->slot], active_scene->sphere_cy[sf->slot], active_scene->sphere_cz[sf->slot], active_scene->sphere_cc[sf->slot]);
 		}
-		else if(strcmp(key, "normal") == 0 && objects[i]->kind == 2) // evaluates only if key is normal and current object is a plane
+		else
 		{
-			objects[i]->plane.normal[0] = value[0];
-			objects[i]->plane.normal[1] = value[1]; // assigns normal values from value vector to current plane object 
-			objects[i]->plane.normal[2] = value[2];
-			plane_normal_read++; // increments error checking variable for plane normal field being read
+			t = plane_hit(Ro, Rd, active_scene->plane_px[sf->slot], active_scene->plane_py[sf->slot], active_scene->plane_pz[sf->slot],
+							active_scene->plane_nx[sf->slot], active_scene->plane_ny[sf->slot], active_scene->plane_nz[sf->slot]);
 		}
-		else // after key was identified as color/diffuse_color/specular_color/position/direction/normal, object type is unknown so display an error
+		STAT(sf->kind == 1 ? thread_stats->sphere_tests++ : thread_stats->plane_tests++);
+		if(t > 0 && (t <= distance || distance == INFINITY)) // same test bvh_traverse() applies, so the answer never depends on the cache
 		{
-			fprintf(stderr, "Error: Only spheres/planes/lights have positions, spheres and planes have specular/diffuse colors, lights have colors and direction, and only planes have a normal. Violation found on line number %d.\n", line);
-            exit(1);
+			STAT(thread_stats->occluder_hits++);
+			return 1;
 		}
-	  } 
-	  else // unknown field was read in so display an error
-	  { 
-	    fprintf(stderr, "Error: Unknown property, \"%s\", on line %d.\n", key, line);
-		exit(1);
-	  }
-	  skip_ws(json);
-	  } 
-	  else  // expecting either a new field or the end of an object so display an error
-	  {
-		fprintf(stderr, "Error: Unexpected value on line %d. Expected either ',' or '}' to indicate next field or end of object.\n", line);
-		exit(1);
-	  }
-     }
-      skip_ws(json);
-      c = next_c(json);
-      if (c == ',') // Should be followed by another object
-	  { 
-		// noop
-		skip_ws(json);
-      } 
-	  else if (c == ']')  // reached end of json file
-	  {
-			objects[i] = NULL; // null-terminate after last object
-			fclose(json);
-			return;
-      } 
-	  else // finished parsing an object and a comma or hard bracket was expect to indicate a new object/end of object list, so display error
-	  {
-			fprintf(stderr, "Error: Expecting ',' or ']' on line %d.\n", line);
-			exit(1);
-      }
-    }
-    else // didn't find end of file or the beginning of an object
+	}
+	
+	real best_t = INFINITY;
+	int best_i = -1;
+	if(bvh_traverse(Ro, Rd, distance, current_index, 1, &best_t, &best_i))
 	{
-		fprintf(stderr, "Error: Expecting '{' or ']' on line %d.\n", line);
-		exit(1);
+		*last_occluder = best_i;
+		return 1;
+	}
+	return 0;
+}
+
+// walks the bounding volume hierarchy, then the instances and finally the planes, keeping the closest hit in best_t/best_i (ties go to the lower hit index, like a linear scan over objects would); returns 1 if anything was hit
+int bvh_traverse(real Ro[3], real Rd[3], real distance, int current_index, int any_hit, real* best_t, int* best_i)
+{
+	STAT(thread_stats->traversals++);
+	render_scene* rs = active_scene;
+	ray_info ray;
+	setup_ray(Ro, Rd, &ray);
+	
+	real inv_Rd[3];
+	inv_Rd[0] = 1 / Rd[0];
+	inv_Rd[1] = 1 / Rd[1]; // reciprocal direction used by the slab tests (infinite along axes the ray doesn't move in)
+	inv_Rd[2] = 1 / Rd[2];
+	
+	if(sphere_bvh_walk(&ray, inv_Rd, distance, current_index, any_hit, 1, 0, best_t, best_i))
+		return 1;
+	
+	if(rs->instance_count > 0 && instance_traverse(Ro, Rd, inv_Rd, distance, current_index, any_hit, best_t, best_i))
+		return 1;
+	
+	for(int p = 0; p < rs->plane_count; p+=1)
+	{
+		int i = rs->plane_id[p];
+		if(current_index == i)
+			continue;
+		
+		STAT(thread_stats->plane_tests++);
+		real t = plane_hit(Ro, Rd, rs->plane_px[p], rs->plane_py[p], rs->plane_pz[p],
+								rs->plane_nx[p], rs->plane_ny[p], rs->plane_nz[p]);
+		if(t > distance && distance != INFINITY) // makes sure intersection isn't beyond where we want to project
+			continue;
+		if(t > 0 && (t < *best_t || (t == *best_t && i < *best_i)))
+		{
+			*best_t = t;
+			*best_i = i;
+			if(any_hit)
+				return 1;
+		}
 	}
-  }
+	
+	return *best_i != -1;
 }
 
-// function which handles raycasting for objects read in from json file
-void raycasting() 
+// walks the sphere hierarchy of the ray's scene looking for hits closer than best_t/best_i. The ray may have been moved into the space of a group, scaled down by scale, so the distances
+// found are multiplied by scale before they're compared with (world space) best_t and distance, and a sphere's hit index is id_base plus its sphere_id; returns 1 only when any_hit is set
+// and something was hit
+int sphere_bvh_walk(ray_info* ray, real inv_Rd[3], real distance, int current_index, int any_hit, real scale, int id_base, real* best_t, int* best_i)
 {
-		image_data current_pixel; // temp image_data struct which will hold RGB pixels
-		image_data* temp_ptr = image_buffer; // temp ptr to image_data struct which will be used to navigate through global buffer
-		current_pixel.r = 0;
-		current_pixel.g = 0; // initializes current pixel RGB values to 0 (black)
-		current_pixel.b = 0;
+	render_scene* rs = ray->scene;
+	real t_batch[KERNEL_BATCH]; // distances returned by the sphere kernel for the current run of spheres
 	
+	int stack[BVH_MAX_DEPTH + 4];
+	int stack_size = 0;
+	
+	if(rs->node_count > 0)
+		stack[stack_size++] = 0;
+	
+	while(stack_size > 0)
+	{
+		bvh_node* node = &rs->nodes[stack[--stack_size]];
 		
-		// block of code to create/facilitate a new Object array which will store only light objects for later use
-		Object** lights;
-		lights = malloc(sizeof(Object) * 129);
-		int light_counter = 0;
+		// nodes entered beyond the closest hit so far (or beyond the max distance) can't hold a better hit
+		real t_limit = *best_t;
+		if(distance != INFINITY && distance < t_limit)
+			t_limit = distance;
+		STAT(thread_stats->box_tests++);
+		if(!ray_box(ray->o, inv_Rd, node->min, node->max, t_limit / scale))
+			continue;
 		
-		for(int l = 0; objects[l] != 0; l+=1)
+		if(node->count == 0) // inner node so visit both children
 		{
-			if(objects[l]->kind == 3)
-			{
-				lights[light_counter++] = objects[l];
-			}
+			stack[stack_size++] = node->offset;
+			stack[stack_size++] = (int)(node - rs->nodes) + 1;
+			continue;
 		}
-		lights[light_counter] = NULL;
-		// end of block of code for creating/filling new lights array
-		
 		
-		// sets cx and cy values of camera (assumed to be at 0, 0)
-		double cx = 0;
-		double cy = 0;
-		
-		// sets width and height of image based on given width/height from command line that was previously stored in the global header buffer
-		int M = atoi(header_buffer->file_height); 
-		int N = atoi(header_buffer->file_width); 
-		
-		// sets pixheight and pixwidth using M and N declared above as well as camera height/width stored in global variables glob_height/glob_width during json parsing 
-		double pixheight = glob_height / M;
-		double pixwidth = glob_width / N;
-				
-		double Ro[3] = {0, 0, 0}; // Initializes origin ray to the assumed 0, 0, 0 position
-		double Rd[3] = {0, 0, 0}; // Initializes direction of ray to 0, 0, 0 which will be changed
-		double ray[3] = {0, 0, 1}; // Initializes temporary ray with 0, 0 for the x and y values and 1 for the assumed z value position
-		
-		for (int y = 0; y < M; y += 1) {
-			ray[1] = (cy - (glob_height/2) + pixheight * (y + 0.5)); // calculates y-position of ray and stores accordingly
-			for (int x = 0; x < N; x += 1) {
-				ray[0] = cx - (glob_width/2) + pixwidth * (x + 0.5); // calculates x-position of ray and stores accordingly
-				// stores the calculated ray values along with the assumed z value of 1 into the Rd vector
-				Rd[0] = ray[0];
-				Rd[1] = ray[1];
-				Rd[2] = ray[2];
-				normalize(Rd); // normalizes the Rd vector
-				
-				double color[3] = {0, 0, 0};
-
-				double best_t;
-				int best_i;
-				shoot(Ro, Rd, INFINITY, -1, &best_t, &best_i); 
-				//double t = 0;
-					
-					
-				if (best_t > 0 && best_t != INFINITY && best_i != -1) { 
-					//double test[3] = {0, 0, 0};
-					//test[0] = (Rd[0] * best_t) + Ro[0];
-					//test[1] = (Rd[1] * best_t) + Ro[1];
-					//test[2] = (Rd[2] * best_t) + Ro[2];
-					//printf("Color values before shade are [%lf %lf %lf]\n", color[0], color[1], color[2]);
-					shade(Ro, Rd, best_t, best_i, lights, 1, 0, color);
-					//shade(test, Rd, best_t, best_i, lights, 0, color);
-					//printf("Color values after shade are [%lf %lf %lf]\n", color[0], color[1], color[2]);
-					
-					current_pixel.r = (unsigned char)(255 * clamp(color[0]));
-					current_pixel.g = (unsigned char)(255 * clamp(color[1])); // sets current pixel's color values based on calculated colors in color vector (clamped)
-					current_pixel.b = (unsigned char)(255 * clamp(color[2]));
-					*temp_ptr = current_pixel; // sets current image_data struct in temp_ptr to current_pixel colored from object 
-					temp_ptr++; // increments temp_ptr to point to next image_data struct in global buffer
-					
-					current_pixel.r = 0;
-					current_pixel.g = 0; // resets current pixel RGB values to 0 after coloring current pixel
-					current_pixel.b = 0;
-				}
-				else { // no dominant intersection found at current point so pixel is to be colored black
-					current_pixel.r = 0;
-					current_pixel.g = 0; // should all be 0 
-					current_pixel.b = 0;		
-					*temp_ptr = current_pixel;  // sets current image_data struct in temp_ptr to current_pixel colored from object 
-					temp_ptr++; // increments temp_ptr to point to next image_data struct in global buffer
+		for(int p = node->offset; p < node->offset + node->count; p+=KERNEL_BATCH)
+		{
+			int n = node->offset + node->count - p;
+			if(n > KERNEL_BATCH)
+				n = KERNEL_BATCH;
+			sphere_kernel(ray, p, n, t_batch); // intersects the whole run of packed spheres at once
+			STAT(thread_stats->sphere_tests += n);
+			
+			for(int j = 0; j < n; j+=1)
+			{
+				int i = id_base + rs->sphere_id[p + j];
+				real t = t_batch[j] * scale;
+				if(current_index == i)
+					continue;
+				if(t > distance && distance != INFINITY) // makes sure intersection isn't beyond where we want to project
+					continue;
+				if(t > 0 && (t < *best_t || (t == *best_t && i < *best_i)))
+				{
+					*best_t = t;
+					*best_i = i;
+					if(any_hit)
+						return 1;
 				}
 			}
-		}	
-		return;
-}	
-
-// write_image_data function takes in the output_file_name to know where to write out to
-void write_image_data(char* output_file_name)
-{
-	FILE *fp;
-	
-	fp = fopen(output_file_name, "a"); // opens file to be appended to (file will be created if one does not exist)
-	
-	if(fp == NULL) 
-	{
-		fprintf(stderr, "Error: Output file couldn't be created/modified.\n");
-		exit(1); // exits out of program due to error
+		}
 	}
 	
-	// block of code which writes header information into the output file along with whitespaces accordingly
-	fprintf(fp, header_buffer->file_format); 
-	fprintf(fp, "%s", "\n");
-	fprintf(fp, header_buffer->file_width);
-	fprintf(fp, "%s", " ");
-	fprintf(fp, header_buffer->file_height);
-	fprintf(fp, "%s", "\n");
-	fprintf(fp, header_buffer->file_maxcolor);
-	fprintf(fp, "%s", "\n");
-	
-	// Writing of P6 data (as recommended by professor) starts here
-	fclose(fp); // closes file after writing header information since P6 requires writing bytes
-	fopen(output_file_name, "ab"); // opens file to be appended to in byte mode
-	int i = 0; // initializes iterator variable
-	image_data* temp_ptr = image_buffer; // temp ptr to image_data struct which will be used to navigate through stored pixels in the global buffer
-		
-	// while loop which iterates for every pixel in the file using width * height
-	while(i != atoi(header_buffer->file_width) * atoi(header_buffer->file_height))
-	{
-		fwrite(&(*temp_ptr).r, sizeof(unsigned char), 1, fp); // writes the current pixels "r" value of an "unsigned char" byte to the file
-		fwrite(&(*temp_ptr).g, sizeof(unsigned char), 1, fp); // writes the current pixels "g" value of an "unsigned char" byte to the file
-		fwrite(&(*temp_ptr).b, sizeof(unsigned char), 1, fp); // writes the current pixels "b" value of an "unsigned char" byte to the file
-				
-		temp_ptr++; // increments temp_ptr to point to next image_data struct in global buffer
-		i++;  // increments iterator variable
-	}
-		
-	fclose(fp);
+	return 0;
 }
 
-// function which takes in an origin ray, direction of the ray, position of the sphere object, and radius of the sphere object and determines if there's an intersection at the current point
-double sphere_intersection(double* Ro, double* Rd, double* C, double r)
+// walks the top level of the two level hierarchy: every instance whose bounds the ray enters before the closest hit so far gets the ray moved into its group's space, where the group's
+// own hierarchy is walked by sphere_bvh_walk(). The direction is unchanged (instances are only moved and scaled), so neither is its reciprocal; returns 1 only when any_hit is set and something was hit
+int instance_traverse(real Ro[3], real Rd[3], real inv_Rd[3], real distance, int current_index, int any_hit, real* best_t, int* best_i)
 {
-	double a = sqr(Rd[0]) + sqr(Rd[1]) + sqr(Rd[2]);
-	double b = (2 * (Ro[0] * Rd[0] - Rd[0] * C[0] + Ro[1] * Rd[1] - Rd[1] * C[1] + Ro[2] * Rd[2] - Rd[2] * C[2]));
-	double c = sqr(Ro[0]) - 2*Ro[0]*C[0] + sqr(C[0]) + sqr(Ro[1]) - 2*Ro[1]*C[1] + sqr(C[1]) + sqr(Ro[2]) - 2*Ro[2]*C[2] + sqr(C[2]) - sqr(r);
-		
-	double det = sqr(b) - 4 * a * c;
-	if(det < 0) return -1; // if determinant is negative then there's no sphere intersection so return -1
+	render_scene* rs = active_scene;
 	
-	det = sqrt(det);
+	int stack[BVH_MAX_DEPTH + 4];
+	int stack_size = 0;
 	
-	double t0 = (-b - det) / (2 * a);	
-	if(t0 > 0) return t0; // t0 indicates a sphere intersection so return it
-	double t1 = (-b + det) / (2 * a);
-	if(t1 > 0) return t1; // t1 indicates a sphere intersection so return it
+	if(rs->instance_node_count > 0)
+		stack[stack_size++] = 0;
 	
-	return -1; // didn't find a sphere intersection so return -1
-}
-
-// function which takes in an origin ray, direction of the ray, position of the plane object, and normal of the plane object and determines if there's an intersection at the current point
-double plane_intersection(double* Ro, double* Rd, double* C, double* N)
-{	
-	normalize(N);
-	double Vd = ((N[0] * Rd[0]) + (N[1] * Rd[1]) + (N[2] * Rd[2]));
-	if(Vd == 0) // parallel ray so no intersection
+	while(stack_size > 0)
 	{
-		return -1;
-	}
-	double Vo = -((N[0] * Ro[0]) + (N[1] * Ro[1]) + (N[2] * Ro[2])) + sqrt(sqr(C[0] - Ro[0]) + sqr(C[1] - Ro[1]) + sqr(C[2] - Ro[2]));
-
-	
-	double t = Vo/Vd;
+		bvh_node* node = &rs->instance_nodes[stack[--stack_size]];
 		
-	if(t > 0) // found plane intersection so return t
-	{
-		return t;
+		real t_limit = *best_t;
+		if(distance != INFINITY && distance < t_limit)
+			t_limit = distance;
+		STAT(thread_stats->box_tests++);
+		if(!ray_box(Ro, inv_Rd, node->min, node->max, t_limit))
+			continue;
+		
+		if(node->count == 0) // inner node so visit both children
+		{
+			stack[stack_size++] = node->offset;
+			stack[stack_size++] = (int)(node - rs->instance_nodes) + 1;
+			continue;
+		}
+		
+		for(int k = node->offset; k < node->offset + node->count; k+=1)
+		{
+			render_instance* instance = &rs->instances[k];
+			real Ro_local[3];
+			for(int c = 0; c < 3; c+=1)
+				Ro_local[c] = (Ro[c] - instance->position[c]) * instance->inv_scale;
+			
+			ray_info ray;
+			setup_ray(Ro_local, Rd, &ray);
+			ray.scene = &rs->groups[instance->group];
+			if(sphere_bvh_walk(&ray, inv_Rd, distance, current_index, any_hit, instance->scale, instance->first_id, best_t, best_i))
+				return 1;
+		}
 	}
 	
-	return -1; // didn't find a plane intersection so return -1
+	return 0;
 }
 
-// next_c() wraps the getc() function and provides error checking and line number maintenance
-int next_c(FILE* json) 
+// returns the instance which placed the sphere with the given hit index, which is past the active scene's own objects (see render_instance)
+render_instance* hit_instance(int index)
 {
-  int c = fgetc(json);
-#ifdef DEBUG
-  printf("next_c: '%c'\n", c);
-#endif
-  if (c == '\n') {
-    line += 1;
-  }
-  if (c == EOF) {
-    fprintf(stderr, "Error: Unexpected end of file on line number %d.\n", line);
-    exit(1);
-  }
-  return c;
+	render_scene* rs = active_scene;
+	int object = (index - rs->object_count) / rs->instance_stride;
+	return &rs->instances[rs->surfaces[object].slot];
 }
 
-// expect_c() checks that the next character is d.  If it is not it emits an error.
-void expect_c(FILE* json, int d) 
+// returns the material of the object with the given hit index, or of the sphere of an instance's group it stands for
+material* hit_material(int index)
 {
-  int c = next_c(json);
-  if (c == d) return;
-  fprintf(stderr, "Error: Expected '%c' on line %d.\n", d, line);
-  exit(1);    
+	render_scene* rs = active_scene;
+	if(index < rs->object_count)
+		return &rs->materials[rs->surfaces[index].material];
+	
+	render_instance* instance = hit_instance(index);
+	render_scene* group = &rs->groups[instance->group];
+	return &group->materials[group->surfaces[index - instance->first_id].material];
 }
 
-// skip_ws() skips white space in the file.
-void skip_ws(FILE* json) 
+// returns the surface of the object with the given hit index. An instanced sphere's surface is copied into scratch with its center moved and scaled into place, and scratch is returned
+// instead (its slot still indexes the group's packed arrays)
+surface* hit_surface(int index, surface* scratch)
 {
-  int c = next_c(json);
-  while (isspace(c)) {
-    c = next_c(json);
-  }
-  ungetc(c, json);
+	render_scene* rs = active_scene;
+	if(index < rs->object_count)
+		return &rs->surfaces[index];
+	
+	render_instance* instance = hit_instance(index);
+	*scratch = rs->groups[instance->group].surfaces[index - instance->first_id];
+	for(int k = 0; k < 3; k+=1)
+		scratch->position[k] = instance->position[k] + instance->scale * scratch->position[k];
+	return scratch;
 }
 
-// next_string() gets the next string from the file handle and emits an error if a string can not be obtained.
-char* next_string(FILE* json) 
+// slab test which checks whether the ray overlaps the box somewhere in [0, t_limit]
+int ray_box(real Ro[3], real inv_Rd[3], real* min, real* max, real t_limit)
 {
-  char buffer[129];
-  int c = next_c(json);
-  if (c != '"') {
-    fprintf(stderr, "Error: Expected string on line %d.\n", line);
-    exit(1);
-  }  
-  c = next_c(json);
-  int i = 0;
-  while (c != '"') {
-    if (i >= 128) {
-      fprintf(stderr, "Error: Strings longer than 128 characters in length are not supported.\n");
-      exit(1);      
-    }
-    if (c == '\\') {
-      fprintf(stderr, "Error: Strings with escape codes are not supported.\n");
-      exit(1);      
-    }
-    if (c < 32 || c > 126) {
-      fprintf(stderr, "Error: Strings may contain only ascii characters.\n");
-      exit(1);
-    }
-    buffer[i] = c;
-    i += 1;
-    c = next_c(json);
-  }
-  buffer[i] = 0;
-  return strdup(buffer);
+	real t_near = 0;
+	real t_far = t_limit;
+	
+	for(int k = 0; k < 3; k+=1)
+	{
+		real t0 = (min[k] - Ro[k]) * inv_Rd[k];
+		real t1 = (max[k] - Ro[k]) * inv_Rd[k];
+		if(t0 > t1)
+		{
+			real temp = t0;
+			t0 = t1;
+			t1 = temp;
+		}
+		// written so that a NaN (origin exactly on a slab of an axis the ray doesn't move in) leaves the interval alone
+		if(t0 > t_near)
+			t_near = t0;
+		if(t1 < t_far)
+			t_far = t1;
+	}
+	
+	return t_near <= t_far;
 }
 
-// function which reads next number from file, wrapped around error checking if nothing is read in
-double next_number(FILE* json) 
+// packs the spheres and planes into the structure-of-arrays compiled scene (plus the cold materials array) and builds the hierarchy over the spheres
+void compile_scene(render_scene* rs)
 {
-  double value;
-  if(fscanf(json, "%lf", &value) == 0) // error checking to make sure fscanf read in a number; will only evaluate if fscanf didn't read anything in and returned 0
-  {
-	  fprintf(stderr, "Error: Expected a number on line %d.\n", line);
-      exit(1);	
-  }
-  return value;
+	compile_groups(rs); // before the objects, whose instances refer to the groups
+	compile_objects(rs, objects, object_count);
+	
+	rs->camera_width = glob_width;
+	rs->camera_height = glob_height;
+	
+	build_instance_bvh(rs);
+	build_light_bvh(rs);
 }
 
-// function which reads next vector from file
-double* next_vector(FILE* json) 
+// packs the given list of objects into the render scene (which compile_scene() does for the scene's objects, and compile_groups() for the members of every group) and builds the
+// hierarchy over its spheres
+void compile_objects(render_scene* rs, Object* list, int count)
 {
-  double* v = malloc(3*sizeof(double));
-  expect_c(json, '[');
-  skip_ws(json);
-  v[0] = next_number(json);
-  skip_ws(json);
-  expect_c(json, ',');
-  skip_ws(json);
-  v[1] = next_number(json);
-  skip_ws(json);
-  expect_c(json, ',');
-  skip_ws(json);
-  v[2] = next_number(json);
-  skip_ws(json);
-  expect_c(json, ']');
-  return v;
+	rs->sphere_count = 0;
+	rs->plane_count = 0;
+	rs->light_count = 0;
+	rs->instance_count = 0;
+	for(int i = 0; i < count; i+=1)
+	{
+		if(list[i].kind == 1)
+			rs->sphere_count++;
+		if(list[i].kind == 2)
+			rs->plane_count++;
+		if(list[i].kind == 3)
+			rs->light_count++;
+		if(list[i].kind == 5)
+			rs->instance_count++;
+	}
+	
+	rs->sphere_cx = malloc(sizeof(real) * (rs->sphere_count + 1));
+	rs->sphere_cy = malloc(sizeof(real) * (rs->sphere_count + 1));
+	rs->sphere_cz = malloc(sizeof(real) * (rs->sphere_count + 1));
+	rs->sphere_r2 = malloc(sizeof(real) * (rs->sphere_count + 1));
+	rs->sphere_cc = malloc(sizeof(real) * (rs->sphere_count + 1));
+	rs->sphere_id = malloc(sizeof(int) * (rs->sphere_count + 1));
+	rs->plane_nx = malloc(sizeof(real) * (rs->plane_count + 1));
+	rs->plane_ny = malloc(sizeof(real) * (rs->plane_count + 1));
+	rs->plane_nz = malloc(sizeof(real) * (rs->plane_count + 1));
+	rs->plane_px = malloc(sizeof(real) * (rs->plane_count + 1));
+	rs->plane_py = malloc(sizeof(real) * (rs->plane_count + 1));
+	rs->plane_pz = malloc(sizeof(real) * (rs->plane_count + 1));
+	rs->plane_id = malloc(sizeof(int) * (rs->plane_count + 1));
+	rs->surfaces = calloc(count + 1, sizeof(surface));
+	rs->lights = malloc(sizeof(render_light) * (rs->light_count + 1));
+	rs->instances = malloc(sizeof(render_instance) * (rs->instance_count + 1));
+	
+	rs->object_count = count;
+	
+	// block of code which hands every sphere/plane/light/instance its slot in the packed arrays in object order (build_bvh() and build_instance_bvh() then move the spheres and
+	// instances into hierarchy order)
+	int s = 0; // iterator variable for spheres
+	int p = 0; // iterator variable for planes
+	int l = 0; // iterator variable for lights
+	int n = 0; // iterator variable for instances
+	for(int i = 0; i < count; i+=1)
+	{
+		surface* sf = &rs->surfaces[i];
+		sf->kind = list[i].kind;
+		if(list[i].kind == 1)
+			sf->slot = s++;
+		else if(list[i].kind == 2)
+			sf->slot = p++;
+		else if(list[i].kind == 3)
+			sf->slot = l++;
+		else if(list[i].kind == 5)
+			sf->slot = n++;
+		
+		compile_object(rs, list, i);
+	}
+	compile_materials(rs, list, count);
+	
+	build_bvh(rs);
 }
 
-// normalizes given vector
-void normalize(double* v) 
+// gathers one copy of each distinct material of the listed spheres/planes into the render scene's materials, which an open addressing hash table (keyed by the material's bytes)
+// finds the repeats of, and sets each surface's material index. The material class is worked out here once, so direct_shade() only has to switch on it
+void compile_materials(render_scene* rs, Object* list, int count)
 {
-  double len = sqrt(sqr(v[0]) + sqr(v[1]) + sqr(v[2]));
-  v[0] /= len;
-  v[1] /= len;
-  v[2] /= len;
+	rs->materials = malloc(sizeof(material) * (count + 1));
+	rs->material_count = 0;
+	int table_size = 16;
+	while(table_size < 2 * count)
+		table_size *= 2;
+	int* table = malloc(sizeof(int) * table_size);
+	for(int k = 0; k < table_size; k+=1)
+		table[k] = -1;
+	
+	for(int i = 0; i < count; i+=1)
+	{
+		if(list[i].kind != 1 && list[i].kind != 2)
+			continue;
+		
+		// the sphere and plane structs hold their shading fields under the same names
+		material m;
+		memset(&m, 0, sizeof(m));
+		if(list[i].kind == 1)
+		{
+			copy_vector(m.diffuse_color, list[i].sphere.diffuse_color);
+			copy_vector(m.specular_color, list[i].sphere.specular_color);
+			m.reflectivity = list[i].sphere.reflectivity;
+			m.refractivity = list[i].sphere.refractivity;
+			m.ior = list[i].sphere.ior;
+			m.shininess = list[i].sphere.shininess;
+		}
+		else
+		{
+			copy_vector(m.diffuse_color, list[i].plane.diffuse_color);
+			copy_vector(m.specular_color, list[i].plane.specular_color);
+			m.reflectivity = list[i].plane.reflectivity;
+			m.refractivity = list[i].plane.refractivity;
+			m.ior = list[i].plane.ior;
+			m.shininess = list[i].plane.shininess;
+		}
+		
+		if(m.specular_color[0] == 0 && m.specular_color[1] == 0 && m.specular_color[2] == 0)
+			m.shading = SHADE_DIFFUSE;
+		else if(m.shininess == floor(m.shininess) && m.shininess <= MAX_WHOLE_POWER)
+		{
+			m.shading = SHADE_WHOLE_POWER;
+			m.power = (int)m.shininess;
+		}
+		else
+			m.shading = SHADE_POWER;
+		
+		int k = hash_bytes((const char*)&m, sizeof(m)) & (table_size - 1);
+		while(table[k] != -1 && memcmp(&rs->materials[table[k]], &m, sizeof(m)) != 0)
+			k = (k + 1) & (table_size - 1);
+		if(table[k] == -1)
+		{
+			table[k] = rs->material_count;
+			rs->materials[rs->material_count++] = m;
+		}
+		rs->surfaces[i].material = table[k];
+	}
+	
+	free(table);
 }
 
-// squares given double
-double sqr(double v) 
+// compiles the members of every group of the scene into a render scene of the group's own, where each sphere's index is its place in the group. All of a group's instances share it
+void compile_groups(render_scene* rs)
 {
-  return v*v;
+	rs->group_count = scene_group_count;
+	rs->groups = calloc(scene_group_count + 1, sizeof(render_scene));
+	rs->instance_stride = 0;
+	for(int g = 0; g < scene_group_count; g+=1)
+	{
+		compile_objects(&rs->groups[g], &group_members[scene_groups[g].first], scene_groups[g].count);
+		if(scene_groups[g].count > rs->instance_stride)
+			rs->instance_stride = scene_groups[g].count;
+	}
 }
 
-// clamping helper function to make sure color isn't outside of 0-1 range (inclusive)
-double clamp(double value)
+// copies object i into the slot compile_scene() gave it; a frame whose objects are the same kinds in the same order as the last one's is compiled by calling this for every object
+// again, which overwrites each one in place
+void compile_object(render_scene* rs, Object* list, int i)
 {
-    if (value < 0)
-        return 0;
-    else if (value > 1)
-        return 1;
-    else
-        return value;
+	Object* objects = list; // (shadows the global object arena, since a group's members are compiled from their own arena)
+	surface* sf = &rs->surfaces[i];
+	int slot = sf->slot;
+	
+	if(objects[i].kind == 1)
+	{
+		copy_vector(sf->position, objects[i].sphere.position);
+		
+		rs->sphere_cx[slot] = objects[i].sphere.position[0];
+		rs->sphere_cy[slot] = objects[i].sphere.position[1];
+		rs->sphere_cz[slot] = objects[i].sphere.position[2];
+		rs->sphere_r2[slot] = sqr(objects[i].sphere.radius);
+		rs->sphere_cc[slot] = sqr(rs->sphere_cx[slot]) + sqr(rs->sphere_cy[slot]) + sqr(rs->sphere_cz[slot]) - rs->sphere_r2[slot];
+		rs->sphere_id[slot] = i;
+	}
+	else if(objects[i].kind == 2)
+	{
+		// the normal is normalized here once instead of for every ray. The plane's offset n.p isn't cached, since plane_hit() measures the distance from the ray origin to the plane's position instead
+		copy_vector(sf->normal, objects[i].plane.normal);
+		normalize(sf->normal);
+		
+		rs->plane_nx[slot] = sf->normal[0];
+		rs->plane_ny[slot] = sf->normal[1];
+		rs->plane_nz[slot] = sf->normal[2];
+		rs->plane_px[slot] = objects[i].plane.position[0];
+		rs->plane_py[slot] = objects[i].plane.position[1];
+		rs->plane_pz[slot] = objects[i].plane.position[2];
+		rs->plane_id[slot] = i;
+	}
+	else if(objects[i].kind == 3)
+	{
+		render_light* light = &rs->lights[slot];
+		light->kind_light = objects[i].light.kind_light;
+		copy_vector(light->color, objects[i].light.color);
+		copy_vector(light->position, objects[i].light.position);
+		copy_vector(light->direction, objects[i].light.direction);
+		if(light->kind_light == 1) // only spot lights have a direction
+			normalize(light->direction);
+		light->radial_a2 = objects[i].light.radial_a2;
+		if(light->radial_a2 == 0) // invalid a2 value so change to 1 as default
+			light->radial_a2 = 1.0;
+		light->radial_a1 = objects[i].light.radial_a1;
+		light->radial_a0 = objects[i].light.radial_a0;
+		light->angular_a0 = objects[i].light.angular_a0;
+		light->angular_power = (light->angular_a0 == floor(light->angular_a0) && light->angular_a0 <= MAX_WHOLE_POWER) ? (int)light->angular_a0 : -1;
+		light->cos_theta = cos(((objects[i].light.theta / 180) * 3.14159)); // (theta / 180) * 3.14159 converts from degrees to radians for cos() function
+	}
+	else if(objects[i].kind == 5)
+	{
+		render_instance* instance = &rs->instances[slot];
+		copy_vector(instance->position, objects[i].instance.position);
+		instance->scale = objects[i].instance.scale;
+		instance->inv_scale = 1 / instance->scale;
+		instance->group = objects[i].instance.group;
+		instance->object = i;
+		instance->first_id = rs->object_count + i * rs->instance_stride; // parse_scene() made sure this fits
+	}
 }
 
-// does radial attenutation calculations and returns value accordingly
-double frad(Object* light, double dl)
+// brings the render scene up to date with the objects of the current frame. When they're the same kinds in the same order as the ones it was compiled from (e.g. only moved by
+// keyframes), every object is copied over its old slot and the hierarchy is refit around the spheres' new positions, keeping its topology; that's only undone by a full rebuild once the
+// refit nodes have grown past BVH_REFIT_LIMIT times their size when built. Anything else is compiled from scratch
+void update_compiled_scene()
 {
-	if(light->light.radial_a2 == 0) // invalid a2 value so change to 1 as default
-		light->light.radial_a2 = 1.0;
-		
-	double return_value = (1.0 / ((light->light.radial_a2 * sqr(dl)) + (light->light.radial_a1 * dl) + light->light.radial_a0));
+	render_scene* rs = &compiled_scene;
+	if(scene_file_loaded) // loaded from a binary scene file this frame, so there's nothing to compile; only a hierarchy left out of the file has to be built
+	{
+		scene_file_loaded = 0;
+		build_mode = "loaded";
+		if(rs->node_count == 0 && rs->sphere_count > 0)
+		{
+			build_bvh(rs);
+			rs->nodes_built = 1;
+			build_mode = "loaded+built";
+		}
+		build_light_bvh(rs);
+		return;
+	}
 	
-	return return_value;
+	int same = (rs->surfaces != NULL && rs->storage == NULL && rs->object_count == object_count && rs->group_count == scene_group_count); // a scene loaded from a file is never updated in place
+	for(int i = 0; same && i < object_count; i+=1)
+		same = (rs->surfaces[i].kind == objects[i].kind);
+	
+	if(!same)
+	{
+		free_compiled_scene(rs);
+		compile_scene(rs);
+		build_mode = "compiled";
+		return;
+	}
+	
+	// the groups are small (that's the point of them), so they're compiled again rather than checked for changes; the instances are few compared to the spheres they place, so
+	// their hierarchy is always rebuilt
+	free_group_scenes(rs);
+	compile_groups(rs);
+	for(int i = 0; i < object_count; i+=1)
+		compile_object(rs, objects, i);
+	free(rs->materials); // a scene list's frames may have changed them
+	compile_materials(rs, objects, object_count);
+	
+	rs->camera_width = glob_width;
+	rs->camera_height = glob_height;
+	
+	free(rs->instance_nodes);
+	build_instance_bvh(rs);
+	free_light_bvh(rs); // the lights may have moved as well
+	build_light_bvh(rs);
+	
+	build_mode = "refit";
+	if(refit_bvh(rs) > BVH_REFIT_LIMIT * rs->build_area)
+	{
+		free(rs->nodes);
+		build_bvh(rs); // starts from the spheres' current (hierarchy) order, which is as good as any
+		build_mode = "rebuilt";
+	}
 }
 
-// does angular attenutation calculations and returns value accordingly
-double fang(Object* light, double direction[3], double theta)
+// frees the compiled render scene and its hierarchy
+void free_compiled_scene(render_scene* rs)
 {
-	normalize(light->light.direction);
-	if(light->light.kind_light != 1) // not spot light so return 1
-		return 1.0;
-		
-	double v0_vl = (light->light.direction[0] * direction[0]) + (light->light.direction[1] * direction[1]) +  (light->light.direction[2] * direction[2]);
+	if(rs->storage != NULL) // every array points into the binary scene file, apart from a hierarchy built after loading it (and the light hierarchy)
+	{
+		if(rs->nodes_built)
+			free(rs->nodes);
+		free_light_bvh(rs);
+		if(rs->storage_mapped)
+			munmap(rs->storage, rs->storage_size);
+		else
+			free(rs->storage);
+		memset(rs, 0, sizeof(render_scene));
+		return;
+	}
 	
-	if(v0_vl < cos(((theta / 180) * 3.14159))) // (theta / 180) * 3.14159 converts from degrees to radians for cos() function
-		return 0;
-		
-	return pow(v0_vl, light->light.angular_a0);
+	free(rs->sphere_cx);
+	free(rs->sphere_cy);
+	free(rs->sphere_cz);
+	free(rs->sphere_r2);
+	free(rs->sphere_cc);
+	free(rs->sphere_id);
+	free(rs->plane_nx);
+	free(rs->plane_ny);
+	free(rs->plane_nz);
+	free(rs->plane_px);
+	free(rs->plane_py);
+	free(rs->plane_pz);
+	free(rs->plane_id);
+	free(rs->materials);
+	free(rs->surfaces);
+	free(rs->lights);
+	free(rs->nodes);
+	free(rs->instances);
+	free(rs->instance_nodes);
+	free_light_bvh(rs);
+	free_group_scenes(rs);
+	memset(rs, 0, sizeof(render_scene));
 }
 
-// does diffuse color calculations and returns value accordingly
-void diffuse_calculation(double n[3], double l[3], double il[3], double kd[3], double* output)
+// frees the render scenes compiled for the groups
+void free_group_scenes(render_scene* rs)
 {
-	double n_l = (n[0] * l[0]) + (n[1] * l[1]) + (n[2] * l[2]);
-	// ambient constant would go here in the future
-    if (n_l > 0) 
-	{
-        output[0] = (kd[0] * il[0]) * n_l;
-        output[1] = (kd[1] * il[1]) * n_l;
-        output[2] = (kd[2] * il[2]) * n_l;
-    }
-    else 
-	{
-        output[0] = 0;
-        output[1] = 0;
-        output[2] = 0;
-    }
+	for(int g = 0; g < rs->group_count; g+=1)
+		free_compiled_scene(&rs->groups[g]);
+	free(rs->groups);
+	rs->groups = NULL;
+	rs->group_count = 0;
 }
 
-// does specular color calculations and returns value accordingly
-void specular_calculation(double n[3], double l[3], double il[3], double ks[3], double v[3], double r[3], double ns, double* output)
+// builds the bounding volume hierarchy over the compiled spheres, then reorders the sphere arrays to match the leaves so each leaf tests one contiguous run of them
+void build_bvh(render_scene* rs)
 {
-    double n_l = (n[0] * l[0]) + (n[1] * l[1]) + (n[2] * l[2]);
-	double v_r = (v[0] * r[0]) + (v[1] * r[1]) + (v[2] * r[2]);
+	int n = rs->sphere_count;
 	
-    if (n_l > 0 && v_r > 0) 
+	bvh_item* items = malloc(sizeof(bvh_item) * (n + 1));
+	rs->nodes = malloc(sizeof(bvh_node) * (2 * n + 1)); // a binary tree with n leaves never has more than 2n - 1 nodes
+	rs->node_count = 0;
+	
+	for(int i = 0; i < n; i+=1)
 	{
-        double vr_ns_power = pow(v_r, ns);
-        output[0] = (ks[0] * il[0]) * vr_ns_power;
-        output[1] = (ks[1] * il[1]) * vr_ns_power;
-        output[2] = (ks[2] * il[2]) * vr_ns_power;
-    }
-    else 
+		sphere_bounds(rs, i, items[i].min, items[i].max);
+		items[i].centroid[0] = rs->sphere_cx[i];
+		items[i].centroid[1] = rs->sphere_cy[i];
+		items[i].centroid[2] = rs->sphere_cz[i];
+		items[i].prim = i;
+	}
+	
+	if(n > 0)
+		bvh_build_node(rs->nodes, &rs->node_count, items, 0, n, 0);
+	
+	// block of code which permutes every sphere array into the (now partitioned) item order
+	real* fields[5] = {rs->sphere_cx, rs->sphere_cy, rs->sphere_cz, rs->sphere_r2, rs->sphere_cc};
+	real* reordered = malloc(sizeof(real) * (n + 1));
+	for(int f = 0; f < 5; f+=1)
 	{
-        output[0] = 0;
-        output[1] = 0;
-        output[2] = 0;
-    }
+		for(int i = 0; i < n; i+=1)
+			reordered[i] = fields[f][items[i].prim];
+		memcpy(fields[f], reordered, sizeof(real) * n);
+	}
+	int* reordered_id = malloc(sizeof(int) * (n + 1));
+	for(int i = 0; i < n; i+=1)
+		reordered_id[i] = rs->sphere_id[items[i].prim];
+	memcpy(rs->sphere_id, reordered_id, sizeof(int) * n);
+	// end of permutation
+	
+	free(reordered_id);
+	free(reordered);
+	free(items);
+	
+	for(int i = 0; i < n; i+=1)
+		rs->surfaces[rs->sphere_id[i]].slot = i; // the spheres only settle into their packed slots here
+	
+	rs->build_area = 0;
+	for(int i = 0; i < rs->node_count; i+=1)
+		rs->build_area += box_area(rs->nodes[i].min, rs->nodes[i].max);
 }
 
-
-void direct_shade(double Ron[3], double Rdn[3], double Rd[3], double distance_to_light, int best_i, Object* light, double* color)
+// builds the top level of the two level hierarchy: the same kind of hierarchy as build_bvh()'s, over the world space bounds of the instances (their group's root node moved and
+// scaled into place), whose leaves hold runs of instances which are then walked into their group's own hierarchy
+void build_instance_bvh(render_scene* rs)
 {
-	// initializes necessary n, l, r, v, and nv vectors as well as diffuse and specular vectors
-	double n[3]; 
-	double l[3];
-	double r[3]; // reflection of l
-	double v[3];
-	double nv[3];
-	double diffuse[3] = {0, 0, 0};
-	double diffuse_object[3] = {0, 0, 0};
-	double specular[3] = {0, 0, 0};
-	double specular_object[3] = {0, 0, 0};
-	double object_direction[3];
-	
-	
-	if(objects[best_i]->kind == 1) // determine some necessary variables according to sphere fields
-	{									
-		n[0] = Ron[0] - objects[best_i]->sphere.position[0];
-		n[1] = Ron[1] - objects[best_i]->sphere.position[1]; // sets normal to the Ron vector minus the closest object's (sphere in this case) position
-		n[2] = Ron[2] - objects[best_i]->sphere.position[2];
-		
-		diffuse_object[0] = objects[best_i]->sphere.diffuse_color[0];
-		diffuse_object[1] = objects[best_i]->sphere.diffuse_color[1];
-		diffuse_object[2] = objects[best_i]->sphere.diffuse_color[2];
-		
-		specular_object[0] = objects[best_i]->sphere.specular_color[0];
-		specular_object[1] = objects[best_i]->sphere.specular_color[1];
-		specular_object[2] = objects[best_i]->sphere.specular_color[2];
+	int n = rs->instance_count;
+	
+	bvh_item* items = malloc(sizeof(bvh_item) * (n + 1));
+	rs->instance_nodes = malloc(sizeof(bvh_node) * (2 * n + 1));
+	rs->instance_node_count = 0;
+	
+	for(int i = 0; i < n; i+=1)
+	{
+		render_instance* instance = &rs->instances[i];
+		bvh_node* root = &rs->groups[instance->group].nodes[0]; // groups are never empty, so they always have a root
+		for(int k = 0; k < 3; k+=1)
+		{
+			double position = instance->position[k];
+			double low = position + instance->scale * (double)root->min[k];
+			double high = position + instance->scale * (double)root->max[k];
+			double pad = BOUNDS_PAD * (fabs(low) + fabs(high)); // moving the ray into the group's space rounds too, in proportion to the coordinates (see sphere_bounds())
+			items[i].min[k] = low - pad;
+			items[i].max[k] = high + pad;
+			items[i].centroid[k] = (low + high) / 2;
+		}
+		items[i].prim = i;
 	}
 	
-	if(objects[best_i]->kind == 2) // determine some necessary variables according to plane fields
-	{									
-		n[0] = objects[best_i]->plane.normal[0];
-		n[1] = objects[best_i]->plane.normal[1]; // sets normal to the closets object's (plane in this case) normal
-		n[2] = objects[best_i]->plane.normal[2];
-		
-		diffuse_object[0] = objects[best_i]->plane.diffuse_color[0];
-		diffuse_object[1] = objects[best_i]->plane.diffuse_color[1];
-		diffuse_object[2] = objects[best_i]->plane.diffuse_color[2];
-		
-		specular_object[0] = objects[best_i]->plane.specular_color[0];
-		specular_object[1] = objects[best_i]->plane.specular_color[1];
-		specular_object[2] = objects[best_i]->plane.specular_color[2];
-		
-		Rdn[1] *= -1; // inverts y-coordinate of Rdn to display properly
-	}
+	if(n > 0)
+		bvh_build_node(rs->instance_nodes, &rs->instance_node_count, items, 0, n, 0);
 	
-	normalize(n);
+	// block of code which permutes the instances into the (now partitioned) item order
+	render_instance* reordered = malloc(sizeof(render_instance) * (n + 1));
+	for(int i = 0; i < n; i+=1)
+		reordered[i] = rs->instances[items[i].prim];
+	memcpy(rs->instances, reordered, sizeof(render_instance) * n);
+	// end of permutation
 	
-	l[0] = Rdn[0];
-	l[1] = Rdn[1]; // sets l vector to the Rdn vector
-	l[2] = Rdn[2];
+	free(reordered);
+	free(items);
 	
-	normalize(l);
-		
-	// calculating reflection variable
-	reflect_vector(l, Ron, best_i, r);	
-	// end of calculating reflection variable
+	for(int i = 0; i < n; i+=1)
+		rs->surfaces[rs->instances[i].object].slot = i;
+}
+
+// works out every light's radius and builds the light hierarchy over the regions the lights reach (see light_bounds()). The lights themselves stay where they are, since the
+// per-thread occluder caches are indexed by light, so the leaves cover runs of light_order instead. Lights reaching infinitely far (no --light-cutoff) get an infinite box, which
+// always holds the point; their centroid is the light's own position so the builder still gets finite numbers to bin
+void build_light_bvh(render_scene* rs)
+{
+	int n = rs->light_count;
 	
-	v[0] = Rd[0];
-	v[1] = Rd[1]; // sets v vector to the Rd vector
-	v[2] = Rd[2];
+	bvh_item* items = malloc(sizeof(bvh_item) * (n + 1));
+	rs->light_radius = malloc(sizeof(real) * (n + 1));
+	rs->light_order = malloc(sizeof(int) * (n + 1));
+	rs->light_nodes = malloc(sizeof(bvh_node) * (2 * n + 1));
+	rs->light_node_count = 0;
 	
-	nv[0] = v[0] * -1;
-	nv[1] = v[1] * -1; // nv vector (v vector scaled by -1) to be passed into the specular_calculation function
-	nv[2] = v[2] * -1;
-	 
-	// passes in corresponding variables for diffuse and specular calculators, using the diffuse/specular vectors as output
-	diffuse_calculation(n, l, light->light.color, diffuse_object, diffuse);
-	specular_calculation(n, l, light->light.color, specular_object, v, r, 20, specular);
-		
-	object_direction[0] = Rdn[0] * -1;
-	object_direction[1] = Rdn[1] * -1; 
-	object_direction[2] = Rdn[2] * -1;
+	for(int l = 0; l < n; l+=1)
+	{
+		double radius = light_reach(&rs->lights[l]);
+		rs->light_radius[l] = radius;
+		light_bounds(&rs->lights[l], radius, items[l].min, items[l].max);
+		for(int k = 0; k < 3; k+=1)
+			items[l].centroid[k] = rs->lights[l].position[k];
+		items[l].prim = l;
+	}
+	
+	if(n > 0)
+		bvh_build_node(rs->light_nodes, &rs->light_node_count, items, 0, n, 0);
+	for(int i = 0; i < n; i+=1)
+		rs->light_order[i] = items[i].prim;
+	
+	free(items);
+}
+
+// frees what build_light_bvh() allocated
+void free_light_bvh(render_scene* rs)
+{
+	free(rs->light_radius);
+	free(rs->light_order);
+	free(rs->light_nodes);
+	rs->light_radius = NULL;
+	rs->light_order = NULL;
+	rs->light_nodes = NULL;
+	rs->light_node_count = 0;
+}
+
+// walks the light hierarchy down to the leaves whose boxes hold the point and lists their lights in out, sorted by index so shade() adds up their colors in the same order as it
+// would visiting every light. The leaves' lights are marked in the (clear) mask and then read back out of it word by word, which sorts them without comparing any and leaves the
+// mask clear again; returns the number of lights listed
+int light_candidates(render_scene* rs, real* point, unsigned long long* mask, int* out)
+{
+	int count = 0;
+	int first_word = INT_MAX;
+	int last_word = -1;
+	int stack[BVH_MAX_DEPTH + 4];
+	int stack_size = 0;
 	
-	double fang_val = 0;
-	double frad_val = 0;
+	if(rs->light_node_count > 0)
+		stack[stack_size++] = 0;
 	
-	if(light->light.kind_light == 2) // light is neither a point/spotlight, but rather a temporary light object intended to hold reflection/refraction values, so don't to any attenuation and just set fang_val and frad_val both to 1
+	while(stack_size > 0)
 	{
-		fang_val = 1;
-		frad_val = 1;
+		bvh_node* node = &rs->light_nodes[stack[--stack_size]];
+		if(point[0] < node->min[0] || point[0] > node->max[0] || point[1] < node->min[1] || point[1] > node->max[1] || point[2] < node->min[2] || point[2] > node->max[2])
+			continue;
+		
+		if(node->count == 0) // inner node so visit both children
+		{
+			stack[stack_size++] = node->offset;
+			stack[stack_size++] = (int)(node - rs->light_nodes) + 1;
+			continue;
+		}
+		
+		for(int i = node->offset; i < node->offset + node->count; i+=1)
+		{
+			int light = rs->light_order[i];
+			mask[light / 64] |= 1ULL << (light % 64);
+			if(light / 64 < first_word)
+				first_word = light / 64;
+			if(light / 64 > last_word)
+				last_word = light / 64;
+		}
 	}
 	
-	if(light->light.kind_light != 2) // light is either a point/spotlight, so do attenuation accordingly
+	for(int w = first_word; w <= last_word; w+=1)
 	{
-		fang_val = fang(light, object_direction, light->light.theta);									
-		frad_val = frad(light, distance_to_light);
+		unsigned long long bits = mask[w];
+		mask[w] = 0;
+		while(bits != 0)
+		{
+			out[count++] = w * 64 + __builtin_ctzll(bits);
+			bits &= bits - 1; // clears the lowest set bit
+		}
 	}
 	
-	color[0] += frad_val * fang_val * (diffuse[0] + specular[0]); 
-	color[1] += frad_val * fang_val * (diffuse[1] + specular[1]); 
-	color[2] += frad_val * fang_val * (diffuse[2] + specular[2]); 
+	return count;
 }
 
+// returns 1 when the file name ends in .rts, which is how the command line (and scene lists) tell binary scene files from json ones
+int is_scene_file(char* filename)
+{
+	int length = strlen(filename);
+	return length >= 4 && strcmp(filename + length - 4, ".rts") == 0;
+}
 
-// master function recursively called to shade the scene through the raytracing process
-void shade(double Ro[3], double Rd[3], double best_t, int best_i, Object** lights, int ior, int depth, double* color)
+// the --convert subcommand: the json scene goes through the same parser and compiler as a render (so a scene which converts is as valid as one which renders), and the resulting
+// render scene is written out as a binary scene file
+void convert_scene(char* input_file, char* output_file)
 {
-	// checks to make sure [recursive] depth doesn't exceed a level of 7
-	if(depth > 7)
+	int input_length = strlen(input_file);
+	if(input_length < 5 || strcmp(input_file + input_length - 5, ".json") != 0 || !is_scene_file(output_file))
 	{
-		color[0] = 0;
-		color[1] = 0;
-		color[2] = 0;
-		return;
+		fprintf(stderr, "Error: --convert turns a .json scene into a .rts binary scene file\n");
+		exit(1); // exits out of program due to error
 	}
-
-	double Ron[3] = {0, 0, 0}; // Initializes new origin ray to the assumed 0, 0, 0 position
-	double Rdn[3] = {0, 0, 0}; // Initializes new direction of ray to 0, 0, 0 which will be changed
 	
-	Ron[0] = (best_t * Rd[0]) + Ro[0];
-	Ron[1] = (best_t * Rd[1]) + Ro[1]; // sets Ron using previously calculated object intersection
-	Ron[2] = (best_t * Rd[2]) + Ro[2];
+	read_scene(input_file);
+	if(scene_group_count > 0) // a binary scene file holds one flat render scene, with nowhere to put the groups' own render scenes
+	{
+		fprintf(stderr, "Error: --convert can't write scenes with groups/instances to a binary scene file\n");
+		exit(1); // exits out of program due to error
+	}
+	compile_scene(&compiled_scene);
+	write_scene_file(output_file, &compiled_scene, convert_bvh);
 	
-	normalize(Rd);
+	fprintf(stderr, "Converted %s to %s: %d spheres, %d planes, %d lights and %d hierarchy nodes\n", input_file, output_file, compiled_scene.sphere_count, compiled_scene.plane_count,
+		compiled_scene.light_count, convert_bvh ? compiled_scene.node_count : 0);
 	
-	// setup/calculate reflection vector
-	double reflection_vector[3] = {0, 0, 0};
+	free_compiled_scene(&compiled_scene);
+	free(objects);
+	free(scene_groups);
+	free(group_members);
+}
+
+// lists the address of every array pointer of the render scene in the order a binary scene file stores the arrays, along with the size in bytes of each array (which only depends
+// on the scene's counts, so it also sizes the arrays of a file from the counts in its header)
+void scene_file_arrays(render_scene* rs, void** fields[], size_t sizes[])
+{
+	size_t spheres = rs->sphere_count;
+	size_t planes = rs->plane_count;
+	void** f[SCENE_FILE_ARRAYS] = {(void**)&rs->sphere_cx, (void**)&rs->sphere_cy, (void**)&rs->sphere_cz, (void**)&rs->sphere_r2, (void**)&rs->sphere_cc, (void**)&rs->sphere_id,
+		(void**)&rs->plane_nx, (void**)&rs->plane_ny, (void**)&rs->plane_nz, (void**)&rs->plane_px, (void**)&rs->plane_py, (void**)&rs->plane_pz, (void**)&rs->plane_id,
+		(void**)&rs->materials, (void**)&rs->surfaces, (void**)&rs->lights, (void**)&rs->nodes};
+	size_t z[SCENE_FILE_ARRAYS] = {spheres * sizeof(real), spheres * sizeof(real), spheres * sizeof(real), spheres * sizeof(real), spheres * sizeof(real), spheres * sizeof(int),
+		planes * sizeof(real), planes * sizeof(real), planes * sizeof(real), planes * sizeof(real), planes * sizeof(real), planes * sizeof(real), planes * sizeof(int),
+		(size_t)rs->material_count * sizeof(material), (size_t)rs->object_count * sizeof(surface), (size_t)rs->light_count * sizeof(render_light), (size_t)rs->node_count * sizeof(bvh_node)};
 	
-	reflect_vector(Rd, Ron, best_i, reflection_vector);
-	// end of setting up/calculating reflection vector
+	for(int k = 0; k < SCENE_FILE_ARRAYS; k+=1)
+	{
+		fields[k] = f[k];
+		sizes[k] = z[k];
+	}
+}
+
+// writes the header followed by every array of the render scene, each starting on a SCENE_FILE_ALIGN boundary. Without with_bvh the node count is stored as 0 (the spheres are
+// still in the order the hierarchy left them in, which is as good as any for the one built when the file is loaded)
+void write_scene_file(char* filename, render_scene* rs, int with_bvh)
+{
+	scene_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic));
+	header.version = SCENE_FILE_VERSION;
+	header.byte_order = 0x01020304;
+	header.real_size = sizeof(real);
+	header.struct_sizes[0] = sizeof(material);
+	header.struct_sizes[1] = sizeof(surface);
+	header.struct_sizes[2] = sizeof(render_light);
+	header.struct_sizes[3] = sizeof(bvh_node);
+	header.object_count = rs->object_count;
+	header.material_count = rs->material_count;
+	header.sphere_count = rs->sphere_count;
+	header.plane_count = rs->plane_count;
+	header.light_count = rs->light_count;
+	header.node_count = with_bvh ? rs->node_count : 0;
+	header.build_area = with_bvh ? rs->build_area : 0;
+	header.camera_width = rs->camera_width;
+	header.camera_height = rs->camera_height;
 	
-	// setup/calculate refraction vector
-	double refraction_vector[3] = {0, 0, 0};
+	render_scene counts = *rs;
+	counts.node_count = header.node_count;
+	void** fields[SCENE_FILE_ARRAYS];
+	size_t sizes[SCENE_FILE_ARRAYS];
+	scene_file_arrays(&counts, fields, sizes);
 	
-	refract_vector(Rd, Ron, ior, best_i, refraction_vector);	
-	// end of setting up/calculating refraction vector
+	// block of code which lays the arrays out one after another, rounding every offset up to the alignment
+	unsigned long long offset = sizeof(header);
+	for(int k = 0; k < SCENE_FILE_ARRAYS; k+=1)
+	{
+		offset = (offset + SCENE_FILE_ALIGN - 1) / SCENE_FILE_ALIGN * SCENE_FILE_ALIGN;
+		header.offsets[k] = offset;
+		offset += sizes[k];
+	}
+	header.file_size = offset;
+	// end of layout
 	
+	FILE* fh = fopen(filename, "wb");
+	if(fh == NULL)
+	{
+		fprintf(stderr, "Error: Scene file \"%s\" couldn't be created.\n", filename);
+		exit(1); // exits out of program due to error
+	}
 	
-	// initializes the new reflected/refracted origin/direction vectors used in the recursive shading process
-	double Ro_reflect[3] = {0, 0, 0};
-	double Ro_refract[3] = {0, 0, 0};
-	double Rd_reflect[3] = {0, 0, 0};
-	double Rd_refract[3] = {0, 0, 0};
+	static const char padding[SCENE_FILE_ALIGN];
+	int ok = (fwrite(&header, sizeof(header), 1, fh) == 1);
+	unsigned long long written = sizeof(header);
+	for(int k = 0; ok && k < SCENE_FILE_ARRAYS; k+=1)
+	{
+		ok = (fwrite(padding, 1, header.offsets[k] - written, fh) == header.offsets[k] - written);
+		if(ok && sizes[k] > 0)
+			ok = (fwrite(*fields[k], 1, sizes[k], fh) == sizes[k]);
+		written = header.offsets[k] + sizes[k];
+	}
+	if(fclose(fh) != 0 || !ok)
+	{
+		fprintf(stderr, "Error: Scene file \"%s\" couldn't be written.\n", filename);
+		exit(1); // exits out of program due to error
+	}
+}
+
+// maps the binary scene file privately (so a hierarchy built when the file has none can still reorder the spheres in place without touching the file) and, once its contents have been
+// checked, points the render scene's arrays straight into the mapping; nothing is parsed or copied, pages are only read in as rendering touches them
+void load_scene_file(char* filename, render_scene* rs)
+{
+	int fd = open(filename, O_RDONLY);
+	struct stat info;
+	if(fd < 0 || fstat(fd, &info) != 0)
+	{
+		fprintf(stderr, "Error: Scene file \"%s\" couldn't be opened.\n", filename);
+		exit(1); // exits out of program due to error
+	}
 	
-	// Copying Ron vector over to Ro_reflect vector
-	Ro_reflect[0] = Ron[0];
-	Ro_reflect[1] = Ron[1];
-	Ro_reflect[2] = Ron[2];
+	char* data = mmap(NULL, info.st_size > 0 ? info.st_size : 1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED)
+	{
+		fprintf(stderr, "Error: Scene file \"%s\" couldn't be mapped.\n", filename);
+		exit(1); // exits out of program due to error
+	}
 	
-	// Copying Ron vector over to Ro_refract vector
-	Ro_refract[0] = Ron[0];
-	Ro_refract[1] = Ron[1];
-	Ro_refract[2] = Ron[2];
+	check_scene_file(filename, data, info.st_size);
 	
-	// offsetting reflection vector
-	double reflect_offset[3] = {0, 0, 0};
-	reflect_offset[0] = reflection_vector[0] * .01;
-	reflect_offset[1] = reflection_vector[1] * .01;
-	reflect_offset[2] = reflection_vector[2] * .01;
-	Ro_reflect[0] = Ro_reflect[0] + reflect_offset[0];
-	Ro_reflect[1] = Ro_reflect[1] + reflect_offset[1];
-	Ro_reflect[2] = Ro_reflect[2] + reflect_offset[2];
-	//
+	free_compiled_scene(rs);
+	bind_scene_file(rs, data);
+	rs->storage_mapped = 1;
+	scene_file_loaded = 1;
+}
+
+// checks that the binary scene file held in memory was written by a build laid out like this one and that every index in it is in range (object ids and slots both ways, materials, hierarchy
+// children, leaf ranges and depth), so a damaged file is refused instead of crashing the render; the arrays of reals aren't checked since any value renders
+void check_scene_file(char* name, const char* data, size_t size)
+{
+	scene_file_header header;
+	if(size < sizeof(header))
+	{
+		fprintf(stderr, "Error: Scene file \"%s\" is too short to be a binary scene file.\n", name);
+		fail();
+	}
+	memcpy(&header, data, sizeof(header));
 	
-	// offsetting refraction vector
-	double refract_offset[3] = {0, 0, 0};
-	refract_offset[0] = refraction_vector[0] * .01;
-	refract_offset[1] = refraction_vector[1] * .01;
-	refract_offset[2] = refraction_vector[2] * .01;
-	Ro_refract[0] = Ro_refract[0] + refract_offset[0];
-	Ro_refract[1] = Ro_refract[1] + refract_offset[1];
-	Ro_refract[2] = Ro_refract[2] + refract_offset[2];
-	//
+	if(memcmp(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic)) != 0 || header.byte_order != 0x01020304)
+	{
+		fprintf(stderr, "Error: Scene file \"%s\" isn't a binary scene file (or was written on a machine with a different byte order).\n", name);
+		fail();
+	}
+	if(header.version != SCENE_FILE_VERSION || header.real_size != (int)sizeof(real) || header.struct_sizes[0] != (int)sizeof(material) || header.struct_sizes[1] != (int)sizeof(surface) ||
+		header.struct_sizes[2] != (int)sizeof(render_light) || header.struct_sizes[3] != (int)sizeof(bvh_node))
+	{
+		fprintf(stderr, "Error: Scene file \"%s\" is version %d with %d byte reals, but this build reads version %d with %d byte reals; convert the scene again.\n", name, header.version,
+			header.real_size, SCENE_FILE_VERSION, (int)sizeof(real));
+		fail();
+	}
+	if(header.object_count < 0 || header.material_count < 0 || header.material_count > header.object_count || header.sphere_count < 0 || header.plane_count < 0 || header.light_count < 0 || header.node_count < 0 ||
+		(long long)header.sphere_count + header.plane_count + header.light_count > header.object_count)
+	{
+		fprintf(stderr, "Error: Scene file \"%s\" has a damaged header.\n", name);
+		fail();
+	}
+	if(header.file_size != size)
+	{
+		fprintf(stderr, "Error: Scene file \"%s\" is %zu bytes long but its header says %llu.\n", name, size, header.file_size);
+		fail();
+	}
 	
-	// Copying reflection vector over to Rd_reflect vector for normalization before use
-	Rd_reflect[0] = reflection_vector[0];
-	Rd_reflect[1] = reflection_vector[1];
-	Rd_reflect[2] = reflection_vector[2];
+	// block of code which checks that every array lies inside the file on an aligned offset
+	render_scene counts;
+	memset(&counts, 0, sizeof(counts));
+	counts.object_count = header.object_count;
+	counts.material_count = header.material_count;
+	counts.sphere_count = header.sphere_count;
+	counts.plane_count = header.plane_count;
+	counts.light_count = header.light_count;
+	counts.node_count = header.node_count;
+	void** fields[SCENE_FILE_ARRAYS];
+	size_t sizes[SCENE_FILE_ARRAYS];
+	scene_file_arrays(&counts, fields, sizes);
+	for(int k = 0; k < SCENE_FILE_ARRAYS; k+=1)
+	{
+		if(header.offsets[k] % SCENE_FILE_ALIGN != 0 || header.offsets[k] < sizeof(header) || header.offsets[k] > size || sizes[k] > size - header.offsets[k])
+		{
+			fprintf(stderr, "Error: Scene file \"%s\" is truncated or has a damaged header.\n", name);
+			fail();
+		}
+	}
+	// end of array checks
 	
-	// Copying refraction vector over to Rd_refract vector for normalization before use
-	Rd_refract[0] = refraction_vector[0];
-	Rd_refract[1] = refraction_vector[1];
-	Rd_refract[2] = refraction_vector[2];
+	const int* sphere_id = (const int*)(data + header.offsets[5]);
+	const int* plane_id = (const int*)(data + header.offsets[12]);
+	const material* materials = (const material*)(data + header.offsets[13]);
+	const surface* surfaces = (const surface*)(data + header.offsets[14]);
+	const bvh_node* nodes = (const bvh_node*)(data + header.offsets[16]);
+	int valid = 1;
 	
+	// block of code which checks that objects and their sphere/plane/light slots point at each other
+	for(int i = 0; valid && i < header.object_count; i+=1)
+	{
+		int kind = surfaces[i].kind;
+		int slot = surfaces[i].slot;
+		if(kind == 1)
+			valid = (slot >= 0 && slot < header.sphere_count && sphere_id[slot] == i);
+		else if(kind == 2)
+			valid = (slot >= 0 && slot < header.plane_count && plane_id[slot] == i);
+		else if(kind == 3)
+			valid = (slot >= 0 && slot < header.light_count);
+		else
+			valid = (kind == 0 || kind == 6);
+		if(valid && (kind == 1 || kind == 2))
+			valid = (surfaces[i].material >= 0 && surfaces[i].material < header.material_count);
+	}
+	for(int k = 0; valid && k < header.material_count; k+=1)
+		valid = (materials[k].shading >= 0 && materials[k].shading < SHADE_CLASSES && materials[k].power >= 0 && materials[k].power <= MAX_WHOLE_POWER);
+	for(int p = 0; valid && p < header.sphere_count; p+=1)
+		valid = (sphere_id[p] >= 0 && sphere_id[p] < header.object_count && surfaces[sphere_id[p]].kind == 1 && surfaces[sphere_id[p]].slot == p);
+	for(int p = 0; valid && p < header.plane_count; p+=1)
+		valid = (plane_id[p] >= 0 && plane_id[p] < header.object_count && surfaces[plane_id[p]].kind == 2 && surfaces[plane_id[p]].slot == p);
+	// end of slot checks
 	
-	normalize(Rd_reflect); // normalize new reflection vector
-	normalize(Rd_refract); // normalize new refraction vector
+	// block of code which checks the hierarchy: children always come after their parent (the left one right after it) and no leaf is deeper than the traversal stack allows
+	int* depth = calloc(header.node_count + 1, sizeof(int));
+	for(int n = 0; valid && n < header.node_count; n+=1)
+	{
+		const bvh_node* node = &nodes[n];
+		if(node->count > 0)
+		{
+			valid = (node->offset >= 0 && node->offset <= header.sphere_count - node->count);
+		}
+		else
+		{
+			valid = (node->count == 0 && n + 1 < node->offset && node->offset < header.node_count && depth[n] < BVH_MAX_DEPTH);
+			if(valid)
+			{
+				depth[n + 1] = depth[n] + 1 > depth[n + 1] ? depth[n] + 1 : depth[n + 1];
+				depth[node->offset] = depth[n] + 1 > depth[node->offset] ? depth[n] + 1 : depth[node->offset];
+			}
+		}
+	}
+	free(depth);
+	// end of hierarchy checks
 	
+	if(!valid)
+	{
+		fprintf(stderr, "Error: Scene file \"%s\" has damaged object indices or hierarchy.\n", name);
+		fail();
+	}
+}
+
+// points the render scene's arrays at the ones stored in the (checked) binary scene file and takes its counts from the header; the scene owns data from here on
+void bind_scene_file(render_scene* rs, char* data)
+{
+	scene_file_header header;
+	memcpy(&header, data, sizeof(header));
 	
-	// shoot out reflection vector with the new ray origin and the reflection vector as the new direction
-	double best_reflect_t = INFINITY;
-	int best_reflect_o = -1;
-	shoot(Ro_reflect, Rd_reflect, INFINITY, best_i, &best_reflect_t, &best_reflect_o);
+	memset(rs, 0, sizeof(render_scene));
+	rs->object_count = header.object_count;
+	rs->material_count = header.material_count;
+	rs->sphere_count = header.sphere_count;
+	rs->plane_count = header.plane_count;
+	rs->light_count = header.light_count;
+	rs->node_count = header.node_count;
+	rs->build_area = header.build_area;
+	rs->camera_width = header.camera_width;
+	rs->camera_height = header.camera_height;
+	rs->storage = data;
+	rs->storage_size = header.file_size;
 	
-	// shoot out refraction vector conditionally with the new ray origin and the refraction vector as the new direction
-	double best_refract_t = INFINITY;
-	int best_refract_o = -1;	
-	shoot(Ro_refract, Rd_refract, INFINITY, best_i, &best_refract_t, &best_refract_o); 
+	void** fields[SCENE_FILE_ARRAYS];
+	size_t sizes[SCENE_FILE_ARRAYS];
+	scene_file_arrays(rs, fields, sizes);
+	for(int k = 0; k < SCENE_FILE_ARRAYS; k+=1)
+		*fields[k] = data + header.offsets[k];
+}
+
+// computes the bounds of a compiled sphere, padded slightly so rounding in the slab test (or in storing the bounds as reals) can never cull a grazing hit; the rounding grows
+// with the coordinates so the padding does too
+void sphere_bounds(render_scene* rs, int slot, double* min, double* max)
+{
+	double center[3] = {rs->sphere_cx[slot], rs->sphere_cy[slot], rs->sphere_cz[slot]};
+	double r = sqrt((double)rs->sphere_r2[slot]) * (1 + BOUNDS_PAD) + BOUNDS_PAD;
+	for(int k = 0; k < 3; k+=1)
+	{
+		double pad = r + BOUNDS_PAD * fabs(center[k]);
+		min[k] = center[k] - pad;
+		max[k] = center[k] + pad;
+	}
+}
+
+// returns the surface area of a bounding box (the surface area heuristic's measure of how likely a ray is to enter it)
+double box_area(real* min, real* max)
+{
+	double dx = max[0] - min[0];
+	double dy = max[1] - min[1];
+	double dz = max[2] - min[2];
+	return 2 * (dx * dy + dy * dz + dz * dx);
+}
+
+// refits the hierarchy to the spheres' current positions without changing which spheres end up in which leaf. Children are always stored after their parent, so walking the nodes
+// backwards visits both children of a node before the node itself
+double refit_bvh(render_scene* rs)
+{
+	double area = 0;
 	
-	// checks if there was either a reflection or refraction "interesection" found
-	if(best_reflect_o != -1 || best_refract_o != -1)
+	for(int i = rs->node_count - 1; i >= 0; i-=1)
 	{
-		// initializes color vectors intended to hold reflection/refraction colors if there was a corresponding "intersection"
-		double reflection_color[3] = {0, 0, 0};
-		double refraction_color[3] = {0, 0, 0};
-		
-		// initializes the reflectivity/refractivity/reflect_ior/refract_ior constants
-		double reflectivity = 0;
-		double refractivity = 0;
-		double reflect_ior = 1; 
-		double refract_ior = 1;
-		
-		// quick set of conditional statements to assign reflectivity/refractivity values from the best_i object index to the variables declared above
-		if(objects[best_i]->kind == 1)
-		{
-			reflectivity = objects[best_i]->sphere.reflectivity;
-			refractivity = objects[best_i]->sphere.refractivity;
-		}
-		if(objects[best_i]->kind == 2)
+		bvh_node* node = &rs->nodes[i];
+		for(int k = 0; k < 3; k+=1)
 		{
-			reflectivity = objects[best_i]->plane.reflectivity;
-			refractivity = objects[best_i]->plane.refractivity;
+			node->min[k] = INFINITY;
+			node->max[k] = -INFINITY;
 		}
 		
-		// checks to see if there was a reflection intersection based on value of returned object index (best_reflect_o); won't ever be 0 since 0 is the camera's index
-		if(best_reflect_o >= 1) 
-		{		
-		
-			// after determining that there was a reflection intersection, we have the reflection index needed to calculate the index of refraction value from the intersected object
-			if(objects[best_reflect_o]->kind == 1)
+		if(node->count > 0)
+		{
+			for(int j = node->offset; j < node->offset + node->count; j+=1)
 			{
-				reflect_ior = objects[best_reflect_o]->sphere.ior;
+				double min[3];
+				double max[3];
+				sphere_bounds(rs, j, min, max);
+				for(int k = 0; k < 3; k+=1)
+				{
+					node->min[k] = fmin(node->min[k], min[k]);
+					node->max[k] = fmax(node->max[k], max[k]);
+				}
 			}
-		
-			if(objects[best_reflect_o]->kind == 2)
+		}
+		else
+		{
+			bvh_node* left = &rs->nodes[i + 1];
+			bvh_node* right = &rs->nodes[node->offset];
+			for(int k = 0; k < 3; k+=1)
 			{
-				reflect_ior = objects[best_reflect_o]->plane.ior;
+				node->min[k] = fmin(left->min[k], right->min[k]);
+				node->max[k] = fmax(left->max[k], right->max[k]);
 			}
-			// end of pulling ior values
-			
-			
-			// create reflection light object intended to store the color/direction values of the reflection to be used in conjunction with the direct_shade function
-			Object* reflection_light;
-			reflection_light = (Object*)malloc(sizeof(Object));
-			
-			reflection_light->light.kind_light = 2; // a type of "flag" value to indicate that the light isn't a point/spotlight but rather a special "reflection/refraction light"
-			
-			// recursive call on the shade function using the previously calculated Ron along with the reflection vector as the new ray direction, in conjunction with the distance to the "reflect" object as well as its index. Also increments recursive depth level
-			shade(Ro_reflect, Rd_reflect, best_reflect_t, best_reflect_o, lights, reflect_ior, depth + 1, reflection_color);
-			
-			// scales the returned reflection_color vector (from the recursive call return) by the reflectivity property to account for the reflection_color vector
-			reflection_color[0] = reflection_color[0] * reflectivity;
-			reflection_color[1] = reflection_color[1] * reflectivity;
-			reflection_color[2] = reflection_color[2] * reflectivity;
+		}
+		
+		area += box_area(node->min, node->max);
+	}
+	
+	return area;
+}
 
-			
-			
-			// stores the previously allocated light object with the reflection vector inverted by -1 as the light's direction, and the reflection_volor vector as the light's color
-			reflection_light->light.direction[0] = reflection_vector[0] * -1;
-			reflection_light->light.direction[1] = reflection_vector[1] * -1; 
-			reflection_light->light.direction[2] = reflection_vector[2] * -1;
-			
-			reflection_light->light.color[0] = reflection_color[0];
-			reflection_light->light.color[1] = reflection_color[1];
-			reflection_light->light.color[2] = reflection_color[2];
-			// end of filling light object
-			
-			
+// recursively builds the node holding items [start, end) and returns its index; splits are chosen with a binned surface area heuristic
+int bvh_build_node(bvh_node* nodes, int* node_count, bvh_item* items, int start, int end, int depth)
+{
+	int index = (*node_count)++;
+	bvh_node* node = &nodes[index];
+	int count = end - start;
 	
-			// modifies reflection vector by scaling it using the distance to the "reflect" object
-			Rd_reflect[0] = Rd_reflect[0] * best_reflect_t;
-			Rd_reflect[1] = Rd_reflect[1] * best_reflect_t;
-			Rd_reflect[2] = Rd_reflect[2] * best_reflect_t;
-					
-			
-			// creates new Rd_reflect direction vector and stores the value Rd_reflect vector - the new ray origin vector to get the new direction of the reflected ray
-			double Rd_reflect_new[3] = {0, 0, 0}; // maybe set to Rdn instead
-			
-			Rd_reflect_new[0] = Rd_reflect[0] - Ron[0];
-			Rd_reflect_new[1] = Rd_reflect[1] - Ron[1]; 
-			Rd_reflect_new[2] = Rd_reflect[2] - Ron[2];
-			
-			
-			// normalizes the newly calculated reflected ray's direction vector
-			normalize(Rd_reflect_new); 
-			
-			// calls the direct_shade function using the new ray origin vector along with the reflected ray's direction vector
-			direct_shade(Ron, Rd_reflect_new, Rd, -1, best_i, reflection_light, color); // pass in  -1 as distance_to_light because it won't be used since this is a reflection
-			
-			
-			free(reflection_light);
+	double cmin[3] = {INFINITY, INFINITY, INFINITY};
+	double cmax[3] = {-INFINITY, -INFINITY, -INFINITY};
+	for(int k = 0; k < 3; k+=1)
+	{
+		node->min[k] = INFINITY;
+		node->max[k] = -INFINITY;
+	}
+	
+	// block of code which computes the bounds of the node along with the bounds of the item centroids
+	for(int i = start; i < end; i+=1)
+	{
+		for(int k = 0; k < 3; k+=1)
+		{
+			node->min[k] = fmin(node->min[k], items[i].min[k]);
+			node->max[k] = fmax(node->max[k], items[i].max[k]);
+			cmin[k] = fmin(cmin[k], items[i].centroid[k]);
+			cmax[k] = fmax(cmax[k], items[i].centroid[k]);
 		}
+	}
+	
+	node->offset = start;
+	node->count = count;
+	
+	if(count <= 1 || depth >= BVH_MAX_DEPTH)
+		return index;
+	
+	// block of code which evaluates BVH_BINS - 1 split planes along each axis and keeps the cheapest one
+	double best_cost = INFINITY;
+	int best_axis = -1;
+	int best_split = 0;
+	
+	for(int k = 0; k < 3; k+=1)
+	{
+		double extent = cmax[k] - cmin[k];
+		if(extent <= 0) // every centroid is at the same coordinate so this axis can't separate anything
+			continue;
 		
-		if(best_refract_o >= 1)
+		int bin_count[BVH_BINS] = {0};
+		double bin_min[BVH_BINS][3];
+		double bin_max[BVH_BINS][3];
+		for(int b = 0; b < BVH_BINS; b+=1)
 		{
-			
-			// after determining that there was a refraction intersection, we have the refraction index needed to calculate the index of refraction value from the intersected object
-			if(objects[best_refract_o]->kind == 1)
+			for(int j = 0; j < 3; j+=1)
 			{
-				refract_ior = objects[best_refract_o]->sphere.ior;
+				bin_min[b][j] = INFINITY;
+				bin_max[b][j] = -INFINITY;
 			}
+		}
 		
-			if(objects[best_refract_o]->kind == 2)
+		for(int i = start; i < end; i+=1)
+		{
+			int b = (int)(BVH_BINS * (items[i].centroid[k] - cmin[k]) / extent);
+			if(b >= BVH_BINS)
+				b = BVH_BINS - 1;
+			bin_count[b]++;
+			for(int j = 0; j < 3; j+=1)
 			{
-				refract_ior = objects[best_refract_o]->plane.ior;
+				bin_min[b][j] = fmin(bin_min[b][j], items[i].min[j]);
+				bin_max[b][j] = fmax(bin_max[b][j], items[i].max[j]);
 			}
-			// end of pulling ior values
-			
-			
-			// create refraction light object intended to store the color/direction values of the refraction to be used in conjunction with the direct_shade function
-			Object* refraction_light;
-			refraction_light = (Object*)malloc(sizeof(Object));
-			
-			refraction_light->light.kind_light = 2; // a type of "flag" value to indicate that the light isn't a point/spotlight but rather a special "reflection/refraction light"
-			
-			// recursive call on the shade function using the previously calculated Ron along with the refraction vector as the new ray direction, in conjunction with the distance to the "refract" object as well as its index. Also increments recursive depth level
-			shade(Ro_refract, Rd_refract, best_refract_t, best_refract_o, lights, refract_ior, depth + 1, refraction_color);
-			
-			// scales the returned refraction vector (from the recursive call return) by the reflectivity property to account for the refraction_color vector
-			refraction_color[0] = refraction_color[0] * refractivity;
-			refraction_color[1] = refraction_color[1] * refractivity;
-			refraction_color[2] = refraction_color[2] * refractivity;
+		}
 		
+		for(int split = 1; split < BVH_BINS; split+=1)
+		{
+			double left_min[3] = {INFINITY, INFINITY, INFINITY};
+			double left_max[3] = {-INFINITY, -INFINITY, -INFINITY};
+			double right_min[3] = {INFINITY, INFINITY, INFINITY};
+			double right_max[3] = {-INFINITY, -INFINITY, -INFINITY};
+			int left_count = 0;
+			int right_count = 0;
 			
-			// stores the previously allocated light object with the refraction vector inverted by -1 as the light's direction, and the refraction_vector vector as the light's color
-			refraction_light->light.direction[0] = refraction_vector[0] * -1;
-			refraction_light->light.direction[1] = refraction_vector[1] * -1; 
-			refraction_light->light.direction[2] = refraction_vector[2] * -1;
-			
-			refraction_light->light.color[0] = refraction_color[0];
-			refraction_light->light.color[1] = refraction_color[1];
-			refraction_light->light.color[2] = refraction_color[2];
-			// end of filling light object
-			
-			
-			// modifies refraction vector by scaling it using the distance to the "refract" object
-			Rd_refract[0] = Rd_refract[0] * best_refract_t;
-			Rd_refract[1] = Rd_refract[1] * best_refract_t;
-			Rd_refract[2] = Rd_refract[2] * best_refract_t;
-			
-			// creates new Rd_refract direction vector and stores the value Rd_refract vector - the new ray origin vector to get the new direction of the refracted ray
-			double Rd_refract_new[3] = {0, 0, 0};
-			
-			Rd_refract_new[0] = Rd_refract[0] - Ron[0];
-			Rd_refract_new[1] = Rd_refract[1] - Ron[1]; 
-			Rd_refract_new[2] = Rd_refract[2] - Ron[2];
-			
-			
-			// normalizes the newly calculated refracted ray's direction vector
-			normalize(Rd_refract_new); 
+			for(int b = 0; b < BVH_BINS; b+=1)
+			{
+				if(bin_count[b] == 0)
+					continue;
+				for(int j = 0; j < 3; j+=1)
+				{
+					if(b < split)
+					{
+						left_min[j] = fmin(left_min[j], bin_min[b][j]);
+						left_max[j] = fmax(left_max[j], bin_max[b][j]);
+					}
+					else
+					{
+						right_min[j] = fmin(right_min[j], bin_min[b][j]);
+						right_max[j] = fmax(right_max[j], bin_max[b][j]);
+					}
+				}
+				if(b < split)
+					left_count += bin_count[b];
+				else
+					right_count += bin_count[b];
+			}
 			
-
-			// calls the direct_shade function using the new ray origin vector along with the refracted ray's direction vector			
-			direct_shade(Ron, Rd_refract_new, Rd, -1, best_i, refraction_light, color); // pass in -1 as distance_to_light because it won't be used since this is a refraction
+			if(left_count == 0 || right_count == 0)
+				continue;
 			
+			double left_extent[3] = {left_max[0] - left_min[0], left_max[1] - left_min[1], left_max[2] - left_min[2]};
+			double right_extent[3] = {right_max[0] - right_min[0], right_max[1] - right_min[1], right_max[2] - right_min[2]};
+			double left_area = left_extent[0] * left_extent[1] + left_extent[1] * left_extent[2] + left_extent[2] * left_extent[0];
+			double right_area = right_extent[0] * right_extent[1] + right_extent[1] * right_extent[2] + right_extent[2] * right_extent[0];
+			double cost = left_area * left_count + right_area * right_count;
 			
-			free(refraction_light);
-		}
-		
-		
-		// adding existing color of the object to newly calculated color vector			
-
-		double color_diff = 1.0 - reflectivity - refractivity;
-
-		double new_color[3] = {0, 0, 0};
-		
-		if(objects[best_i]->kind == 1)
-		{
-			new_color[0] = objects[best_i]->sphere.diffuse_color[0] * color_diff;
-			new_color[1] = objects[best_i]->sphere.diffuse_color[1] * color_diff;
-			new_color[2] = objects[best_i]->sphere.diffuse_color[2] * color_diff;
-		}
-		
-		if(objects[best_i]->kind == 2)
-		{
-			new_color[0] = objects[best_i]->plane.diffuse_color[0] * color_diff;
-			new_color[1] = objects[best_i]->plane.diffuse_color[1] * color_diff;
-			new_color[2] = objects[best_i]->plane.diffuse_color[2] * color_diff;
+			if(cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = k;
+				best_split = split;
+			}
 		}
-		
-		color[0] += new_color[0];
-		color[1] += new_color[1];
-		color[2] += new_color[2];
-			
 	}
+	// end of split evaluation
+	
+	double extent[3] = {node->max[0] - node->min[0], node->max[1] - node->min[1], node->max[2] - node->min[2]};
+	double area = extent[0] * extent[1] + extent[1] * extent[2] + extent[2] * extent[0];
+	
+	// small nodes stay leaves when testing all of their items is no more expensive than the best split (1 traversal step + expected intersection tests)
+	if(count <= BVH_MAX_LEAF && (best_axis == -1 || area * count <= area + best_cost))
+		return index;
 	
-	// checks to see if there was neither a reflection/refraction "intersection" and sets the color to the background accordingly
-	if(best_reflect_o == -1 && best_refract_o == -1) 
+	int mid;
+	if(best_axis == -1) // every centroid coincides so just split the items in half
 	{
-		color[0] += 0;
-		color[1] += 0;
-		color[2] += 0;
+		mid = start + count / 2;
 	}
-	
-			
-	for(int j =  0; lights[j] != 0; j+=1) // new for loop which iterates for every light in the lights array
-	{							
-		Rdn[0] = lights[j]->light.position[0] - Ron[0];
-		Rdn[1] = lights[j]->light.position[1] - Ron[1]; // sets Rdn using current light's position and the previously calculated Ron vector
-		Rdn[2] = lights[j]->light.position[2] - Ron[2];
-		
-		double distance_to_light = sqrt(sqr(Rdn[0]) + sqr(Rdn[1]) + sqr(Rdn[2]));  // calculates the distance to the light using the Rdn vector
-		normalize(Rdn);				
-		
-		
-		// shoots ray to check if there's a "shadow object" using Ron and Rdn vector as well as the previously calculated distance_to_light value as the max distance for the ray
-		double new_best_t = INFINITY; 
-		int best_s = -1; 
-		shoot(Ron, Rdn, distance_to_light, best_i, &new_best_t, &best_s);
-			
-		
-		if(best_s == -1) // no closest shadow was found since best_s was unmodified (would never be set to -1 otherwise)
-		{ 						
-			// since no shadow was found, direct_shade is called to color the point accordingly
-			direct_shade(Ron, Rdn, Rd, distance_to_light, best_i, lights[j], color);
-		}
-		
-		else // shadow was found so color black
+	else
+	{
+		// partitions the items so that everything in a bin below best_split ends up before mid
+		double extent_axis = cmax[best_axis] - cmin[best_axis];
+		mid = start;
+		for(int i = start; i < end; i+=1)
 		{
-			color[0] += 0;
-			color[1] += 0;
-			color[2] += 0;
+			int b = (int)(BVH_BINS * (items[i].centroid[best_axis] - cmin[best_axis]) / extent_axis);
+			if(b >= BVH_BINS)
+				b = BVH_BINS - 1;
+			if(b < best_split)
+			{
+				bvh_item temp = items[i];
+				items[i] = items[mid];
+				items[mid] = temp;
+				mid++;
+			}
 		}
 	}
+	
+	node->count = 0;
+	bvh_build_node(nodes, node_count, items, start, mid, depth + 1); // left child lands at index + 1
+	int right = bvh_build_node(nodes, node_count, items, mid, end, depth + 1);
+	node->offset = right; // the left child always sits at index + 1 so only the right one needs recording
+	
+	return index;
 }
 
-// encapsulates functionality for shooting a ray out into the scene and indirectly returning a distance to the intersected object as well as an index
-void shoot(double Ro[3], double Rd[3], double distance, int current_index, double* final_distance, int* final_index)
-{
-	double best_t = INFINITY;
-	int best_i = -1;
-	for(int i = 0; objects[i] != 0; i += 1)
-	{
-		if(current_index == i)
-			continue;
-		
-		double t = 0;
-		switch(objects[i]->kind) { // switch statement used to check object type and intersection information accordingly
-			case 0: // object is a camera so break
-				break; 
-			case 1: // object is a sphere so calculate sphere intersection
-				t = sphere_intersection(Ro, Rd,
-											objects[i]->sphere.position,
-											objects[i]->sphere.radius);	
-		
-				break;
-			case 2: // object is a plane so calculate plane intersection
-				t = plane_intersection(Ro, Rd,
-											objects[i]->plane.position,
-											objects[i]->plane.normal);
-									
-				break;
-			case 3: // object is a light so break
-				break;
-			default:
-				fprintf(stderr, "Error: Unrecognized object.\n"); // Error in case siwtch doesn't evaluate as a known object but should never happen
-				exit(1);
-			}
-		if(t > distance && distance != INFINITY) // makes sure intersection isn't beyond where we want to project
-			continue;
-		if (t > 0 && t < best_t) // stores new_best_t if there's a dominant shadow intersection. Also stores best_s to record current object index
-			{
-				best_t = t; 
-				best_i = i;
-			} 
-	}
-	*final_distance = best_t; // returns distance to object through pointer 
-	*final_index = best_i; // returns intersected object index through pointer
-}
 
 
 // a function which calculates the reflected vector using a direction/position as well as an object index
-void reflect_vector(double* d, double* p, int index, double* output)
+void reflect_vector(real* d, real* p, int index, real* output)
 {
-	double normal[3];
+	real normal[3];
 	
 	// determining normal value
-	if(objects[index]->kind == 1)
+	surface scratch;
+	surface* sf = hit_surface(index, &scratch);
+	if(sf->kind == 1)
 	{
-		normal[0] = p[0] - objects[index]->sphere.position[0];
-		normal[1] = p[1] - objects[index]->sphere.position[1];
-		normal[2] = p[2] - objects[index]->sphere.position[2];
+		normal[0] = p[0] - sf->position[0];
+		normal[1] = p[1] - sf->position[1];
+		normal[2] = p[2] - sf->position[2];
 	}
-	if(objects[index]->kind == 2)
+	if(sf->kind == 2)
 	{
-		normal[0] = objects[index]->plane.normal[0];
-		normal[1] = objects[index]->plane.normal[1];
-		normal[2] = objects[index]->plane.normal[2];
+		normal[0] = sf->normal[0];
+		normal[1] = sf->normal[1];
+		normal[2] = sf->normal[2];
 	}
 	
 	// normalizes normal
 	normalize(normal);
 	
 	// reflectino process
-	double temp_scalar = 2 * ((normal[0]*d[0]) + (normal[1]*d[1]) + (normal[2]*d[2]));
-	double temp_vector[3];
+	real temp_scalar = 2 * ((normal[0]*d[0]) + (normal[1]*d[1]) + (normal[2]*d[2]));
+	real temp_vector[3];
 	temp_vector[0] = normal[0] * temp_scalar;
 	temp_vector[1] = normal[1] * temp_scalar;
 	temp_vector[2] = normal[2] * temp_scalar;
@@ -1645,28 +7291,20 @@ void reflect_vector(double* d, double* p, int index, double* output)
 }
 
 // a function which calculates the refracted vector using a direction/position and external index of refraction along with an object index
-void refract_vector(double* d, double* p, int external_ior, int index, double* output)
-{
-	double temp_d[3] = {0, 0, 0};
-	double temp_p[3] = {0, 0, 0};
-	double transmit_ior = 0;
-	double normal[3];
-	double coord_1[3];
-	double coord_2[3];
-	double sin_angle = 0;
-	double sin_o = 0;
-	double cos_o = 0;
+void refract_vector(real* d, real* p, int external_ior, int index, real* output)
+{
+	real temp_d[3] = {0, 0, 0};
+	real temp_p[3] = {0, 0, 0};
+	real transmit_ior = 0;
+	real normal[3];
+	real coord_1[3];
+	real coord_2[3];
+	real sin_angle = 0;
+	real sin_o = 0;
+	real cos_o = 0;
 	
 	// determining ior value
-	if(objects[index]->kind == 1)
-	{
-		transmit_ior = objects[index]->sphere.ior;
-	}
-	
-	if(objects[index]->kind == 2)
-	{
-		transmit_ior = objects[index]->plane.ior;
-	}
+	transmit_ior = hit_material(index)->ior;
 	
 	
 	// copying parameters to temp vectors
@@ -1680,17 +7318,19 @@ void refract_vector(double* d, double* p, int external_ior, int index, double* o
 	
 	
 	// determining normal value
-	if(objects[index]->kind == 1)
+	surface scratch;
+	surface* sf = hit_surface(index, &scratch);
+	if(sf->kind == 1)
 	{
-		normal[0] = p[0] - objects[index]->sphere.position[0];
-		normal[1] = p[1] - objects[index]->sphere.position[1];
-		normal[2] = p[2] - objects[index]->sphere.position[2];
+		normal[0] = p[0] - sf->position[0];
+		normal[1] = p[1] - sf->position[1];
+		normal[2] = p[2] - sf->position[2];
 	}
-	if(objects[index]->kind == 2)
+	if(sf->kind == 2)
 	{
-		normal[0] = objects[index]->plane.normal[0];
-		normal[1] = objects[index]->plane.normal[1];
-		normal[2] = objects[index]->plane.normal[2];
+		normal[0] = sf->normal[0];
+		normal[1] = sf->normal[1];
+		normal[2] = sf->normal[2];
 	}
 	
 	// normalizing vectors
@@ -0,0 +1,160 @@
+//
+//  scenegen.c
+//  CS430 Project 4
+//
+//  Frankie Berry
+//
+
+// pre-processor directives
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+// function prototypes
+double next_random(); // returns the next pseudo random number in [0, 1)
+
+double random_range(double low, double high); // returns the next pseudo random number in [low, high)
+
+void write_sphere(double x, double y, double z, double radius); // writes one sphere with a random color/material mix to stdout
+
+void write_light(int spot); // writes one point/spot light with a random position to stdout
+
+
+unsigned long long random_state = 88172645463325252ULL; // xorshift state, seeded from the command line so every platform generates the same scene
+
+int reflective_percent = 0; // percentage of spheres which get a reflectivity
+int refractive_percent = 0; // percentage of spheres which get a refractivity
+double light_intensity = 1; // color of every light, scaled down as more lights are added
+
+int main(int argc, char** argv)
+{
+	// error checking for number of arguments
+	if(argc != 8)
+	{
+		fprintf(stderr, "Error: Incorrect number of arguments; format should be -> [grid|cloud spheres lights spot%% reflective%% refractive%% seed]\n");
+		return -1;
+	}
+
+	char* layout = argv[1]; // spheres on a regular grid or in a random cloud
+	int sphere_count = atoi(argv[2]);
+	int light_count = atoi(argv[3]);
+	int spot_percent = atoi(argv[4]);
+	reflective_percent = atoi(argv[5]);
+	refractive_percent = atoi(argv[6]);
+	random_state ^= (unsigned long long)atoll(argv[7]) * 0x9E3779B97F4A7C15ULL;
+
+	if(strcmp(layout, "grid") != 0 && strcmp(layout, "cloud") != 0)
+	{
+		fprintf(stderr, "Error: Layout must be either grid or cloud\n");
+		return -1;
+	}
+	if(sphere_count < 0 || light_count < 1)
+	{
+		fprintf(stderr, "Error: A scene needs a non-negative number of spheres and at least one light\n");
+		return -1;
+	}
+
+	light_intensity = 2.0 / sqrt(light_count);
+
+	printf("[\n");
+	printf("  {\"type\": \"camera\", \"width\": 1.0, \"height\": 1.0},\n");
+
+	// every sphere lies in the box x = [-4, 4], y = [-3, 3], z = [6, 20] in front of the camera
+	if(strcmp(layout, "grid") == 0)
+	{
+		int side = (int)ceil(cbrt(sphere_count)); // spheres per row of the grid
+		if(side < 1)
+			side = 1;
+		double dx = 8.0 / side;
+		double dy = 6.0 / side;
+		double dz = 14.0 / side;
+		double radius = 0.4 * fmin(dx, fmin(dy, dz));
+
+		for(int i = 0; i < sphere_count; i+=1)
+		{
+			int gx = i % side;
+			int gy = (i / side) % side;
+			int gz = i / (side * side);
+			write_sphere(-4 + (gx + 0.5) * dx, -3 + (gy + 0.5) * dy, 6 + (gz + 0.5) * dz, radius);
+		}
+	}
+	else
+	{
+		double scale = sphere_count > 1000 ? cbrt(1000.0 / sphere_count) : 1; // shrinks the spheres of big clouds so they don't just form a wall
+
+		for(int i = 0; i < sphere_count; i+=1)
+		{
+			double x = random_range(-4, 4);
+			double y = random_range(-3, 3);
+			double z = random_range(6, 20);
+			write_sphere(x, y, z, random_range(0.1, 0.6) * scale);
+		}
+	}
+
+	printf("  {\"type\": \"plane\", \"normal\": [0, 1, 0], \"diffuse_color\": [0.5, 0.5, 0.5], \"specular_color\": [1, 1, 1], \"position\": [0, -3.5, 0], \"reflectivity\": 0.3, \"refractivity\": 0, \"ior\": 1},\n");
+
+	for(int i = 0; i < light_count; i+=1)
+	{
+		write_light(i * 100 < spot_percent * light_count); // the first spot% of the lights are spot lights
+		printf(i + 1 < light_count ? ",\n" : "\n");
+	}
+
+	printf("]\n");
+
+	return 0;
+}
+
+// xorshift64* generator which returns the next pseudo random number in [0, 1)
+double next_random()
+{
+	random_state ^= random_state >> 12;
+	random_state ^= random_state << 25;
+	random_state ^= random_state >> 27;
+	return ((random_state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// returns the next pseudo random number in [low, high)
+double random_range(double low, double high)
+{
+	return low + (high - low) * next_random();
+}
+
+// writes one sphere to stdout; reflective_percent/refractive_percent of them get a reflectivity/refractivity (which never add up to more than 1)
+void write_sphere(double x, double y, double z, double radius)
+{
+	double reflectivity = 0;
+	double refractivity = 0;
+
+	if(next_random() * 100 < reflective_percent)
+		reflectivity = random_range(0.2, 0.8);
+	if(next_random() * 100 < refractive_percent)
+		refractivity = random_range(0.1, 1.0 - reflectivity);
+
+	double r = next_random();
+	double g = next_random();
+	double b = next_random();
+
+	printf("  {\"type\": \"sphere\", \"radius\": %.4f, \"diffuse_color\": [%.3f, %.3f, %.3f], \"specular_color\": [1, 1, 1], \"position\": [%.4f, %.4f, %.4f], \"reflectivity\": %.3f, \"refractivity\": %.3f, \"ior\": %.2f},\n",
+			radius, r, g, b, x, y, z, reflectivity, refractivity, refractivity > 0 ? 1.5 : 1.0);
+}
+
+// writes one point/spot light above the spheres to stdout (without the trailing comma)
+void write_light(int spot)
+{
+	double x = random_range(-5, 5);
+	double y = random_range(2, 6);
+	double z = random_range(0, 10);
+
+	if(spot)
+	{
+		printf("  {\"type\": \"light\", \"color\": [%.3f, %.3f, %.3f], \"position\": [%.3f, %.3f, %.3f], \"direction\": [0, -1, 1], \"theta\": %.1f, \"angular-a0\": 2, \"radial-a2\": 0.02, \"radial-a1\": 0.05, \"radial-a0\": 0.1}",
+				light_intensity, light_intensity, light_intensity, x, y, z, random_range(15, 45));
+	}
+	else
+	{
+		printf("  {\"type\": \"light\", \"color\": [%.3f, %.3f, %.3f], \"position\": [%.3f, %.3f, %.3f], \"radial-a2\": 0.05, \"radial-a1\": 0.05, \"radial-a0\": 0.1}",
+				light_intensity, light_intensity, light_intensity, x, y, z);
+	}
+}